@@ -2,12 +2,37 @@
 #include <iostream>
 #include <random>
 #include "../includes/sdr.hpp"
+#include "../includes/perf_counters.hpp"
 
 std::chrono::system_clock::duration since_epoch()
 {
     return std::chrono::system_clock::now().time_since_epoch();
 }
 
+// hardware events of this thread since before, where they can be counted
+void print_events(const sdr::perf_counters & counters, const sdr::perf_values & before)
+{
+    sdr::perf_values after;
+    if(! counters.read(after)) {
+        return;
+    }
+
+    const sdr::perf_values counted { after - before };
+
+    std::cout << "\t";
+    for(std::size_t i=0; i<sdr::perf_event_count; ++i) {
+        if(counters.available(static_cast<sdr::perf_event>(i))) {
+            std::cout << sdr::perf_event_name(i) << ": " << counted.values[i] << " ";
+        }
+    }
+
+    if(counted[sdr::perf_event::CYCLES]) {
+        std::cout << "ipc: " << static_cast<double>(counted[sdr::perf_event::INSTRUCTIONS]) / counted[sdr::perf_event::CYCLES];
+    }
+
+    std::cout << std::endl;
+}
+
 
 int main()
 {
@@ -19,6 +44,10 @@ int main()
     sdr::bank memory(Width);
     std::vector<std::vector<sdr::position_t>> fields;
 
+    // counts this thread only, so the parallel closest is left out
+    const sdr::perf_counters counters;
+    sdr::perf_values before;
+
     std::vector<double> weights(Width, 1.1);
 
     std::cout << "bench" << std::endl;
@@ -117,6 +146,19 @@ int main()
     }
 
     {
+        counters.read(before);
+        auto start = since_epoch();
+
+        auto closest = memory.closest(1, 10);
+
+        auto end = since_epoch();
+
+        std::cout << "finding closest took: " << std::chrono::duration_cast<std::chrono::milliseconds>(end-start).count() << "ms" << std::endl;
+        print_events(counters, before);
+    }
+
+    {
+        counters.read(before);
         auto start = since_epoch();
 
         auto closest = memory.weighted_closest(1, 10, weights);
@@ -124,6 +166,7 @@ int main()
         auto end = since_epoch();
 
         std::cout << "finding weighted closest took: " << std::chrono::duration_cast<std::chrono::milliseconds>(end-start).count() << "ms" << std::endl;
+        print_events(counters, before);
 
         std::cout << "closest: " << std::endl;
         for(auto & it : closest) {
@@ -135,6 +178,7 @@ int main()
         std::vector<std::size_t> simlist(1000);
         std::iota(simlist.begin(), simlist.end(), 1);
 
+        counters.read(before);
         auto start = since_epoch();
 
         auto similarity = memory.union_similarity(0, simlist);
@@ -142,11 +186,13 @@ int main()
         auto end = since_epoch();
 
         std::cout << "finding union similarity took: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count() << "ns" << std::endl;
+        print_events(counters, before);
 
         std::cout << "similarity: " << similarity << std::endl;
     }
 
     {
+        counters.read(before);
         auto start = since_epoch();
 
         auto matching = memory.matching(sdr::concept({ 0, 10 }));
@@ -154,6 +200,7 @@ int main()
         auto end = since_epoch();
 
         std::cout << "finding matching took: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count() << "ns" << std::endl;
+        print_events(counters, before);
         std::cout << "matching.size() => " << matching.size() << std::endl;
 
         std::cout << "matching: " << std::endl;
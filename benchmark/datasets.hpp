@@ -0,0 +1,263 @@
+#ifndef DATASETS_H
+#define DATASETS_H
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <set>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+#include <unistd.h>
+
+#include "../includes/sdr.hpp"
+
+// synthetic concepts for the benchmarks
+// encoders in the wild set some bits far more often than others and give
+// similar inputs similar concepts, which is what makes columns long and
+// closest and matching slow, so uniform bits alone flatter the bank
+
+// what to generate, the same concepts for the same shape on every run
+struct dataset_shape
+{
+    std::size_t amount;
+    std::size_t width;
+
+    // fraction of width set in a concept
+    double density;
+
+    // bit popularity falls off as 1 / rank^zipf over a shuffled order of
+    // positions, 0 for uniform
+    double zipf;
+
+    // concepts are near duplicates of one of this many centers, 0 for none
+    std::size_t clusters;
+
+    // fraction of a center's bits each of its concepts replaces
+    double noise;
+
+    // a concept's cardinality is drawn from within this fraction either
+    // side of density, 0 for all the same
+    double spread;
+
+    std::uint64_t seed;
+
+    // names the shape's file in a dataset cache
+    std::string name() const
+    {
+        std::stringstream ss;
+        ss  << "a" << amount
+            << "-w" << width
+            << "-d" << density
+            << "-z" << zipf
+            << "-c" << clusters
+            << "-n" << noise
+            << "-v" << spread
+            << "-s" << seed;
+
+        return ss.str();
+    }
+
+    // the seed and every parameter, for a std::seed_seq, with salt telling
+    // apart generators of one shape
+    std::vector<std::uint32_t> seeds(const std::uint32_t salt) const
+    {
+        return std::vector<std::uint32_t> {
+            static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32),
+            static_cast<std::uint32_t>(amount), static_cast<std::uint32_t>(width),
+            static_cast<std::uint32_t>(density * 1000000),
+            static_cast<std::uint32_t>(zipf * 1000000),
+            static_cast<std::uint32_t>(clusters),
+            static_cast<std::uint32_t>(noise * 1000000),
+            static_cast<std::uint32_t>(spread * 1000000),
+            salt
+        };
+    }
+};
+
+struct dataset
+{
+    dataset_shape shape;
+    std::vector<sdr::concept> concepts;
+
+    // positions queried, in the order each thread queries them
+    std::vector<sdr::position_t> targets;
+};
+
+// density of width traits are set in each concept, at least one
+inline std::size_t traits_per_concept(const std::size_t width, const double density)
+{
+    return std::max<std::size_t>(1, static_cast<std::size_t>(width * density + 0.5));
+}
+
+// draws positions with zipf popularity, or uniformly for an exponent of 0
+class bit_sampler
+{
+private:
+    std::size_t width;
+
+    // running sums of each rank's weight, and the position of each rank
+    std::vector<double> cumulative;
+    std::vector<sdr::position_t> ranked;
+
+public:
+    template <typename Generator>
+    bit_sampler(const std::size_t width, const double zipf, Generator & gen)
+    : width(width)
+    , cumulative()
+    , ranked()
+    {
+        if(zipf <= 0.0) {
+            return;
+        }
+
+        ranked.resize(width);
+        std::iota(ranked.begin(), ranked.end(), 0);
+        std::shuffle(ranked.begin(), ranked.end(), gen);
+
+        cumulative.resize(width);
+
+        double sum { 0.0 };
+        for(std::size_t r=0; r<width; ++r) {
+            sum += 1.0 / std::pow(static_cast<double>(r + 1), zipf);
+            cumulative[r] = sum;
+        }
+    }
+
+    template <typename Generator>
+    sdr::position_t operator()(Generator & gen) const
+    {
+        if(cumulative.empty()) {
+            return std::uniform_int_distribution<sdr::position_t>(0, width - 1)(gen);
+        }
+
+        const double u { std::uniform_real_distribution<double>(0.0, cumulative.back())(gen) };
+        const std::size_t r { static_cast<std::size_t>(std::upper_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin()) };
+
+        return ranked[std::min(r, width - 1)];
+    }
+
+    // adds distinct positions to traits until it holds bits of them
+    // popular positions are drawn again and again under heavy skew, so
+    // after enough misses the rest are drawn uniformly
+    template <typename Generator>
+    void fill(std::set<sdr::position_t> & traits, const std::size_t bits, Generator & gen) const
+    {
+        std::uniform_int_distribution<sdr::position_t> uniform(0, width - 1);
+
+        for(std::size_t attempts=0; traits.size() < bits; ++attempts) {
+            traits.insert(attempts < 64 * bits ? (*this)(gen) : uniform(gen));
+        }
+    }
+};
+
+// drawn apart from the concepts, so a cached dataset queries the same
+inline std::vector<sdr::position_t> make_targets(const dataset_shape & shape)
+{
+    const std::vector<std::uint32_t> seeds { shape.seeds(1) };
+    std::seed_seq seq(seeds.begin(), seeds.end());
+    std::mt19937_64 gen(seq);
+    std::uniform_int_distribution<sdr::position_t> adis(0, shape.amount - 1);
+
+    std::vector<sdr::position_t> targets(4096);
+    for(sdr::position_t & target : targets) {
+        target = adis(gen);
+    }
+
+    return targets;
+}
+
+inline dataset make_dataset(const dataset_shape & shape)
+{
+    dataset d { shape, {}, {} };
+
+    const std::vector<std::uint32_t> seeds { shape.seeds(0) };
+    std::seed_seq seq(seeds.begin(), seeds.end());
+    std::mt19937_64 gen(seq);
+
+    const bit_sampler sampler(shape.width, shape.zipf, gen);
+
+    const std::size_t bits { std::min(shape.width, traits_per_concept(shape.width, shape.density)) };
+    std::uniform_int_distribution<std::size_t> cardinality(
+        std::max<std::size_t>(1, static_cast<std::size_t>(bits * (1.0 - shape.spread))),
+        std::min<std::size_t>(shape.width, static_cast<std::size_t>(bits * (1.0 + shape.spread)))
+    );
+
+    std::set<sdr::position_t> traits;
+
+    std::vector<std::vector<sdr::position_t>> centers(shape.clusters);
+    for(std::vector<sdr::position_t> & center : centers) {
+        traits.clear();
+        sampler.fill(traits, bits, gen);
+        center.assign(traits.begin(), traits.end());
+    }
+
+    std::uniform_int_distribution<std::size_t> pick(0, shape.clusters ? shape.clusters - 1 : 0);
+    std::bernoulli_distribution replaced(std::min(1.0, std::max(0.0, shape.noise)));
+
+    d.concepts.reserve(shape.amount);
+
+    for(std::size_t i=0; i<shape.amount; ++i) {
+        const std::size_t wanted { cardinality(gen) };
+        traits.clear();
+
+        // keep each of the center's bits unless replaced, then top up
+        if(! centers.empty()) {
+            for(const sdr::position_t p : centers[pick(gen)]) {
+                if(traits.size() < wanted && ! replaced(gen)) {
+                    traits.insert(p);
+                }
+            }
+        }
+
+        sampler.fill(traits, wanted, gen);
+
+        d.concepts.emplace_back(std::vector<sdr::position_t>(traits.begin(), traits.end()));
+    }
+
+    d.targets = make_targets(shape);
+
+    return d;
+}
+
+// reads the shape's dataset from directory if it was saved there, otherwise
+// generates and saves it
+// an empty directory caches nothing
+inline dataset load_dataset(const dataset_shape & shape, const std::string & directory)
+{
+    if(directory.empty()) {
+        return make_dataset(shape);
+    }
+
+    const std::string path { directory + "/" + shape.name() + ".sdr" };
+
+    if(access(path.c_str(), R_OK) == 0) {
+        sdr::bank memory(shape.width);
+
+        if(memory.load_from_file(path) == shape.amount) {
+            dataset d { shape, {}, {} };
+            d.concepts.reserve(shape.amount);
+
+            for(sdr::position_t i=0; i<shape.amount; ++i) {
+                d.concepts.emplace_back(memory.get_concept(i));
+            }
+
+            d.targets = make_targets(shape);
+            return d;
+        }
+    }
+
+    dataset d { make_dataset(shape) };
+
+    sdr::bank memory(shape.width);
+    memory.bulk_insert(d.concepts);
+    memory.save_to_file(path);
+
+    return d;
+}
+
+#endif
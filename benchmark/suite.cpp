@@ -0,0 +1,925 @@
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <numeric>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include "../includes/sdr.hpp"
+#include "../includes/perf_counters.hpp"
+#include "datasets.hpp"
+#include "../db/server/rw_lock.hpp"
+
+// sweeps every bank primitive over the cartesian product of its parameters
+// and writes one json object per run, see display_usage
+
+typedef std::chrono::steady_clock suite_clock;
+
+std::uint64_t nanoseconds(const suite_clock::time_point from, const suite_clock::time_point to)
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+}
+
+struct suite_options
+{
+    std::vector<std::size_t> amounts { 100000 };
+    std::vector<std::size_t> widths { 2048 };
+    std::vector<double> densities { 0.01 };
+    std::vector<double> zipfs { 0.0 };
+    std::vector<std::size_t> clusters { 0 };
+    double noise { 0.1 };
+    double spread { 0.0 };
+    std::vector<std::size_t> ks { 10 };
+    std::vector<std::size_t> threads { 1 };
+    std::vector<std::string> weight_modes { "unit" };
+    std::vector<std::string> primitives {
+        "insert", "bulk_load", "save", "load",
+        "similarity", "usimilarity", "closest", "weighted_closest", "matching", "matchingx",
+        "mixed"
+    };
+
+    // mixed runs readers against writers for mixed_seconds, each writer
+    // doing write_rates a second, 0 as fast as it can
+    // every reader count is also run without writers, to compare against
+    std::vector<std::size_t> readers { 2 };
+    std::vector<std::size_t> writers { 1 };
+    std::vector<std::size_t> write_rates { 0 };
+    double update_fraction { 0.5 };
+    double closest_fraction { 0.5 };
+    double mixed_seconds { 2.0 };
+
+    // per query primitive and thread, and for building, saving and loading
+    std::size_t repetitions { 200 };
+    std::size_t warmup { 20 };
+    std::size_t build_repetitions { 3 };
+
+    std::uint64_t seed { 1 };
+    std::string path { "bench-suite.sdr" };
+
+    // directory datasets are cached in, see load_dataset
+    std::string cache;
+    std::string output;
+};
+
+std::vector<double> make_weights(const std::string & mode, const std::size_t width, const std::uint64_t seed)
+{
+    std::vector<double> weights(width, 1.0);
+
+    if(mode == "random") {
+        std::mt19937_64 gen(seed);
+        std::uniform_real_distribution<double> dis(0.5, 1.5);
+
+        for(double & w : weights) {
+            w = dis(gen);
+        }
+    }
+
+    return weights;
+}
+
+// the parameters of a run, and what it measured
+struct run
+{
+    std::string primitive;
+    dataset_shape shape;
+
+    // 0 where a primitive does not use them
+    std::size_t k;
+    std::size_t threads;
+    std::string weights;
+
+    std::size_t repetitions;
+    std::size_t warmup;
+
+    // ops each sample covers, amount for insert, bulk_load, save and load
+    std::size_t ops_per_sample;
+
+    std::vector<std::uint64_t> samples;
+    std::uint64_t wall_ns;
+
+    // hardware events per sample, single threaded runs only
+    bool counted;
+    sdr::perf_values events;
+
+    // sum of results, so queries cannot be optimised away
+    std::uint64_t checksum;
+
+    // mixed only, where samples are reads and threads readers
+    std::size_t writers;
+    std::size_t write_rate;
+    std::vector<std::uint64_t> write_samples;
+
+    // read p50 and p99 of the same readers without writers
+    std::uint64_t idle_p50;
+    std::uint64_t idle_p99;
+};
+
+// nearest rank percentile of sorted samples
+std::uint64_t percentile(const std::vector<std::uint64_t> & sorted, const double p)
+{
+    if(sorted.empty()) {
+        return 0;
+    }
+
+    const std::size_t rank { static_cast<std::size_t>(p * (sorted.size() - 1) + 0.5) };
+
+    return sorted[rank];
+}
+
+// "name":{"min":..,"p50":..,...} of sorted
+void write_latencies(std::ostream & os, const char * name, const std::vector<std::uint64_t> & sorted)
+{
+    const std::uint64_t sum { std::accumulate(sorted.begin(), sorted.end(), static_cast<std::uint64_t>(0)) };
+    const double mean { sorted.empty() ? 0.0 : static_cast<double>(sum) / sorted.size() };
+
+    os  << ",\"" << name << "\":{"
+            << "\"min\":" << (sorted.empty() ? 0 : sorted.front())
+            << ",\"p50\":" << percentile(sorted, 0.5)
+            << ",\"p90\":" << percentile(sorted, 0.9)
+            << ",\"p99\":" << percentile(sorted, 0.99)
+            << ",\"p999\":" << percentile(sorted, 0.999)
+            << ",\"max\":" << (sorted.empty() ? 0 : sorted.back())
+            << ",\"mean\":" << mean
+        << "}";
+}
+
+void write_json(std::ostream & os, const run & r)
+{
+    std::vector<std::uint64_t> sorted(r.samples);
+    std::sort(sorted.begin(), sorted.end());
+
+    const double ops { static_cast<double>(sorted.size() * r.ops_per_sample) };
+
+    os  << "{\"primitive\":\"" << r.primitive << "\""
+        << ",\"amount\":" << r.shape.amount
+        << ",\"width\":" << r.shape.width
+        << ",\"density\":" << r.shape.density
+        << ",\"zipf\":" << r.shape.zipf
+        << ",\"clusters\":" << r.shape.clusters
+        << ",\"noise\":" << r.shape.noise
+        << ",\"spread\":" << r.shape.spread
+        << ",\"k\":" << r.k
+        << ",\"threads\":" << r.threads
+        << ",\"weights\":\"" << r.weights << "\""
+        << ",\"repetitions\":" << r.repetitions
+        << ",\"warmup\":" << r.warmup
+        << ",\"ops_per_sample\":" << r.ops_per_sample;
+
+    write_latencies(os, "ns", sorted);
+
+    os << ",\"ops_per_sec\":" << (r.wall_ns ? ops * 1e9 / r.wall_ns : 0.0);
+
+    // writes alongside the reads above, and how much slower reads got
+    if(r.primitive == "mixed") {
+        std::vector<std::uint64_t> writes(r.write_samples);
+        std::sort(writes.begin(), writes.end());
+
+        os  << ",\"writers\":" << r.writers
+            << ",\"write_rate\":" << r.write_rate
+            << ",\"reads_per_write\":" << (writes.empty() ? 0.0 : static_cast<double>(sorted.size()) / writes.size());
+
+        write_latencies(os, "write_ns", writes);
+
+        os  << ",\"writes_per_sec\":" << (r.wall_ns ? writes.size() * 1e9 / r.wall_ns : 0.0)
+            << ",\"read_p50_vs_idle\":" << (r.idle_p50 ? static_cast<double>(percentile(sorted, 0.5)) / r.idle_p50 : 0.0)
+            << ",\"read_p99_vs_idle\":" << (r.idle_p99 ? static_cast<double>(percentile(sorted, 0.99)) / r.idle_p99 : 0.0);
+    }
+
+    if(r.counted && ! sorted.empty()) {
+        os << ",\"events\":{";
+
+        for(std::size_t i=0; i<sdr::perf_event_count; ++i) {
+            os  << (i ? "," : "") << "\"" << sdr::perf_event_name(i) << "\":"
+                << r.events.values[i] / sorted.size();
+        }
+
+        os << "}";
+    }
+
+    os  << ",\"checksum\":" << r.checksum << "}";
+}
+
+// runs query on threads threads, each warming up then timing repetitions
+// calls, the ith call of a thread being query(i)
+// a single thread also counts its hardware events
+void time_queries(run & r, const std::function<std::uint64_t(std::size_t)> & query)
+{
+    std::vector<std::vector<std::uint64_t>> samples(r.threads);
+    std::vector<std::uint64_t> checksums(r.threads, 0);
+
+    auto warm = [&](const std::size_t t) {
+        for(std::size_t i=0; i<r.warmup; ++i) {
+            checksums[t] += query(t * r.repetitions + i);
+        }
+    };
+
+    auto measure = [&](const std::size_t t) {
+        std::vector<std::uint64_t> & mine { samples[t] };
+        mine.reserve(r.repetitions);
+
+        for(std::size_t i=0; i<r.repetitions; ++i) {
+            const suite_clock::time_point start { suite_clock::now() };
+            checksums[t] += query(t * r.repetitions + i);
+            mine.emplace_back(nanoseconds(start, suite_clock::now()));
+        }
+    };
+
+    suite_clock::time_point start;
+
+    if(r.threads == 1) {
+        const sdr::perf_counters counters;
+        sdr::perf_values before;
+        sdr::perf_values after;
+
+        warm(0);
+
+        start = suite_clock::now();
+        const bool counting { counters.read(before) };
+        measure(0);
+        r.counted = counting && counters.read(after);
+        r.events = after - before;
+    } else {
+        // every thread warms up before any is timed, the last one ready
+        // starting the clock
+        std::atomic<std::size_t> ready { 0 };
+
+        std::vector<std::thread> workers;
+        for(std::size_t t=0; t<r.threads; ++t) {
+            workers.emplace_back([&, t]() {
+                warm(t);
+
+                if(++ready == r.threads) {
+                    start = suite_clock::now();
+                }
+
+                while(ready < r.threads) {
+                    std::this_thread::yield();
+                }
+
+                measure(t);
+            });
+        }
+
+        for(std::thread & w : workers) {
+            w.join();
+        }
+    }
+
+    r.wall_ns = nanoseconds(start, suite_clock::now());
+
+    for(std::size_t t=0; t<r.threads; ++t) {
+        r.samples.insert(r.samples.end(), samples[t].begin(), samples[t].end());
+        r.checksum += checksums[t];
+    }
+}
+
+// runs build on a fresh bank build_repetitions times after one warm up
+// prepare is not timed
+void time_builds(
+    run & r,
+    const suite_options & opts,
+    const std::function<void(sdr::bank &)> & prepare,
+    const std::function<std::uint64_t(sdr::bank &)> & build
+) {
+    for(std::size_t i=0; i<1 + opts.build_repetitions; ++i) {
+        sdr::bank memory(r.shape.width);
+        prepare(memory);
+
+        const suite_clock::time_point begin { suite_clock::now() };
+        const std::uint64_t result { build(memory) };
+        const std::uint64_t took { nanoseconds(begin, suite_clock::now()) };
+
+        if(i > 0) {
+            r.samples.emplace_back(took);
+            r.checksum += result;
+        }
+    }
+
+    r.wall_ns = 0;
+    for(const std::uint64_t s : r.samples) {
+        r.wall_ns += s;
+    }
+}
+
+bool wanted(const suite_options & opts, const std::string & primitive)
+{
+    return std::find(opts.primitives.begin(), opts.primitives.end(), primitive) != opts.primitives.end();
+}
+
+run make_run(const std::string & primitive, const dataset & d)
+{
+    run r;
+    r.primitive = primitive;
+    r.shape = d.shape;
+    r.k = 0;
+    r.threads = 1;
+    r.weights = "";
+    r.repetitions = 0;
+    r.warmup = 0;
+    r.ops_per_sample = 1;
+    r.wall_ns = 0;
+    r.counted = false;
+    r.checksum = 0;
+    r.writers = 0;
+    r.write_rate = 0;
+    r.idle_p50 = 0;
+    r.idle_p99 = 0;
+
+    return r;
+}
+
+void run_builds(const suite_options & opts, const dataset & d, std::vector<run> & runs)
+{
+    auto nothing = [](sdr::bank &) {};
+
+    auto fill = [&](sdr::bank & memory) {
+        memory.bulk_insert(d.concepts);
+    };
+
+    auto build = [&](const std::string & primitive, const std::function<void(sdr::bank &)> & prepare, const std::function<std::uint64_t(sdr::bank &)> & timed) {
+        if(! wanted(opts, primitive)) {
+            return;
+        }
+
+        run r { make_run(primitive, d) };
+        r.repetitions = opts.build_repetitions;
+        r.warmup = 1;
+        r.ops_per_sample = d.shape.amount;
+
+        time_builds(r, opts, prepare, timed);
+        runs.emplace_back(std::move(r));
+    };
+
+    build("insert", nothing, [&](sdr::bank & memory) -> std::uint64_t {
+        for(const sdr::concept & concept : d.concepts) {
+            memory.insert(concept);
+        }
+
+        return memory.get_storage_size();
+    });
+
+    build("bulk_load", nothing, [&](sdr::bank & memory) -> std::uint64_t {
+        memory.bulk_insert(d.concepts);
+        return memory.get_storage_size();
+    });
+
+    build("save", fill, [&](sdr::bank & memory) -> std::uint64_t {
+        return memory.save_to_file(opts.path);
+    });
+
+    if(wanted(opts, "load")) {
+        sdr::bank memory(d.shape.width);
+        fill(memory);
+        memory.save_to_file(opts.path);
+
+        build("load", nothing, [&](sdr::bank & memory) -> std::uint64_t {
+            return memory.load_from_file(opts.path);
+        });
+    }
+
+    std::remove(opts.path.c_str());
+}
+
+void run_queries(const suite_options & opts, const dataset & d, std::vector<run> & runs)
+{
+    sdr::bank memory(d.shape.width);
+    memory.bulk_insert(d.concepts);
+
+    auto target = [&](const std::size_t i) -> sdr::position_t {
+        return d.targets[i % d.targets.size()];
+    };
+
+    auto query = [&](const std::string & primitive, const std::size_t k, const std::size_t threads, const std::string & weights, const std::function<std::uint64_t(std::size_t)> & call) {
+        run r { make_run(primitive, d) };
+        r.k = k;
+        r.threads = threads;
+        r.weights = weights;
+        r.repetitions = opts.repetitions;
+        r.warmup = opts.warmup;
+
+        time_queries(r, call);
+        runs.emplace_back(std::move(r));
+
+        std::cerr << "\t" << primitive << " k=" << k << " threads=" << threads << (weights.empty() ? "" : " weights=") << weights << std::endl;
+    };
+
+    for(const std::size_t threads : opts.threads) {
+        if(wanted(opts, "similarity")) {
+            query("similarity", 0, threads, "", [&](const std::size_t i) -> std::uint64_t {
+                return memory.similarity(target(i), target(i + 1));
+            });
+        }
+
+        if(wanted(opts, "matching")) {
+            query("matching", 0, threads, "", [&](const std::size_t i) -> std::uint64_t {
+                return memory.matching(d.concepts[target(i)]).size();
+            });
+        }
+
+        for(const std::size_t k : opts.ks) {
+            // k concepts are unioned
+            if(wanted(opts, "usimilarity")) {
+                query("usimilarity", k, threads, "", [&](const std::size_t i) -> std::uint64_t {
+                    std::vector<std::size_t> others(k);
+                    for(std::size_t j=0; j<k; ++j) {
+                        others[j] = target(i + 1 + j);
+                    }
+
+                    return memory.union_similarity(target(i), others);
+                });
+            }
+
+            if(wanted(opts, "closest")) {
+                query("closest", k, threads, "", [&](const std::size_t i) -> std::uint64_t {
+                    return memory.closest(target(i), k).size();
+                });
+            }
+
+            if(wanted(opts, "weighted_closest")) {
+                for(const std::string & mode : opts.weight_modes) {
+                    const std::vector<double> weights { make_weights(mode, d.shape.width, opts.seed) };
+
+                    query("weighted_closest", k, threads, mode, [&](const std::size_t i) -> std::uint64_t {
+                        return memory.weighted_closest(target(i), k, weights).size();
+                    });
+                }
+            }
+
+            // k of the target's traits have to match, at most all of them
+            if(wanted(opts, "matchingx")) {
+                query("matchingx", k, threads, "", [&](const std::size_t i) -> std::uint64_t {
+                    const sdr::concept & concept { d.concepts[target(i)] };
+                    return memory.matching(concept, std::min(k, concept.data.size())).size();
+                });
+            }
+        }
+    }
+}
+
+// readers query closest and matching while writers insert and update, all
+// on one bank behind the rw_lock sdrdb-server puts around each database,
+// so reads are timed waiting on writes as they would be there
+// writers take their concepts from d in turn and update random positions
+run mixed_once(const suite_options & opts, const dataset & d, const std::size_t k, const std::size_t readers, const std::size_t writers, const std::size_t write_rate)
+{
+    run r { make_run("mixed", d) };
+    r.k = k;
+    r.threads = readers;
+    r.writers = writers;
+    r.write_rate = write_rate;
+
+    sdr::bank memory(d.shape.width);
+    memory.bulk_insert(d.concepts);
+
+    rw_lock lock;
+    std::atomic<bool> stop { false };
+    std::atomic<std::size_t> next_write { 0 };
+
+    std::vector<std::vector<std::uint64_t>> read_samples(readers);
+    std::vector<std::vector<std::uint64_t>> write_samples(writers);
+    std::vector<std::uint64_t> checksums(readers, 0);
+
+    auto reader = [&](const std::size_t t) {
+        std::mt19937_64 gen(opts.seed + t);
+        std::bernoulli_distribution closest(opts.closest_fraction);
+
+        for(std::size_t i=0; ! stop; ++i) {
+            const sdr::position_t target { d.targets[(t * 7919 + i) % d.targets.size()] };
+            const bool is_closest { closest(gen) };
+
+            const suite_clock::time_point start { suite_clock::now() };
+            {
+                const shared_guard guard(lock);
+
+                checksums[t] += is_closest
+                    ? memory.closest(target, k).size()
+                    : memory.matching(d.concepts[target]).size();
+            }
+            read_samples[t].emplace_back(nanoseconds(start, suite_clock::now()));
+        }
+    };
+
+    auto writer = [&](const std::size_t t, const suite_clock::time_point began) {
+        std::mt19937_64 gen(opts.seed + readers + t);
+        std::bernoulli_distribution update(opts.update_fraction);
+
+        for(std::size_t i=0; ! stop; ++i) {
+            if(write_rate) {
+                std::this_thread::sleep_until(began + std::chrono::duration_cast<suite_clock::duration>(std::chrono::duration<double>(static_cast<double>(i) / write_rate)));
+            }
+
+            const sdr::concept & concept { d.concepts[next_write++ % d.concepts.size()] };
+            const bool is_update { update(gen) };
+
+            const suite_clock::time_point start { suite_clock::now() };
+            {
+                const std::lock_guard<rw_lock> guard(lock);
+
+                if(is_update) {
+                    memory.update(std::uniform_int_distribution<sdr::position_t>(0, memory.get_storage_size() - 1)(gen), concept);
+                } else {
+                    memory.insert(concept);
+                }
+            }
+            write_samples[t].emplace_back(nanoseconds(start, suite_clock::now()));
+        }
+    };
+
+    const suite_clock::time_point start { suite_clock::now() };
+
+    std::vector<std::thread> threads;
+    for(std::size_t t=0; t<readers; ++t) {
+        threads.emplace_back(reader, t);
+    }
+
+    for(std::size_t t=0; t<writers; ++t) {
+        threads.emplace_back(writer, t, start);
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(opts.mixed_seconds));
+    stop = true;
+
+    for(std::thread & t : threads) {
+        t.join();
+    }
+
+    r.wall_ns = nanoseconds(start, suite_clock::now());
+
+    for(std::size_t t=0; t<readers; ++t) {
+        r.samples.insert(r.samples.end(), read_samples[t].begin(), read_samples[t].end());
+        r.checksum += checksums[t];
+    }
+
+    for(std::size_t t=0; t<writers; ++t) {
+        r.write_samples.insert(r.write_samples.end(), write_samples[t].begin(), write_samples[t].end());
+    }
+
+    r.repetitions = r.samples.size();
+
+    return r;
+}
+
+void run_mixed(const suite_options & opts, const dataset & d, std::vector<run> & runs)
+{
+    if(! wanted(opts, "mixed")) {
+        return;
+    }
+
+    for(const std::size_t k : opts.ks) {
+        for(const std::size_t readers : opts.readers) {
+            run idle { mixed_once(opts, d, k, readers, 0, 0) };
+
+            std::vector<std::uint64_t> sorted(idle.samples);
+            std::sort(sorted.begin(), sorted.end());
+
+            const std::uint64_t idle_p50 { percentile(sorted, 0.5) };
+            const std::uint64_t idle_p99 { percentile(sorted, 0.99) };
+
+            idle.idle_p50 = idle_p50;
+            idle.idle_p99 = idle_p99;
+            runs.emplace_back(std::move(idle));
+
+            std::cerr << "\tmixed k=" << k << " readers=" << readers << " writers=0" << std::endl;
+
+            for(const std::size_t writers : opts.writers) {
+                for(const std::size_t rate : opts.write_rates) {
+                    run r { mixed_once(opts, d, k, readers, writers, rate) };
+                    r.idle_p50 = idle_p50;
+                    r.idle_p99 = idle_p99;
+                    runs.emplace_back(std::move(r));
+
+                    std::cerr << "\tmixed k=" << k << " readers=" << readers << " writers=" << writers << " rate=" << rate << std::endl;
+                }
+            }
+        }
+    }
+}
+
+template <typename T>
+bool parse_number(const std::string & arg, T & out)
+{
+    if(arg.empty() || ! std::all_of(arg.begin(), arg.end(), ::isdigit)) {
+        return false;
+    }
+
+    out = static_cast<T>(std::stoull(arg));
+    return true;
+}
+
+template <typename T>
+bool parse_list(const std::string & arg, std::vector<T> & out, const std::function<T(const std::string &)> & convert)
+{
+    out.clear();
+
+    std::stringstream ss(arg);
+    std::string item;
+
+    while(std::getline(ss, item, ',')) {
+        try {
+            out.emplace_back(convert(item));
+        } catch(const std::exception &) {
+            return false;
+        }
+    }
+
+    return ! out.empty();
+}
+
+void display_usage()
+{
+    std::cout
+        << "Usage: bench-suite [OPTION]..." << std::endl
+        << "Lists are comma separated and swept as a cartesian product." << std::endl
+        << "Options and arguments:" << std::endl
+        << "-h            : show this help" << std::endl
+        << "-a list       : amounts of concepts (default: 100000)" << std::endl
+        << "-w list       : widths (default: 2048)" << std::endl
+        << "-d list       : fraction of width set in each concept (default: 0.01)" << std::endl
+        << "-z list       : zipf exponent of bit popularity, 0 is uniform (default: 0)" << std::endl
+        << "-C list       : clusters of near duplicate concepts, 0 is none (default: 0)" << std::endl
+        << "-n arg        : fraction of its cluster's bits a concept replaces (default: 0.1)" << std::endl
+        << "-v arg        : cardinality varies this fraction either side of density (default: 0)" << std::endl
+        << "-k list       : results of closest, concepts of usimilarity, traits of matchingx (default: 10)" << std::endl
+        << "-t list       : query threads (default: 1)" << std::endl
+        << "-W list       : weighted closest weights: unit, random (default: unit)" << std::endl
+        << "-p list       : primitives to run (default: all)" << std::endl
+        << "                insert, bulk_load, save, load, similarity, usimilarity," << std::endl
+        << "                closest, weighted_closest, matching, matchingx, mixed" << std::endl
+        << "-R list       : mixed reader threads (default: 2)" << std::endl
+        << "-X list       : mixed writer threads, each run also without writers (default: 1)" << std::endl
+        << "-i list       : mixed writes per second per writer, 0 is unthrottled (default: 0)" << std::endl
+        << "-U arg        : fraction of mixed writes that update rather than insert (default: 0.5)" << std::endl
+        << "-q arg        : fraction of mixed reads that are closest rather than matching (default: 0.5)" << std::endl
+        << "-M arg        : seconds of each mixed run (default: 2)" << std::endl
+        << "-r arg        : timed queries per thread (default: 200)" << std::endl
+        << "-u arg        : warm up queries per thread (default: 20)" << std::endl
+        << "-b arg        : timed runs of insert, bulk_load, save and load (default: 3)" << std::endl
+        << "-s arg        : dataset seed (default: 1)" << std::endl
+        << "-c arg        : directory datasets are saved in and loaded from (default: none)" << std::endl
+        << "-f arg        : file saved to and loaded from (default: bench-suite.sdr)" << std::endl
+        << "-o arg        : write json here rather than to stdout" << std::endl;
+}
+
+int main(int argc, char ** argv)
+{
+    suite_options opts;
+
+    const std::function<std::size_t(const std::string &)> to_size { [](const std::string & s) -> std::size_t {
+        std::size_t v { 0 };
+
+        if(! parse_number(s, v) || v == 0) {
+            throw std::invalid_argument(s);
+        }
+
+        return v;
+    } };
+
+    const std::function<double(const std::string &)> to_density { [](const std::string & s) -> double {
+        const double v { std::stod(s) };
+
+        if(v <= 0.0 || v > 1.0) {
+            throw std::invalid_argument(s);
+        }
+
+        return v;
+    } };
+
+    const std::function<double(const std::string &)> to_fraction { [](const std::string & s) -> double {
+        const double v { std::stod(s) };
+
+        if(v < 0.0 || v > 1.0) {
+            throw std::invalid_argument(s);
+        }
+
+        return v;
+    } };
+
+    const std::function<double(const std::string &)> to_seconds { [](const std::string & s) -> double {
+        const double v { std::stod(s) };
+
+        if(v <= 0.0) {
+            throw std::invalid_argument(s);
+        }
+
+        return v;
+    } };
+
+    const std::function<double(const std::string &)> to_exponent { [](const std::string & s) -> double {
+        const double v { std::stod(s) };
+
+        if(v < 0.0) {
+            throw std::invalid_argument(s);
+        }
+
+        return v;
+    } };
+
+    const std::function<std::size_t(const std::string &)> to_count { [](const std::string & s) -> std::size_t {
+        std::size_t v { 0 };
+
+        if(! parse_number(s, v)) {
+            throw std::invalid_argument(s);
+        }
+
+        return v;
+    } };
+
+    const std::function<std::string(const std::string &)> to_weights { [](const std::string & s) -> std::string {
+        if(s != "unit" && s != "random") {
+            throw std::invalid_argument(s);
+        }
+
+        return s;
+    } };
+
+    const std::function<std::string(const std::string &)> to_primitive { [&](const std::string & s) -> std::string {
+        if(! wanted(suite_options(), s)) {
+            throw std::invalid_argument(s);
+        }
+
+        return s;
+    } };
+
+    {
+        int c;
+        bool ok { true };
+
+        while ((c = getopt (argc, argv, "ha:w:d:z:C:n:v:k:t:W:p:R:X:i:U:q:M:r:u:b:s:c:f:o:")) != -1) {
+            switch (c) {
+            case 'h':
+                display_usage();
+                return EXIT_SUCCESS;
+            case 'a':
+                ok = parse_list(optarg, opts.amounts, to_size);
+                break;
+            case 'w':
+                ok = parse_list(optarg, opts.widths, to_size);
+                break;
+            case 'd':
+                ok = parse_list(optarg, opts.densities, to_density);
+                break;
+            case 'z':
+                ok = parse_list(optarg, opts.zipfs, to_exponent);
+                break;
+            case 'C':
+                ok = parse_list(optarg, opts.clusters, to_count);
+                break;
+            case 'n':
+                {
+                    std::vector<double> v;
+                    ok = parse_list(optarg, v, to_fraction) && v.size() == 1;
+                    opts.noise = ok ? v[0] : 0.0;
+                }
+                break;
+            case 'v':
+                {
+                    std::vector<double> v;
+                    ok = parse_list(optarg, v, to_fraction) && v.size() == 1;
+                    opts.spread = ok ? v[0] : 0.0;
+                }
+                break;
+            case 'c':
+                opts.cache = optarg;
+                break;
+            case 'R':
+                ok = parse_list(optarg, opts.readers, to_size);
+                break;
+            case 'X':
+                ok = parse_list(optarg, opts.writers, to_size);
+                break;
+            case 'i':
+                ok = parse_list(optarg, opts.write_rates, to_count);
+                break;
+            case 'U':
+                {
+                    std::vector<double> v;
+                    ok = parse_list(optarg, v, to_fraction) && v.size() == 1;
+                    opts.update_fraction = ok ? v[0] : 0.0;
+                }
+                break;
+            case 'q':
+                {
+                    std::vector<double> v;
+                    ok = parse_list(optarg, v, to_fraction) && v.size() == 1;
+                    opts.closest_fraction = ok ? v[0] : 0.0;
+                }
+                break;
+            case 'M':
+                {
+                    std::vector<double> v;
+                    ok = parse_list(optarg, v, to_seconds) && v.size() == 1;
+                    opts.mixed_seconds = ok ? v[0] : 0.0;
+                }
+                break;
+            case 'k':
+                ok = parse_list(optarg, opts.ks, to_size);
+                break;
+            case 't':
+                ok = parse_list(optarg, opts.threads, to_size);
+                break;
+            case 'W':
+                ok = parse_list(optarg, opts.weight_modes, to_weights);
+                break;
+            case 'p':
+                ok = parse_list(optarg, opts.primitives, to_primitive);
+                break;
+            case 'r':
+                ok = parse_number(optarg, opts.repetitions) && opts.repetitions > 0;
+                break;
+            case 'u':
+                ok = parse_number(optarg, opts.warmup);
+                break;
+            case 'b':
+                ok = parse_number(optarg, opts.build_repetitions) && opts.build_repetitions > 0;
+                break;
+            case 's':
+                ok = parse_number(optarg, opts.seed);
+                break;
+            case 'f':
+                opts.path = optarg;
+                break;
+            case 'o':
+                opts.output = optarg;
+                break;
+            case '?':
+                ok = false;
+                break;
+            default:
+                abort ();
+            }
+
+            if(! ok) {
+                std::cerr << "bench-suite: bad option: -" << static_cast<char>(c == '?' ? optopt : c) << std::endl;
+                display_usage();
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    std::vector<run> runs;
+
+    std::vector<dataset_shape> shapes;
+
+    for(const std::size_t amount : opts.amounts) {
+        for(const std::size_t width : opts.widths) {
+            for(const double density : opts.densities) {
+                for(const double zipf : opts.zipfs) {
+                    for(const std::size_t clusters : opts.clusters) {
+                        shapes.emplace_back(dataset_shape { amount, width, density, zipf, clusters, opts.noise, opts.spread, opts.seed });
+                    }
+                }
+            }
+        }
+    }
+
+    for(const dataset_shape & shape : shapes) {
+        std::cerr << shape.name() << std::endl;
+
+        const dataset d { load_dataset(shape, opts.cache) };
+
+        run_builds(opts, d, runs);
+        run_queries(opts, d, runs);
+        run_mixed(opts, d, runs);
+    }
+
+    std::ofstream file;
+    if(! opts.output.empty()) {
+        file.open(opts.output);
+
+        if(! file) {
+            std::cerr << "bench-suite: unable to open " << opts.output << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::ostream & os { opts.output.empty() ? std::cout : file };
+
+    os  << "{\"seed\":" << opts.seed
+        << ",\"compiler\":\"" << __VERSION__ << "\""
+        << ",\"hardware_concurrency\":" << std::thread::hardware_concurrency()
+        << ",\"runs\":[" << std::endl;
+
+    for(std::size_t i=0; i<runs.size(); ++i) {
+        write_json(os, runs[i]);
+        os << (i + 1 < runs.size() ? "," : "") << std::endl;
+    }
+
+    os << "]}" << std::endl;
+
+    return EXIT_SUCCESS;
+}
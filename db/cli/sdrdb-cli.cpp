@@ -4,6 +4,9 @@
 #include <chrono>
 #include <algorithm>
 #include <sstream>
+#include <memory>
+#include <vector>
+#include <cstdint>
 
 #include <libsocket/unixclientstream.hpp>
 #include <libsocket/exception.hpp>
@@ -13,6 +16,7 @@
 
 #include "linenoise.h"
 #include "help_block.hpp"
+#include "../common/protocol.hpp"
 
 
 #ifndef SDRDB_VERSION
@@ -21,6 +25,7 @@
 
 
 std::string bindpath { "/tmp/sdrdb.sock" };
+bool binary { false };
 
 std::string trim(const std::string & s)
 {
@@ -45,17 +50,35 @@ void render_help_commands_index()
         << "clear DBNAME\n\tEmpty database" << std::endl
         << "resize DBNAME WIDTH\n\tSet new width for database" << std::endl
 
-        //<< "load from FILE into DBNAME\n\t" << std::endl
-        //<< "save DBNAME to FILE\n\t" << std::endl
+        << "save DBNAME FILE\n\tWrite database snapshot to file" << std::endl
+        << "load DBNAME FILE\n\tReplace database contents with snapshot" << std::endl
+        << "bgsave DBNAME FILE\n\tWrite database snapshot to file in the background" << std::endl
+        << "bgsave status\n\tShow progress of the running or last background save" << std::endl
+        << "stats [DBNAME]\n\tShow counts, errors, bytes and p50/p99/p999 nanoseconds of each phase per command" << std::endl
+        << "slowlog get [AMOUNT]\n\tShow the latest commands slower than the server's -S threshold, newest first (default: 10)" << std::endl
+        << "slowlog reset\n\tForget the slow commands logged so far" << std::endl
+        << "slowlog status\n\tShow the slow log threshold and how many commands it logged" << std::endl
+        << "info cache\n\tShow query cache hits, misses, evictions and size" << std::endl
+        << "info memory\n\tShow the bytes each database holds" << std::endl
+        << "info memory DBNAME [AMOUNT]\n\tShow where a database's bytes go, with its largest columns (default: 10)" << std::endl
+        << "info inflight\n\tShow how many queries were run and how many waited on an identical one" << std::endl
+        << "binary\n\tSwitch the connection to binary frames, see sdrdb-cli -B" << std::endl
+        << "@TAG COMMAND\n\tRun COMMAND apart from the others, answered with @TAG RESPONSE once done" << std::endl
 
         << "put DBNAME TRAIT...\n\t" << std::endl
+        << "mput DBNAME TRAIT... [, TRAIT...]...\n\tInsert many concepts, returns the first and last id" << std::endl
         << "update DBNAME CONCEPT_ID TRAIT....\n\t" << std::endl
+        << "weights DBNAME POSITION WEIGHT...\n\tSet weights used by weighted queries, 1.0 by default" << std::endl
 
         << "query DBNAME [WEIGHTED] similarity CONCEPT CONCEPT\n\t" << std::endl
         << "query DBNAME [WEIGHTED] usimilarity CONCEPT CONCEPT...\n\t" << std::endl
-        << "query DBNAME [WEIGHTED] [ASYNC] closest AMOUNT CONCEPT\n\t" << std::endl
+        << "query DBNAME [WEIGHTED] [ASYNC] closest AMOUNT CONCEPT\n\tASYNC needs a tag, see @TAG" << std::endl
+        << "query DBNAME [WEIGHTED] similarity CONCEPT traits TRAIT...\n\tCompare with traits that are not stored" << std::endl
+        << "query DBNAME [WEIGHTED] usimilarity CONCEPT... traits TRAIT...\n\tCompare traits that are not stored with the union of concepts" << std::endl
+        << "query DBNAME [WEIGHTED] closest AMOUNT traits TRAIT...\n\tClosest to traits that are not stored" << std::endl
         << "query DBNAME matching TRAIT...\n\t" << std::endl
-        << "query DBNAME [WEIGHTED] matchingx AMOUNT TRAIT...\n\t" << std::endl
+        << "query DBNAME matchingx AMOUNT TRAIT...\n\t" << std::endl
+        << "mquery DBNAME closest AMOUNT CONCEPT...\n\tClosest for each concept, results separated by |" << std::endl
         << std::endl;
 }
 
@@ -109,6 +132,45 @@ void render_help_resize()
     item.render();
 }
 
+void render_help_save()
+{
+    const help_block item("save", "write a snapshot of a database to a file on the server", {
+        help_block_arg("DBNAME", "string", true, "the name of the database to save"),
+        help_block_arg("FILE", "string", true, "path to write, recommend .sdr extension"),
+    }, {
+        "save newdb /var/lib/sdrdb/newdb.sdr",
+        "save people people.sdr"
+    });
+
+    item.render();
+}
+
+void render_help_bgsave()
+{
+    const help_block item("bgsave", "write a snapshot of a database without blocking queries", {
+        help_block_arg("DBNAME", "string", true, "the name of the database to save, or status"),
+        help_block_arg("FILE", "string", false, "path to write, recommend .sdr extension"),
+    }, {
+        "bgsave newdb /var/lib/sdrdb/newdb.sdr",
+        "bgsave status"
+    });
+
+    item.render();
+}
+
+void render_help_load()
+{
+    const help_block item("load", "replace a database with a snapshot from a file on the server", {
+        help_block_arg("DBNAME", "string", true, "the name of the database, width must match the file"),
+        help_block_arg("FILE", "string", true, "path of a snapshot written by save"),
+    }, {
+        "load newdb /var/lib/sdrdb/newdb.sdr",
+        "load people people.sdr"
+    });
+
+    item.render();
+}
+
 void render_help_put()
 {
     const help_block item("put", "insert concept into database", {
@@ -250,6 +312,12 @@ void parse_help(const std::string & str)
             render_help_clear();
         } else if(cmd == "resize") {
             render_help_resize();
+        } else if(cmd == "save") {
+            render_help_save();
+        } else if(cmd == "bgsave") {
+            render_help_bgsave();
+        } else if(cmd == "load") {
+            render_help_load();
         } else if(cmd == "put") {
             render_help_put();
         } else if(cmd == "update") {
@@ -296,7 +364,8 @@ void display_usage()
         << "Options and arguments:" << std::endl
         << "-h            : show this help" << std::endl
         << "-v            : show version" << std::endl
-        << "-b arg        : set bindpath for server" << std::endl;
+        << "-b arg        : set bindpath for server" << std::endl
+        << "-B            : talk to the server in binary frames" << std::endl;
 }
 
 void display_version()
@@ -304,30 +373,190 @@ void display_version()
     std::cout << "sdrdb " << SDRDB_VERSION << std::endl;
 }
 
-void send_command(const std::string & cmd)
+// kept open across commands, reconnected if the server goes away
+std::unique_ptr<libsocket::unix_stream_client> sock;
+std::string received;
+
+std::uint32_t next_request_id { 1 };
+
+// the server answers every command except empty ones and comments
+std::vector<std::string> split_commands(const std::string & cmd)
 {
-    constexpr std::size_t buffer_size { 128 };
+    std::vector<std::string> commands;
+    std::size_t start { 0 };
 
-    try {
-        libsocket::unix_stream_client sock(bindpath);
-        sock << cmd;
+    while(start <= cmd.size()) {
+        std::size_t end { cmd.find_first_of(";\n", start) };
+        if(end == std::string::npos) {
+            end = cmd.size();
+        }
+
+        const std::string piece { trim(cmd.substr(start, end - start)) };
+        if(! piece.empty() && piece[0] != '#') {
+            commands.emplace_back(piece);
+        }
+
+        start = end + 1;
+    }
+
+    return commands;
+}
+
+// appends to received, returns false once the server hung up
+bool receive_more()
+{
+    constexpr std::size_t buffer_size { 4096 };
+    char buffer[buffer_size];
+
+    const ssize_t got { sock->rcv(buffer, buffer_size) };
 
-        while(true) {
-            std::string answer;
-            answer.resize(buffer_size);
+    if(got <= 0) {
+        std::cerr << "connection closed by server" << std::endl;
+        sock.reset();
+        return false;
+    }
 
-            sock >> answer;
+    received.append(buffer, static_cast<std::size_t>(got));
 
-            std::cout << answer;
+    return true;
+}
 
-            for(char c : answer) {
-                if(c == '\n') {
-                    goto breaker;
+bool receive_line(std::string & line)
+{
+    std::size_t eol;
+
+    while((eol = received.find('\n')) == std::string::npos) {
+        if(! receive_more()) {
+            return false;
+        }
+    }
+
+    line = received.substr(0, eol + 1);
+    received.erase(0, eol + 1);
+
+    return true;
+}
+
+// prints a response frame the way the text protocol would have
+bool receive_frame()
+{
+    while(received.size() < protocol::header_size
+       || received.size() < protocol::header_size + protocol::get_u32(received.data())) {
+        if(! receive_more()) {
+            return false;
+        }
+    }
+
+    const protocol::header h { protocol::get_header(received.data()) };
+    const char * body { received.data() + protocol::header_size };
+
+    switch(static_cast<protocol::result>(h.extra)) {
+        case protocol::result::NONE:
+            break;
+        case protocol::result::BOOL:
+        case protocol::result::SIZET:
+            std::cout << protocol::get_u32(body) << std::endl;
+            break;
+        case protocol::result::DOUBLE:
+            std::cout << protocol::get_f64(body) << std::endl;
+            break;
+        case protocol::result::STRING:
+            std::cout << std::string(body, h.length) << std::endl;
+            break;
+        case protocol::result::VECSIZET:
+            for(std::size_t i=0; i<h.length; i += 4) {
+                std::cout << (i ? " " : "") << protocol::get_u32(body + i);
+            }
+            std::cout << std::endl;
+            break;
+        case protocol::result::VECPAIRSIZETSIZET:
+            for(std::size_t i=0; i<h.length; i += 8) {
+                std::cout << (i ? " " : "") << protocol::get_u32(body + i) << ":" << protocol::get_u32(body + i + 4);
+            }
+            std::cout << std::endl;
+            break;
+        case protocol::result::VECPAIRSIZETDOUBLE:
+            for(std::size_t i=0; i<h.length; i += 12) {
+                std::cout << (i ? " " : "") << protocol::get_u32(body + i) << ":" << protocol::get_f64(body + i + 4);
+            }
+            std::cout << std::endl;
+            break;
+        case protocol::result::VECVECPAIRSIZETSIZET:
+            {
+                const std::uint32_t lists { protocol::get_u32(body) };
+                std::size_t offset { 4 };
+
+                for(std::uint32_t l=0; l<lists; ++l) {
+                    const std::uint32_t pairs { protocol::get_u32(body + offset) };
+                    offset += 4;
+
+                    std::cout << (l ? " | " : "");
+                    for(std::uint32_t i=0; i<pairs; ++i, offset += 8) {
+                        std::cout << (i ? " " : "") << protocol::get_u32(body + offset) << ":" << protocol::get_u32(body + offset + 4);
+                    }
                 }
+                std::cout << std::endl;
             }
-        } breaker:;
+            break;
+        default:
+            std::cerr << "unknown result type: " << static_cast<unsigned>(h.extra) << std::endl;
+            break;
+    }
+
+    received.erase(0, protocol::header_size + h.length);
+
+    return true;
+}
+
+void open_connection()
+{
+    sock.reset(new libsocket::unix_stream_client(bindpath));
+    received.clear();
+
+    if(binary) {
+        *sock << "binary\n";
+
+        std::string line;
+        if(receive_line(line) && line != "1\n") {
+            std::cerr << "server refused binary mode: " << line;
+        }
+    }
+}
+
+void send_command(const std::string & cmd)
+{
+    try {
+        if(! sock) {
+            open_connection();
+        }
+
+        if(! sock) {
+            return;
+        }
+
+        const std::vector<std::string> commands { split_commands(cmd) };
+
+        if(binary) {
+            std::string frames;
+
+            for(const std::string & command : commands) {
+                frames += protocol::text_request(next_request_id++, command);
+            }
+
+            *sock << frames;
+
+            for(std::size_t i=0; i<commands.size() && receive_frame(); ++i);
+        } else {
+            *sock << cmd;
+
+            std::string line;
+            for(std::size_t i=0; i<commands.size() && receive_line(line); ++i) {
+                std::cout << line;
+            }
+        }
     } catch (const libsocket::socket_exception & exc) {
         std::cerr << exc.mesg;
+        sock.reset();
     }
 }
 
@@ -374,7 +603,7 @@ int main(int argc, char ** argv)
     {
         int c;
 
-        while ((c = getopt (argc, argv, "vhb:")) != -1) {
+        while ((c = getopt (argc, argv, "vhb:B")) != -1) {
             switch (c) {
             case 'v':
                 display_version();
@@ -387,6 +616,9 @@ int main(int argc, char ** argv)
             case 'b':
                 bindpath = optarg;
                 break;
+            case 'B':
+                binary = true;
+                break;
             case '?':
                 std::cerr << "sdrdb-cli: invalid option" << std::endl;
                 display_usage();
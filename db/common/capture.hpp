@@ -0,0 +1,157 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "../../includes/codec.hpp"
+
+// commands as a server received them, written by sdrdb-server -C and fed
+// back by sdrdb-replay
+//
+// file:    "SDRC", u32 version, little endian
+// record:  ns since the record before, as two varints, low then high 32 bits
+//          connection id, as two varints
+//          u8  flags, see capture_binary
+//          varint length of the command
+//          the command as received, with its newline or ';', or the whole
+//          frame of a binary connection
+//
+// a record cut short by the server stopping mid write is dropped on reading
+
+namespace capture
+{
+
+constexpr char magic[4] { 'S', 'D', 'R', 'C' };
+constexpr std::uint32_t version { 1 };
+
+// the command is a binary frame rather than text
+constexpr std::uint8_t capture_binary { 0x01 };
+
+struct record
+{
+    // since the first record
+    std::uint64_t ns;
+    std::uint64_t connection;
+    std::uint8_t flags;
+    std::string command;
+};
+
+inline void put_header(std::vector<std::uint8_t> & out)
+{
+    out.insert(out.end(), magic, magic + sizeof(magic));
+
+    for(std::size_t i=0; i<sizeof(version); ++i) {
+        out.emplace_back(static_cast<std::uint8_t>(version >> (8 * i)));
+    }
+}
+
+inline void put_u64(std::vector<std::uint8_t> & out, const std::uint64_t v)
+{
+    sdr::put_varint(out, static_cast<std::uint32_t>(v));
+    sdr::put_varint(out, static_cast<std::uint32_t>(v >> 32));
+}
+
+inline void put_record(
+    std::vector<std::uint8_t> & out,
+    const std::uint64_t delta_ns,
+    const std::uint64_t connection,
+    const std::uint8_t flags,
+    const char * command,
+    const std::size_t size
+) {
+    put_u64(out, delta_ns);
+    put_u64(out, connection);
+    out.emplace_back(flags);
+    sdr::put_varint(out, static_cast<std::uint32_t>(size));
+    out.insert(out.end(), command, command + size);
+}
+
+inline const std::uint8_t * get_u64(const std::uint8_t * in, const std::uint8_t * end, std::uint64_t & v)
+{
+    std::uint32_t lo, hi;
+
+    in = sdr::get_varint(in, end, lo);
+    if(in == nullptr) {
+        return nullptr;
+    }
+
+    in = sdr::get_varint(in, end, hi);
+    v = (static_cast<std::uint64_t>(hi) << 32) | lo;
+    return in;
+}
+
+// reads every whole record of the file at path into records
+// false if it could not be read or is not a capture
+inline bool read_file(const std::string & path, std::vector<record> & records)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    if(! file) {
+        return false;
+    }
+
+    const std::vector<std::uint8_t> buf {
+        std::istreambuf_iterator<char>(file),
+        std::istreambuf_iterator<char>()
+    };
+
+    constexpr std::size_t header_size { sizeof(magic) + sizeof(version) };
+
+    if(buf.size() < header_size || std::memcmp(buf.data(), magic, sizeof(magic)) != 0) {
+        return false;
+    }
+
+    std::uint32_t file_version { 0 };
+    for(std::size_t i=0; i<sizeof(version); ++i) {
+        file_version |= static_cast<std::uint32_t>(buf[sizeof(magic) + i]) << (8 * i);
+    }
+
+    if(file_version != version) {
+        return false;
+    }
+
+    const std::uint8_t * in { buf.data() + header_size };
+    const std::uint8_t * const end { buf.data() + buf.size() };
+    std::uint64_t now { 0 };
+
+    while(in < end) {
+        record rec;
+        std::uint64_t delta;
+        std::uint32_t size;
+
+        in = get_u64(in, end, delta);
+        if(in != nullptr) {
+            in = get_u64(in, end, rec.connection);
+        }
+
+        if(in == nullptr || in == end) {
+            break;
+        }
+
+        rec.flags = *in++;
+
+        in = sdr::get_varint(in, end, size);
+        if(in == nullptr || static_cast<std::size_t>(end - in) < size) {
+            break;
+        }
+
+        now += delta;
+        rec.ns = now;
+        rec.command.assign(reinterpret_cast<const char *>(in), size);
+        in += size;
+
+        records.emplace_back(std::move(rec));
+    }
+
+    return true;
+}
+
+} //namespace capture
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// binary framing, used by a connection once it sends the text command "binary"
+// all integers are little endian
+//
+// request:  u32 length of everything after the header
+//           u16 opcode
+//           u8  flags, see flag_weighted, flag_traits and flag_async
+//           u8  length of the database name
+//           u32 request id, echoed back in the response
+//           database name, then the arguments as u32s
+//
+// response: u32 length of everything after the header
+//           u16 opcode of the request
+//           u8  status
+//           u8  result type
+//           u32 request id
+//           result: nothing, a u32, an f64, u32s, u32 pairs, u32 f64 pairs,
+//           a string, or for lists of pair lists a u32 count followed by
+//           each list as a u32 count and its pairs, f64s being ieee 754
+//           doubles
+//
+// MPUT takes each concept as a u32 trait count followed by its traits
+// and returns the first and last id given out
+//
+// OP_TEXT carries a text command in place of the name and arguments, so any
+// command can be sent over a binary connection
+
+namespace protocol
+{
+
+constexpr std::size_t header_size { 12 };
+
+// similarity, usimilarity and closest use the database's weights
+constexpr std::uint8_t flag_weighted { 0x01 };
+
+// similarity, usimilarity and closest score the traits at the end of the
+// arguments in place of their first concept, without storing them
+// usimilarity then takes the amount of concepts before the concepts
+constexpr std::uint8_t flag_traits { 0x02 };
+
+// run apart from the frames around it, the response comes back as soon as
+// it is ready and may overtake earlier ones, match it up by request id
+constexpr std::uint8_t flag_async { 0x04 };
+
+enum class opcode : std::uint16_t {
+    TEXT = 0,
+    PUT = 1,
+    UPDATE = 2,
+    SIMILARITY = 3,
+    USIMILARITY = 4,
+    CLOSEST = 5,
+    MATCHING = 6,
+    MATCHINGX = 7,
+    MPUT = 8,
+    MCLOSEST = 9
+};
+
+enum class status : std::uint8_t {
+    OK = 0,
+    ERR = 1
+};
+
+// mirrors result_type on the server
+enum class result : std::uint8_t {
+    NONE = 0,
+    BOOL = 1,
+    SIZET = 2,
+    STRING = 3,
+    VECSIZET = 4,
+    VECPAIRSIZETSIZET = 5,
+    DOUBLE = 6,
+    VECPAIRSIZETDOUBLE = 7,
+    VECVECPAIRSIZETSIZET = 8
+};
+
+struct header
+{
+    std::uint32_t length;
+    std::uint16_t op;
+    std::uint8_t flags;
+
+    // name length in requests, result type in responses
+    std::uint8_t extra;
+    std::uint32_t request_id;
+};
+
+inline void put_u16(std::string & out, const std::uint16_t v)
+{
+    const char bytes[2] {
+        static_cast<char>(v & 0xFF),
+        static_cast<char>(v >> 8)
+    };
+
+    out.append(bytes, 2);
+}
+
+inline void put_u32(std::string & out, const std::uint32_t v)
+{
+    const char bytes[4] {
+        static_cast<char>(v & 0xFF),
+        static_cast<char>((v >> 8) & 0xFF),
+        static_cast<char>((v >> 16) & 0xFF),
+        static_cast<char>(v >> 24)
+    };
+
+    out.append(bytes, 4);
+}
+
+inline void put_f64(std::string & out, const double d)
+{
+    std::uint64_t v;
+    std::memcpy(&v, &d, sizeof(v));
+
+    put_u32(out, static_cast<std::uint32_t>(v));
+    put_u32(out, static_cast<std::uint32_t>(v >> 32));
+}
+
+inline std::uint16_t get_u16(const char * in)
+{
+    const unsigned char * b { reinterpret_cast<const unsigned char *>(in) };
+    return static_cast<std::uint16_t>(b[0] | (b[1] << 8));
+}
+
+inline std::uint32_t get_u32(const char * in)
+{
+    const unsigned char * b { reinterpret_cast<const unsigned char *>(in) };
+
+    return static_cast<std::uint32_t>(b[0])
+        | (static_cast<std::uint32_t>(b[1]) << 8)
+        | (static_cast<std::uint32_t>(b[2]) << 16)
+        | (static_cast<std::uint32_t>(b[3]) << 24);
+}
+
+inline double get_f64(const char * in)
+{
+    const std::uint64_t v { get_u32(in) | (static_cast<std::uint64_t>(get_u32(in + 4)) << 32) };
+
+    double d;
+    std::memcpy(&d, &v, sizeof(d));
+
+    return d;
+}
+
+// in must hold header_size bytes
+inline header get_header(const char * in)
+{
+    header h;
+    h.length = get_u32(in);
+    h.op = get_u16(in + 4);
+    h.flags = static_cast<std::uint8_t>(in[6]);
+    h.extra = static_cast<std::uint8_t>(in[7]);
+    h.request_id = get_u32(in + 8);
+
+    return h;
+}
+
+inline void put_header(std::string & out, const header & h)
+{
+    put_u32(out, h.length);
+    put_u16(out, h.op);
+    out += static_cast<char>(h.flags);
+    out += static_cast<char>(h.extra);
+    put_u32(out, h.request_id);
+}
+
+// returns the offset to write the length at, once the body is appended
+inline std::size_t begin_frame(
+    std::string & out,
+    const std::uint16_t op,
+    const std::uint8_t flags,
+    const std::uint8_t extra,
+    const std::uint32_t request_id
+) {
+    const std::size_t start { out.size() };
+    put_header(out, header { 0, op, flags, extra, request_id });
+
+    return start;
+}
+
+inline void end_frame(std::string & out, const std::size_t start)
+{
+    const std::uint32_t length { static_cast<std::uint32_t>(out.size() - start - header_size) };
+
+    out[start]     = static_cast<char>(length & 0xFF);
+    out[start + 1] = static_cast<char>((length >> 8) & 0xFF);
+    out[start + 2] = static_cast<char>((length >> 16) & 0xFF);
+    out[start + 3] = static_cast<char>(length >> 24);
+}
+
+inline std::string request(
+    const opcode op,
+    const std::uint32_t request_id,
+    const std::string & db_name,
+    const std::vector<std::uint32_t> & args,
+    const std::uint8_t flags = 0
+) {
+    std::string out;
+    out.reserve(header_size + db_name.size() + args.size() * 4);
+
+    const std::size_t start { begin_frame(out, static_cast<std::uint16_t>(op), flags, static_cast<std::uint8_t>(db_name.size()), request_id) };
+    out += db_name;
+
+    for(const std::uint32_t a : args) {
+        put_u32(out, a);
+    }
+
+    end_frame(out, start);
+
+    return out;
+}
+
+inline std::string text_request(const std::uint32_t request_id, const std::string & command)
+{
+    std::string out;
+    out.reserve(header_size + command.size());
+
+    const std::size_t start { begin_frame(out, static_cast<std::uint16_t>(opcode::TEXT), 0, 0, request_id) };
+    out += command;
+    end_frame(out, start);
+
+    return out;
+}
+
+} //namespace protocol
+
+#endif
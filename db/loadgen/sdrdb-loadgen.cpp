@@ -0,0 +1,710 @@
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <libsocket/unixclientstream.hpp>
+#include <libsocket/exception.hpp>
+
+#include "../common/protocol.hpp"
+#include "../../benchmark/datasets.hpp"
+
+#ifndef SDRDB_VERSION
+#define SDRDB_VERSION "0.1-alpha"
+#endif
+
+// open loop load generator
+// requests are sent on a fixed schedule whether or not earlier ones were
+// answered, and each one's latency runs from when it was due rather than
+// when it went out, so a stalled server shows up in the percentiles instead
+// of slowing the load down to what it can take
+
+typedef std::chrono::steady_clock load_clock;
+
+enum class op_kind : std::uint8_t { PUT, UPDATE, CLOSEST, MATCHING, USIMILARITY };
+
+constexpr std::size_t op_kind_count { 5 };
+
+const char * op_name(const std::size_t i)
+{
+    static const char * names[op_kind_count] { "put", "update", "closest", "matching", "usimilarity" };
+    return names[i];
+}
+
+struct loadgen_options
+{
+    std::string bindpath { "/tmp/sdrdb.sock" };
+    std::string db_name { "loadgen" };
+    std::size_t connections { 8 };
+    double rate { 1000.0 };
+    double duration { 10.0 };
+    double interval { 1.0 };
+    bool poisson { false };
+
+    // relative weights of each op_kind
+    std::vector<double> mix { 5.0, 5.0, 60.0, 10.0, 20.0 };
+
+    // results of closest, concepts unioned by usimilarity, traits of matching
+    std::size_t k { 10 };
+    std::size_t union_size { 10 };
+    std::size_t matching_traits { 2 };
+
+    // the database loaded before the run, see dataset_shape
+    dataset_shape shape { 10000, 2048, 0.01, 0.0, 0, 0.1, 0.0, 1 };
+};
+
+// one request sent and not yet answered
+struct pending
+{
+    std::uint32_t request_id;
+    op_kind kind;
+    load_clock::time_point due;
+};
+
+struct connection
+{
+    std::unique_ptr<libsocket::unix_stream_client> client;
+    int fd;
+
+    std::string output;
+    std::size_t output_offset;
+    std::string input;
+
+    // frames are answered in order
+    std::deque<pending> waiting;
+
+    bool writable_watched;
+};
+
+// latencies in nanoseconds, and what happened to them
+struct latencies
+{
+    std::vector<std::uint64_t> ns;
+    std::uint64_t errors;
+
+    latencies()
+    : ns()
+    , errors(0)
+    {}
+
+    std::uint64_t percentile(const double p) const
+    {
+        if(ns.empty()) {
+            return 0;
+        }
+
+        return ns[static_cast<std::size_t>(p * (ns.size() - 1) + 0.5)];
+    }
+
+    // sorts first
+    std::string describe()
+    {
+        std::sort(ns.begin(), ns.end());
+
+        std::stringstream ss;
+        ss  << "done=" << ns.size()
+            << " errors=" << errors
+            << " p50_us=" << percentile(0.5) / 1000
+            << " p99_us=" << percentile(0.99) / 1000
+            << " p999_us=" << percentile(0.999) / 1000
+            << " max_us=" << (ns.empty() ? 0 : ns.back() / 1000);
+
+        return ss.str();
+    }
+};
+
+std::uint64_t nanoseconds(const load_clock::time_point from, const load_clock::time_point to)
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+}
+
+// blocks until a whole frame is in, false if the server hung up
+bool receive_frame(connection & conn, protocol::header & h, std::string & body)
+{
+    char buffer[65536];
+
+    while(conn.input.size() < protocol::header_size
+       || conn.input.size() < protocol::header_size + protocol::get_u32(conn.input.data())) {
+        const ssize_t got { conn.client->rcv(buffer, sizeof(buffer)) };
+
+        if(got <= 0) {
+            return false;
+        }
+
+        conn.input.append(buffer, static_cast<std::size_t>(got));
+    }
+
+    h = protocol::get_header(conn.input.data());
+    body.assign(conn.input.data() + protocol::header_size, h.length);
+    conn.input.erase(0, protocol::header_size + h.length);
+
+    return true;
+}
+
+// connects and switches to binary frames, still blocking
+bool open_connection(const loadgen_options & opts, connection & conn)
+{
+    conn.client.reset(new libsocket::unix_stream_client(opts.bindpath));
+    conn.fd = conn.client->getfd();
+    conn.output_offset = 0;
+    conn.writable_watched = false;
+
+    *conn.client << "binary\n";
+
+    std::string line;
+    char c;
+    while(conn.client->rcv(&c, 1) == 1 && c != '\n') {
+        line += c;
+    }
+
+    if(line != "1") {
+        std::cerr << "sdrdb-loadgen: server refused binary mode: " << line << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// runs a text command over a binary connection, false on an error response
+bool run_text(connection & conn, const std::string & command, std::string & response)
+{
+    *conn.client << protocol::text_request(0, command);
+
+    protocol::header h;
+    if(! receive_frame(conn, h, response)) {
+        return false;
+    }
+
+    return h.flags == static_cast<std::uint8_t>(protocol::status::OK);
+}
+
+// drops and creates the database, then puts the dataset's concepts in it
+// returns the amount stored, 0 on failure
+std::size_t prepare_database(const loadgen_options & opts, const dataset & d)
+{
+    connection conn;
+    if(! open_connection(opts, conn)) {
+        return 0;
+    }
+
+    std::string response;
+    run_text(conn, "drop " + opts.db_name, response);
+
+    if(! run_text(conn, "create " + opts.db_name + " " + std::to_string(opts.shape.width), response)) {
+        std::cerr << "sdrdb-loadgen: unable to create " << opts.db_name << ": " << response << std::endl;
+        return 0;
+    }
+
+    constexpr std::size_t batch_size { 1000 };
+
+    for(std::size_t first=0; first<d.concepts.size(); first += batch_size) {
+        const std::size_t last { std::min(first + batch_size, d.concepts.size()) };
+
+        std::vector<std::uint32_t> args;
+        for(std::size_t i=first; i<last; ++i) {
+            args.emplace_back(static_cast<std::uint32_t>(d.concepts[i].data.size()));
+            args.insert(args.end(), d.concepts[i].data.begin(), d.concepts[i].data.end());
+        }
+
+        *conn.client << protocol::request(protocol::opcode::MPUT, 0, opts.db_name, args);
+
+        protocol::header h;
+        if(! receive_frame(conn, h, response) || h.flags != static_cast<std::uint8_t>(protocol::status::OK)) {
+            std::cerr << "sdrdb-loadgen: preload failed: " << response << std::endl;
+            return 0;
+        }
+    }
+
+    return d.concepts.size();
+}
+
+// builds the requests of the run, drawing payloads from pool and ids from
+// those stored so far
+class request_maker
+{
+private:
+    const loadgen_options & opts;
+    const std::vector<sdr::concept> & pool;
+    std::mt19937_64 gen;
+    std::discrete_distribution<std::size_t> kinds;
+    std::uint32_t next_id;
+
+public:
+    // stored grows with every put answered
+    std::size_t stored;
+
+    request_maker(const loadgen_options & opts, const std::vector<sdr::concept> & pool, const std::size_t stored)
+    : opts(opts)
+    , pool(pool)
+    , gen(opts.shape.seed)
+    , kinds(opts.mix.begin(), opts.mix.end())
+    , next_id(1)
+    , stored(stored)
+    {}
+
+    // appends the next request's frame to out
+    pending make(std::string & out, const load_clock::time_point due)
+    {
+        const op_kind kind { static_cast<op_kind>(kinds(gen)) };
+        const std::uint32_t id { next_id++ };
+
+        // the server takes no concept id 0
+        std::uniform_int_distribution<std::size_t> any_stored(1, stored - 1);
+        const sdr::concept & payload { pool[std::uniform_int_distribution<std::size_t>(0, pool.size() - 1)(gen)] };
+
+        std::vector<std::uint32_t> args;
+        protocol::opcode op { protocol::opcode::PUT };
+        std::uint8_t flags { 0 };
+
+        switch(kind) {
+            case op_kind::PUT:
+                args.assign(payload.data.begin(), payload.data.end());
+                break;
+            case op_kind::UPDATE:
+                op = protocol::opcode::UPDATE;
+                args.emplace_back(static_cast<std::uint32_t>(any_stored(gen)));
+                args.insert(args.end(), payload.data.begin(), payload.data.end());
+                break;
+            case op_kind::CLOSEST:
+                op = protocol::opcode::CLOSEST;
+                flags = protocol::flag_traits;
+                args.emplace_back(static_cast<std::uint32_t>(opts.k));
+                args.insert(args.end(), payload.data.begin(), payload.data.end());
+                break;
+            case op_kind::MATCHING:
+                op = protocol::opcode::MATCHING;
+                args.assign(payload.data.begin(), payload.data.begin() + std::min(opts.matching_traits, payload.data.size()));
+                break;
+            case op_kind::USIMILARITY:
+                op = protocol::opcode::USIMILARITY;
+                for(std::size_t i=0; i<1 + opts.union_size; ++i) {
+                    args.emplace_back(static_cast<std::uint32_t>(any_stored(gen)));
+                }
+                break;
+        }
+
+        out += protocol::request(op, id, opts.db_name, args, flags);
+
+        return pending { id, kind, due };
+    }
+
+    // gap until the next request is due
+    load_clock::duration gap()
+    {
+        const double seconds { opts.poisson ? std::exponential_distribution<double>(opts.rate)(gen) : 1.0 / opts.rate };
+
+        return std::chrono::duration_cast<load_clock::duration>(std::chrono::duration<double>(seconds));
+    }
+};
+
+// op is EPOLL_CTL_ADD or EPOLL_CTL_MOD, writable while output is backed up
+void watch(const int epfd, const int op, connection & conn, const std::size_t index, const bool writable)
+{
+    epoll_event ev;
+    ev.events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.u64 = index;
+
+    epoll_ctl(epfd, op, conn.fd, &ev);
+    conn.writable_watched = writable;
+}
+
+// writes as much output as the socket takes, false if it failed
+bool flush(connection & conn)
+{
+    while(conn.output_offset < conn.output.size()) {
+        const ssize_t sent { ::send(conn.fd, conn.output.data() + conn.output_offset, conn.output.size() - conn.output_offset, MSG_NOSIGNAL) };
+
+        if(sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        conn.output_offset += static_cast<std::size_t>(sent);
+    }
+
+    conn.output.clear();
+    conn.output_offset = 0;
+
+    return true;
+}
+
+int run(const loadgen_options & opts)
+{
+    // the first amount concepts are stored up front, the rest are put,
+    // updated and queried with during the run
+    dataset_shape shape { opts.shape };
+    shape.amount *= 2;
+
+    const dataset d { make_dataset(shape) };
+    const std::vector<sdr::concept> preload(d.concepts.begin(), d.concepts.begin() + opts.shape.amount);
+    const std::vector<sdr::concept> pool(d.concepts.begin() + opts.shape.amount, d.concepts.end());
+
+    const std::size_t stored { prepare_database(opts, dataset { opts.shape, preload, {} }) };
+    if(stored == 0) {
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "loaded " << stored << " concepts into " << opts.db_name << std::endl;
+
+    const int epfd { epoll_create1(0) };
+    std::vector<connection> conns(opts.connections);
+
+    for(std::size_t i=0; i<conns.size(); ++i) {
+        if(! open_connection(opts, conns[i])) {
+            return EXIT_FAILURE;
+        }
+
+        fcntl(conns[i].fd, F_SETFL, fcntl(conns[i].fd, F_GETFL) | O_NONBLOCK);
+        watch(epfd, EPOLL_CTL_ADD, conns[i], i, false);
+    }
+
+    request_maker maker(opts, pool, stored);
+
+    latencies interval;
+    latencies total;
+    latencies kinds[op_kind_count];
+    std::uint64_t sent { 0 };
+    std::uint64_t interval_sent { 0 };
+    std::size_t in_flight { 0 };
+
+    const load_clock::time_point start { load_clock::now() };
+    const load_clock::time_point end { start + std::chrono::duration_cast<load_clock::duration>(std::chrono::duration<double>(opts.duration)) };
+    const load_clock::duration report_every { std::chrono::duration_cast<load_clock::duration>(std::chrono::duration<double>(opts.interval)) };
+
+    // answers still out this long after the end are given up on
+    const load_clock::time_point give_up { end + std::chrono::seconds(5) };
+
+    load_clock::time_point next_due { start };
+    load_clock::time_point next_report { start + report_every };
+    std::size_t next_conn { 0 };
+
+    auto report = [&](const load_clock::time_point now) {
+        const double elapsed { std::chrono::duration<double>(now - start).count() };
+        const double seconds { std::chrono::duration<double>(report_every).count() };
+
+        std::cout
+            << "t=" << static_cast<std::uint64_t>(elapsed + 0.5)
+            << " sent=" << interval_sent
+            << " rps=" << static_cast<std::uint64_t>(interval.ns.size() / seconds)
+            << " " << interval.describe()
+            << " inflight=" << in_flight << std::endl;
+
+        interval = latencies();
+        interval_sent = 0;
+    };
+
+    epoll_event events[64];
+    std::string body;
+
+    while(true) {
+        load_clock::time_point now { load_clock::now() };
+
+        if(now >= end && (in_flight == 0 || now >= give_up)) {
+            break;
+        }
+
+        // every request due by now goes out, however far behind
+        while(next_due <= now && next_due < end) {
+            connection & conn { conns[next_conn] };
+            conn.waiting.emplace_back(maker.make(conn.output, next_due));
+
+            ++sent;
+            ++interval_sent;
+            ++in_flight;
+
+            next_due += maker.gap();
+            next_conn = (next_conn + 1) % conns.size();
+        }
+
+        for(std::size_t i=0; i<conns.size(); ++i) {
+            connection & conn { conns[i] };
+
+            if(conn.output.empty()) {
+                continue;
+            }
+
+            if(! flush(conn)) {
+                std::cerr << "sdrdb-loadgen: connection " << i << " failed" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            const bool backed_up { ! conn.output.empty() };
+            if(backed_up != conn.writable_watched) {
+                watch(epfd, EPOLL_CTL_MOD, conn, i, backed_up);
+            }
+        }
+
+        const load_clock::time_point wake { std::min(next_due < end ? next_due : give_up, next_report) };
+        const int timeout { wake > now ? static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count()) : 0 };
+
+        const int ready { epoll_wait(epfd, events, 64, timeout) };
+
+        for(int e=0; e<ready; ++e) {
+            connection & conn { conns[events[e].data.u64] };
+
+            if(events[e].events & EPOLLOUT) {
+                flush(conn);
+            }
+
+            if(! (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                continue;
+            }
+
+            char buffer[65536];
+            ssize_t got;
+
+            while((got = ::recv(conn.fd, buffer, sizeof(buffer), 0)) > 0) {
+                conn.input.append(buffer, static_cast<std::size_t>(got));
+            }
+
+            if(got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                std::cerr << "sdrdb-loadgen: server closed connection " << events[e].data.u64 << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            const load_clock::time_point arrived { load_clock::now() };
+            std::size_t offset { 0 };
+
+            while(conn.input.size() - offset >= protocol::header_size
+               && conn.input.size() - offset >= protocol::header_size + protocol::get_u32(conn.input.data() + offset)) {
+                const protocol::header h { protocol::get_header(conn.input.data() + offset) };
+                const pending p { conn.waiting.front() };
+                conn.waiting.pop_front();
+                --in_flight;
+
+                const std::uint64_t ns { nanoseconds(p.due, arrived) };
+                const bool error { h.flags != static_cast<std::uint8_t>(protocol::status::OK) || h.request_id != p.request_id };
+
+                // a put is a new id to update and query
+                if(! error && p.kind == op_kind::PUT) {
+                    ++maker.stored;
+                }
+
+                for(latencies * l : { &interval, &total, &kinds[static_cast<std::size_t>(p.kind)] }) {
+                    l->ns.emplace_back(ns);
+                    l->errors += error;
+                }
+
+                offset += protocol::header_size + h.length;
+            }
+
+            conn.input.erase(0, offset);
+        }
+
+        now = load_clock::now();
+        if(now >= next_report) {
+            report(now);
+            next_report += report_every;
+        }
+    }
+
+    const double elapsed { std::chrono::duration<double>(load_clock::now() - start).count() };
+
+    std::cout
+        << "total sent=" << sent
+        << " target_rps=" << opts.rate
+        << " rps=" << static_cast<std::uint64_t>(total.ns.size() / elapsed)
+        << " " << total.describe()
+        << " lost=" << in_flight << std::endl;
+
+    for(std::size_t i=0; i<op_kind_count; ++i) {
+        if(! kinds[i].ns.empty()) {
+            std::cout << op_name(i) << " " << kinds[i].describe() << std::endl;
+        }
+    }
+
+    close(epfd);
+
+    return total.errors == 0 && in_flight == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// "closest=60,put=5" into weights by op_kind, unnamed kinds weigh 0
+bool parse_mix(const std::string & arg, std::vector<double> & mix)
+{
+    mix.assign(op_kind_count, 0.0);
+
+    std::stringstream ss(arg);
+    std::string item;
+
+    while(std::getline(ss, item, ',')) {
+        const std::size_t eq { item.find('=') };
+        if(eq == std::string::npos) {
+            return false;
+        }
+
+        const std::string name { item.substr(0, eq) };
+        std::size_t i { 0 };
+        while(i < op_kind_count && name != op_name(i)) {
+            ++i;
+        }
+
+        if(i == op_kind_count) {
+            return false;
+        }
+
+        try {
+            mix[i] = std::stod(item.substr(eq + 1));
+        } catch(const std::exception &) {
+            return false;
+        }
+
+        if(mix[i] < 0.0) {
+            return false;
+        }
+    }
+
+    return std::any_of(mix.begin(), mix.end(), [](const double w) { return w > 0.0; });
+}
+
+void display_usage()
+{
+    std::cout
+        << "Usage: sdrdb-loadgen [OPTION]..." << std::endl
+        << "Drops and recreates the database, loads it, then sends requests at a fixed rate." << std::endl
+        << "Options and arguments:" << std::endl
+        << "-h            : show this help" << std::endl
+        << "-v            : show version" << std::endl
+        << "-b arg        : bindpath of the server (default: /tmp/sdrdb.sock)" << std::endl
+        << "-D arg        : database to load and query (default: loadgen)" << std::endl
+        << "-c arg        : connections (default: 8)" << std::endl
+        << "-r arg        : requests per second across all connections (default: 1000)" << std::endl
+        << "-d arg        : seconds to send for (default: 10)" << std::endl
+        << "-i arg        : seconds between reports (default: 1)" << std::endl
+        << "-P            : poisson arrivals rather than evenly spaced ones" << std::endl
+        << "-m arg        : mix of put, update, closest, matching and usimilarity" << std::endl
+        << "                (default: put=5,update=5,closest=60,matching=10,usimilarity=20)" << std::endl
+        << "-k arg        : results of closest (default: 10)" << std::endl
+        << "-u arg        : concepts unioned by usimilarity (default: 10)" << std::endl
+        << "-M arg        : traits of matching (default: 2)" << std::endl
+        << "-a arg        : concepts loaded before the run (default: 10000)" << std::endl
+        << "-w arg        : width (default: 2048)" << std::endl
+        << "-p arg        : fraction of width set in each concept (default: 0.01)" << std::endl
+        << "-z arg        : zipf exponent of bit popularity, 0 is uniform (default: 0)" << std::endl
+        << "-C arg        : clusters of near duplicate concepts, 0 is none (default: 0)" << std::endl
+        << "-s arg        : seed (default: 1)" << std::endl;
+}
+
+void display_version()
+{
+    std::cout << "sdrdb-loadgen " << SDRDB_VERSION << std::endl;
+}
+
+int main(int argc, char ** argv)
+{
+    loadgen_options opts;
+
+    {
+        int c;
+        bool ok { true };
+
+        while ((c = getopt (argc, argv, "hvb:D:c:r:d:i:Pm:k:u:M:a:w:p:z:C:s:")) != -1) {
+            try {
+                switch (c) {
+                case 'h':
+                    display_usage();
+                    return EXIT_SUCCESS;
+                case 'v':
+                    display_version();
+                    return EXIT_SUCCESS;
+                case 'b':
+                    opts.bindpath = optarg;
+                    break;
+                case 'D':
+                    opts.db_name = optarg;
+                    ok = ! opts.db_name.empty() && opts.db_name.size() < 256;
+                    break;
+                case 'c':
+                    opts.connections = std::stoul(optarg);
+                    ok = opts.connections > 0;
+                    break;
+                case 'r':
+                    opts.rate = std::stod(optarg);
+                    ok = opts.rate > 0.0;
+                    break;
+                case 'd':
+                    opts.duration = std::stod(optarg);
+                    ok = opts.duration > 0.0;
+                    break;
+                case 'i':
+                    opts.interval = std::stod(optarg);
+                    ok = opts.interval > 0.0;
+                    break;
+                case 'P':
+                    opts.poisson = true;
+                    break;
+                case 'm':
+                    ok = parse_mix(optarg, opts.mix);
+                    break;
+                case 'k':
+                    opts.k = std::stoul(optarg);
+                    ok = opts.k > 0;
+                    break;
+                case 'u':
+                    opts.union_size = std::stoul(optarg);
+                    ok = opts.union_size > 0;
+                    break;
+                case 'M':
+                    opts.matching_traits = std::stoul(optarg);
+                    ok = opts.matching_traits > 0;
+                    break;
+                case 'a':
+                    opts.shape.amount = std::stoul(optarg);
+                    ok = opts.shape.amount > 1;
+                    break;
+                case 'w':
+                    opts.shape.width = std::stoul(optarg);
+                    ok = opts.shape.width > 0;
+                    break;
+                case 'p':
+                    opts.shape.density = std::stod(optarg);
+                    ok = opts.shape.density > 0.0 && opts.shape.density <= 1.0;
+                    break;
+                case 'z':
+                    opts.shape.zipf = std::stod(optarg);
+                    ok = opts.shape.zipf >= 0.0;
+                    break;
+                case 'C':
+                    opts.shape.clusters = std::stoul(optarg);
+                    break;
+                case 's':
+                    opts.shape.seed = std::stoull(optarg);
+                    break;
+                case '?':
+                    ok = false;
+                    break;
+                default:
+                    abort ();
+                }
+            } catch(const std::exception &) {
+                ok = false;
+            }
+
+            if(! ok) {
+                std::cerr << "sdrdb-loadgen: bad option: -" << static_cast<char>(c == '?' ? optopt : c) << std::endl;
+                display_usage();
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    try {
+        return run(opts);
+    } catch (const libsocket::socket_exception & exc) {
+        std::cerr << exc.mesg << std::endl;
+        return EXIT_FAILURE;
+    }
+}
@@ -4,17 +4,48 @@ require('SDRDBException.php');
 
 class SDRDBClient
 {
+    // binary protocol, see db/common/protocol.hpp
+    const OP_TEXT = 0;
+    const OP_PUT = 1;
+    const OP_UPDATE = 2;
+    const OP_SIMILARITY = 3;
+    const OP_USIMILARITY = 4;
+    const OP_CLOSEST = 5;
+    const OP_MATCHING = 6;
+    const OP_MATCHINGX = 7;
+    const OP_MPUT = 8;
+    const OP_MCLOSEST = 9;
+
+    const FLAG_WEIGHTED = 1;
+    const FLAG_TRAITS = 2;
+    const FLAG_ASYNC = 4;
+
+    const STATUS_ERR = 1;
+
+    const RESULT_NONE = 0;
+    const RESULT_BOOL = 1;
+    const RESULT_SIZET = 2;
+    const RESULT_STRING = 3;
+    const RESULT_VECSIZET = 4;
+    const RESULT_VECPAIRSIZETSIZET = 5;
+    const RESULT_DOUBLE = 6;
+    const RESULT_VECPAIRSIZETDOUBLE = 7;
+    const RESULT_VECVECPAIRSIZETSIZET = 8;
+
     protected $bindpath;
     protected $port;
     protected $fp;
     protected $ferrno;
     protected $ferrstr;
     protected $sopen;
+    protected $binary;
+    protected $request_id = 0;
 
-    public function __construct($bindpath, $port = -1)
+    public function __construct($bindpath, $port = -1, $binary = false)
     {
         $this->bindpath = $bindpath;
         $this->port = $port;
+        $this->binary = $binary;
         $this->opensock();
     }
 
@@ -30,7 +61,15 @@ class SDRDBClient
 
         if($this->fp === false) {
             $this->sopen = false;
-            throw new SDRDBException("couldn't bind to $bindpath");
+            throw new SDRDBException("couldn't bind to $this->bindpath");
+        }
+
+        if($this->binary) {
+            $this->write_to_sock("binary\n");
+
+            if($this->read_from_sock() !== "1") {
+                throw new SDRDBException("server refused binary mode");
+            }
         }
     }
 
@@ -56,72 +95,217 @@ class SDRDBClient
         fwrite($this->fp, $data, strlen($data));
     }
 
+    // the connection stays open, every command is answered with one line
     protected function read_from_sock()
     {
         if(! $this->sopen) {
             $this->opensock();
         }
 
-        $res = "";
-        while(!feof($this->fp)) {
-            $res .= fgets($this->fp);
+        $res = fgets($this->fp);
+
+        if($res === false) {
+            $this->closesock();
+            throw new SDRDBException("connection closed by server");
         }
 
-        $this->closesock();
+        return rtrim($res, "\n");
+    }
+
+    protected function read_exact($length)
+    {
+        $res = "";
+
+        while(strlen($res) < $length) {
+            $chunk = fread($this->fp, $length - strlen($res));
+
+            if($chunk === false || $chunk === "") {
+                $this->closesock();
+                throw new SDRDBException("connection closed by server");
+            }
+
+            $res .= $chunk;
+        }
 
         return $res;
     }
 
-    public function create_database($dbname, $amount)
+    protected function frame($op, $dbname, array $args, $text = "", $flags = 0)
     {
-        $this->write_to_sock("create $dbname $amount\n");
+        $body = $op == self::OP_TEXT ? $text : $dbname . pack('V*', ...$args);
+        $name_length = $op == self::OP_TEXT ? 0 : strlen($dbname);
 
-        $res = $this->read_from_sock();
+        return pack('VvCCV', strlen($body), $op, $flags, $name_length, ++$this->request_id) . $body;
+    }
 
-        if($this->is_error($res)) {
-            throw new SDRDBException($res);
+    // returns null, a number, a string, a list of ints or a list of [int, number]
+    protected function read_frame($throw = true, &$request_id = null)
+    {
+        $header = unpack('Vlength/vop/Cstatus/Ctype/Vid', $this->read_exact(12));
+        $body = $header['length'] ? $this->read_exact($header['length']) : "";
+        $request_id = $header['id'];
+
+        if($header['status'] == self::STATUS_ERR) {
+            if($throw) {
+                throw new SDRDBException($body);
+            }
+
+            return $body;
         }
 
-        return (int) $res;
+        switch($header['type']) {
+            case self::RESULT_BOOL:
+            case self::RESULT_SIZET:
+                return unpack('V', $body)[1];
+            case self::RESULT_STRING:
+                return $body;
+            case self::RESULT_VECSIZET:
+                return strlen($body) ? array_values(unpack('V*', $body)) : [];
+            case self::RESULT_VECPAIRSIZETSIZET:
+                return strlen($body) ? array_chunk(array_values(unpack('V*', $body)), 2) : [];
+            case self::RESULT_DOUBLE:
+                return unpack('e', $body)[1];
+            case self::RESULT_VECPAIRSIZETDOUBLE:
+                $ret = [];
+                for($i = 0; $i < strlen($body); $i += 12) {
+                    $pair = unpack('Vid/escore', substr($body, $i, 12));
+                    $ret[] = [$pair['id'], $pair['score']];
+                }
+                return $ret;
+            case self::RESULT_VECVECPAIRSIZETSIZET:
+                $ret = [];
+                $offset = 4;
+                for($l = unpack('V', $body)[1]; $l > 0; --$l) {
+                    $pairs = unpack('V', substr($body, $offset, 4))[1];
+                    $offset += 4;
+                    $ret[] = $pairs ? array_chunk(array_values(unpack('V*', substr($body, $offset, $pairs * 8))), 2) : [];
+                    $offset += $pairs * 8;
+                }
+                return $ret;
+            default:
+                return null;
+        }
     }
 
-    public function drop_database($dbname)
+    // text mode returns the response line, binary mode the decoded frame
+    protected function request($text, $op = self::OP_TEXT, $dbname = "", array $args = [], $flags = 0)
     {
-        $this->write_to_sock("drop $dbname\n");
+        if(! $this->binary) {
+            $this->write_to_sock("$text\n");
+
+            $res = $this->read_from_sock();
 
-        $res = $this->read_from_sock();
+            if($this->is_error($res)) {
+                throw new SDRDBException($res);
+            }
 
-        if($this->is_error($res)) {
-            throw new SDRDBException($res);
+            return $res;
         }
 
-        return (int) $res;
+        $this->write_to_sock($this->frame($op, $dbname, $args, $text, $flags));
+
+        return $this->read_frame();
     }
 
-    public function clear_database($dbname)
+    // sends every command in one write and returns one raw response per command
+    // in binary mode these are decoded frames, and errors are returned rather than thrown
+    public function pipeline(array $commands)
     {
-        $this->write_to_sock("clear $dbname\n");
+        if($this->binary) {
+            $frames = "";
+            foreach($commands as $command) {
+                $frames .= $this->frame(self::OP_TEXT, "", [], $command);
+            }
+            $this->write_to_sock($frames);
+        } else {
+            $this->write_to_sock(implode("\n", $commands) . "\n");
+        }
 
-        $res = $this->read_from_sock();
+        $ret = [];
+        foreach($commands as $command) {
+            $ret[] = $this->binary ? $this->read_frame(false) : $this->read_from_sock();
+        }
 
-        if($this->is_error($res)) {
-            throw new SDRDBException($res);
+        return $ret;
+    }
+
+    // like pipeline, but each command runs on its own on the server so a slow
+    // one does not hold up the rest, responses are put back in order here
+    // comments get no response, so must not be sent
+    public function pipeline_async(array $commands)
+    {
+        $tags = [];
+
+        if($this->binary) {
+            $frames = "";
+            foreach($commands as $i => $command) {
+                $frames .= $this->frame(self::OP_TEXT, "", [], $command, self::FLAG_ASYNC);
+                $tags[$this->request_id] = $i;
+            }
+            $this->write_to_sock($frames);
+        } else {
+            $lines = "";
+            foreach($commands as $i => $command) {
+                $lines .= "@$i $command\n";
+                $tags[$i] = $i;
+            }
+            $this->write_to_sock($lines);
+        }
+
+        $ret = [];
+        while(count($ret) < count($commands)) {
+            if($this->binary) {
+                $res = $this->read_frame(false, $tag);
+            } else {
+                list($tag, $res) = explode(' ', substr($this->read_from_sock(), 1), 2);
+            }
+
+            $ret[$tags[$tag]] = $res;
         }
 
-        return (int) $res;
+        ksort($ret);
+
+        return $ret;
+    }
+
+    public function create_database($dbname, $amount)
+    {
+        return (int) $this->request("create $dbname $amount");
+    }
+
+    public function drop_database($dbname)
+    {
+        return (int) $this->request("drop $dbname");
+    }
+
+    public function clear_database($dbname)
+    {
+        return (int) $this->request("clear $dbname");
     }
 
     public function resize_database($dbname, $amount)
     {
-        $this->write_to_sock("resize $dbname $amount\n");
+        return (int) $this->request("resize $dbname $amount");
+    }
 
-        $res = $this->read_from_sock();
+    public function save_database($dbname, $file)
+    {
+        return (int) $this->request("save $dbname $file");
+    }
 
-        if($this->is_error($res)) {
-            throw new SDRDBException($res);
-        }
+    public function bgsave_database($dbname, $file)
+    {
+        return (int) $this->request("bgsave $dbname $file");
+    }
 
-        return (int) $res;
+    public function bgsave_status()
+    {
+        return trim($this->request("bgsave status"));
+    }
+
+    public function load_database($dbname, $file)
+    {
+        return (int) $this->request("load $dbname $file");
     }
 
     public function put($dbname, array $traits)
@@ -130,15 +314,26 @@ class SDRDBClient
         foreach($traits as $trait) {
             $swrite .= " $trait";
         }
-        $this->write_to_sock("$swrite\n");
 
-        $res = $this->read_from_sock();
+        return (int) $this->request($swrite, self::OP_PUT, $dbname, $traits);
+    }
 
-        if($this->is_error($res)) {
-            throw new SDRDBException($res);
+    // concepts is a list of trait lists, returns [first id, last id]
+    public function mput($dbname, array $concepts)
+    {
+        $swrite = "mput $dbname";
+        $args = [];
+        foreach($concepts as $i => $traits) {
+            $swrite .= ($i ? " ," : "") . " " . implode(" ", $traits);
+            $args[] = count($traits);
+            foreach($traits as $trait) {
+                $args[] = $trait;
+            }
         }
 
-        return (int) $res;
+        $res = $this->request($swrite, self::OP_MPUT, $dbname, $args);
+
+        return $this->binary ? $res : array_map('intval', explode(' ', $res));
     }
 
     public function update($dbname, $concept_id, array $traits)
@@ -147,64 +342,147 @@ class SDRDBClient
         foreach($traits as $trait) {
             $swrite .= " $trait";
         }
-        $this->write_to_sock("$swrite\n");
 
-        $res = $this->read_from_sock();
+        return (int) $this->request($swrite, self::OP_UPDATE, $dbname, array_merge([$concept_id], $traits));
+    }
 
-        if($this->is_error($res)) {
-            throw new SDRDBException($res);
+    // weights maps positions to their weight for weighted queries
+    public function set_weights($dbname, array $weights)
+    {
+        $swrite = "weights $dbname";
+        foreach($weights as $position => $weight) {
+            $swrite .= " $position $weight";
         }
 
-        return (int) $res;
+        return (int) $this->request($swrite);
     }
 
-    public function query_similarity($dbname, $concept_a_id, $concept_b_id)
+    public function query_similarity($dbname, $concept_a_id, $concept_b_id, $weighted = false)
     {
-        $swrite = "query $dbname similarity $concept_a_id $concept_b_id";
-        $this->write_to_sock("$swrite\n");
+        $swrite = "query $dbname" . ($weighted ? " weighted" : "") . " similarity $concept_a_id $concept_b_id";
 
-        $res = $this->read_from_sock();
-
-        if($this->is_error($res)) {
-            throw new SDRDBException($res);
-        }
+        $res = $this->request($swrite, self::OP_SIMILARITY, $dbname, [$concept_a_id, $concept_b_id], $weighted ? self::FLAG_WEIGHTED : 0);
 
-        return (int) $res;
+        return $weighted ? (float) $res : (int) $res;
     }
 
-    public function query_usimilarity($dbname, $concept_id, array $other_concept_ids)
+    public function query_usimilarity($dbname, $concept_id, array $other_concept_ids, $weighted = false)
     {
-        $swrite = "query $dbname usimilarity $concept_id";
+        $swrite = "query $dbname" . ($weighted ? " weighted" : "") . " usimilarity $concept_id";
         foreach($other_concept_ids as $id) {
             $swrite .= " $id";
         }
-        $this->write_to_sock("$swrite\n");
 
-        $res = $this->read_from_sock();
+        $res = $this->request($swrite, self::OP_USIMILARITY, $dbname, array_merge([$concept_id], $other_concept_ids), $weighted ? self::FLAG_WEIGHTED : 0);
 
-        if($this->is_error($res)) {
-            throw new SDRDBException($res);
+        return $weighted ? (float) $res : (int) $res;
+    }
+
+    public function query_closest($dbname, $amount, $concept_id, $weighted = false)
+    {
+        $swrite = "query $dbname" . ($weighted ? " weighted" : "") . " closest $amount $concept_id";
+
+        $res = $this->request($swrite, self::OP_CLOSEST, $dbname, [$amount, $concept_id], $weighted ? self::FLAG_WEIGHTED : 0);
+
+        $ret = [];
+
+        if($this->binary) {
+            foreach($res as $pair) {
+                $ret[$pair[0]] = $pair[1];
+            }
+
+            return $ret;
         }
 
-        return (int) $res;
+        $pieces = explode(' ', $res);
+        foreach($pieces as $p) {
+            $kv = explode(':', $p);
+            $ret[(int) $kv[0]] = $weighted ? (float) $kv[1] : (int) $kv[1];
+        }
+
+        return $ret;
     }
 
-    public function query_closest($dbname, $amount, $concept_id)
+    // returns one closest result per concept id, in the same order
+    public function mquery_closest($dbname, $amount, array $concept_ids)
     {
-        $swrite = "query $dbname closest $amount $concept_id";
-        $this->write_to_sock("$swrite\n");
+        $swrite = "mquery $dbname closest $amount " . implode(" ", $concept_ids);
+
+        $res = $this->request($swrite, self::OP_MCLOSEST, $dbname, array_merge([$amount], $concept_ids));
+
+        $ret = [];
+
+        if($this->binary) {
+            foreach($res as $list) {
+                $closest = [];
+                foreach($list as $pair) {
+                    $closest[$pair[0]] = $pair[1];
+                }
+                $ret[] = $closest;
+            }
 
-        $res = $this->read_from_sock();
+            return $ret;
+        }
 
-        if($this->is_error($res)) {
-            throw new SDRDBException($res);
+        foreach(explode(' | ', $res) as $list) {
+            $closest = [];
+            foreach(explode(' ', $list) as $p) {
+                if($p === "") {
+                    continue;
+                }
+
+                $kv = explode(':', $p);
+                $closest[(int) $kv[0]] = (int) $kv[1];
+            }
+            $ret[] = $closest;
         }
 
+        return $ret;
+    }
+
+    // the *_traits queries score traits that are not stored in place of a concept
+
+    public function query_similarity_traits($dbname, $concept_id, array $traits, $weighted = false)
+    {
+        $swrite = "query $dbname" . ($weighted ? " weighted" : "") . " similarity $concept_id traits " . implode(" ", $traits);
+
+        $res = $this->request($swrite, self::OP_SIMILARITY, $dbname, array_merge([$concept_id], $traits), self::FLAG_TRAITS | ($weighted ? self::FLAG_WEIGHTED : 0));
+
+        return $weighted ? (float) $res : (int) $res;
+    }
+
+    public function query_usimilarity_traits($dbname, array $concept_ids, array $traits, $weighted = false)
+    {
+        $swrite = "query $dbname" . ($weighted ? " weighted" : "") . " usimilarity " . implode(" ", $concept_ids) . " traits " . implode(" ", $traits);
+
+        $res = $this->request($swrite, self::OP_USIMILARITY, $dbname, array_merge([count($concept_ids)], $concept_ids, $traits), self::FLAG_TRAITS | ($weighted ? self::FLAG_WEIGHTED : 0));
+
+        return $weighted ? (float) $res : (int) $res;
+    }
+
+    public function query_closest_traits($dbname, $amount, array $traits, $weighted = false)
+    {
+        $swrite = "query $dbname" . ($weighted ? " weighted" : "") . " closest $amount traits " . implode(" ", $traits);
+
+        $res = $this->request($swrite, self::OP_CLOSEST, $dbname, array_merge([$amount], $traits), self::FLAG_TRAITS | ($weighted ? self::FLAG_WEIGHTED : 0));
+
         $ret = [];
-        $pieces = explode(' ', $res);
-        foreach($pieces as $p) {
+
+        if($this->binary) {
+            foreach($res as $pair) {
+                $ret[$pair[0]] = $pair[1];
+            }
+
+            return $ret;
+        }
+
+        foreach(explode(' ', $res) as $p) {
+            if($p === "") {
+                continue;
+            }
+
             $kv = explode(':', $p);
-            $ret[(int) $kv[0]] = (int) $kv[1];
+            $ret[(int) $kv[0]] = $weighted ? (float) $kv[1] : (int) $kv[1];
         }
 
         return $ret;
@@ -216,12 +494,11 @@ class SDRDBClient
         foreach($traits as $trait) {
             $swrite .= " $trait";
         }
-        $this->write_to_sock("$swrite\n");
 
-        $res = $this->read_from_sock();
+        $res = $this->request($swrite, self::OP_MATCHING, $dbname, $traits);
 
-        if($this->is_error($res)) {
-            throw new SDRDBException($res);
+        if($this->binary) {
+            return $res;
         }
 
         $ret = explode(' ', $res);
@@ -238,12 +515,11 @@ class SDRDBClient
         foreach($traits as $trait) {
             $swrite .= " $trait";
         }
-        $this->write_to_sock("$swrite\n");
 
-        $res = $this->read_from_sock();
+        $res = $this->request($swrite, self::OP_MATCHINGX, $dbname, array_merge([$amount], $traits));
 
-        if($this->is_error($res)) {
-            throw new SDRDBException($res);
+        if($this->binary) {
+            return $res;
         }
 
         $ret = explode(' ', $res);
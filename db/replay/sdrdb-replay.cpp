@@ -0,0 +1,846 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <libsocket/unixclientstream.hpp>
+#include <libsocket/exception.hpp>
+
+#include "../common/protocol.hpp"
+#include "../common/capture.hpp"
+#include "../../includes/constants.hpp"
+
+#ifndef SDRDB_VERSION
+#define SDRDB_VERSION "0.1-alpha"
+#endif
+
+// feeds a capture written by sdrdb-server -C back to a server, one
+// connection per connection captured, and measures each command's latency
+//
+// every connection is switched to binary frames up front and text commands
+// go out inside text frames, so each command gets exactly one response,
+// matched up by request id, whatever the command and however it answers
+// tagged commands keep running apart as async frames
+//
+// paced, commands go out when they arrived in the capture, scaled by -x,
+// and latency runs from then, as in sdrdb-loadgen
+// with -F each connection sends as fast as its answers come back, keeping
+// -q commands in flight, and latency runs from sending
+
+typedef std::chrono::steady_clock replay_clock;
+
+struct snapshot
+{
+    std::string db_name;
+    std::string file;
+};
+
+struct replay_options
+{
+    std::string bindpath { "/tmp/sdrdb.sock" };
+    std::string capture_path;
+    bool fast { false };
+    double speed { 1.0 };
+    std::size_t depth { 1 };
+
+    // loaded before replaying
+    std::vector<snapshot> snapshots;
+
+    // commands of these names are left out, see command_name
+    std::vector<std::string> skip;
+
+    // latencies written to, and compared against
+    std::string save_path;
+    std::string baseline_path;
+};
+
+// one captured command, ready to go out
+struct command
+{
+    std::string frame;
+    std::size_t conn;
+    std::size_t kind;
+    replay_clock::duration due;
+};
+
+struct connection
+{
+    std::unique_ptr<libsocket::unix_stream_client> client;
+    int fd;
+
+    std::string output;
+    std::size_t output_offset;
+    std::string input;
+
+    // indexes of its commands, and how many went out
+    std::vector<std::size_t> commands;
+    std::size_t next;
+    std::size_t in_flight;
+
+    bool writable_watched;
+};
+
+// latencies in nanoseconds, and what happened to them
+struct latencies
+{
+    std::vector<std::uint64_t> ns;
+    std::uint64_t errors;
+
+    latencies()
+    : ns()
+    , errors(0)
+    {}
+
+    // ns must be sorted
+    std::uint64_t percentile(const double p) const
+    {
+        if(ns.empty()) {
+            return 0;
+        }
+
+        return ns[static_cast<std::size_t>(p * (ns.size() - 1) + 0.5)];
+    }
+};
+
+const double percentiles[] { 0.5, 0.9, 0.99, 0.999, 1.0 };
+const char * percentile_names[] { "p50", "p90", "p99", "p999", "max" };
+constexpr std::size_t percentile_count { sizeof(percentiles) / sizeof(percentiles[0]) };
+
+std::uint64_t nanoseconds(const replay_clock::time_point from, const replay_clock::time_point to)
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+}
+
+const char * opcode_name(const std::uint16_t op)
+{
+    static const char * names[] {
+        "text", "put", "update", "similarity", "usimilarity",
+        "closest", "matching", "matchingx", "mput", "mclosest"
+    };
+
+    return op < sizeof(names) / sizeof(names[0]) ? names[op] : "unknown";
+}
+
+std::string tolower(std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(), [](const unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+
+    return s;
+}
+
+// a text command without its delimiter and tag, false if it was tagged
+bool untag(const std::string & captured, std::string & text)
+{
+    text = captured;
+
+    while(! text.empty() && (text.back() == '\n' || text.back() == ';' || text.back() == '\r')) {
+        text.pop_back();
+    }
+
+    std::size_t i { 0 };
+    while(i < text.size() && std::isspace(static_cast<unsigned char>(text[i]))) {
+        ++i;
+    }
+
+    if(i == text.size() || text[i] != '@') {
+        return false;
+    }
+
+    while(i < text.size() && ! std::isspace(static_cast<unsigned char>(text[i]))) {
+        ++i;
+    }
+
+    text.erase(0, i);
+    return true;
+}
+
+// a command's first word, and for queries the kind of query, as in
+// "query closest", so latencies are told apart by what was asked
+std::string command_name(const std::string & text)
+{
+    std::stringstream ss(text);
+    std::string word;
+
+    if(! (ss >> word)) {
+        return "empty";
+    }
+
+    const std::string name { tolower(word) };
+
+    if(name != "query" && name != "mquery") {
+        return name;
+    }
+
+    // past the database name and any modifiers
+    ss >> word;
+    while(ss >> word) {
+        const std::string w { tolower(word) };
+
+        if(w != "weighted" && w != "async") {
+            return name + " " + w;
+        }
+    }
+
+    return name;
+}
+
+// blocks until a whole frame is in, false if the server hung up
+bool receive_frame(connection & conn, protocol::header & h, std::string & body)
+{
+    char buffer[65536];
+
+    while(conn.input.size() < protocol::header_size
+       || conn.input.size() < protocol::header_size + protocol::get_u32(conn.input.data())) {
+        const ssize_t got { conn.client->rcv(buffer, sizeof(buffer)) };
+
+        if(got <= 0) {
+            return false;
+        }
+
+        conn.input.append(buffer, static_cast<std::size_t>(got));
+    }
+
+    h = protocol::get_header(conn.input.data());
+    body.assign(conn.input.data() + protocol::header_size, h.length);
+    conn.input.erase(0, protocol::header_size + h.length);
+
+    return true;
+}
+
+// connects and switches to binary frames, still blocking
+bool open_connection(const replay_options & opts, connection & conn)
+{
+    conn.client.reset(new libsocket::unix_stream_client(opts.bindpath));
+    conn.fd = conn.client->getfd();
+    conn.output_offset = 0;
+    conn.next = 0;
+    conn.in_flight = 0;
+    conn.writable_watched = false;
+
+    *conn.client << "binary\n";
+
+    std::string line;
+    char c;
+    while(conn.client->rcv(&c, 1) == 1 && c != '\n') {
+        line += c;
+    }
+
+    if(line != "1") {
+        std::cerr << "sdrdb-replay: server refused binary mode: " << line << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// runs a text command over a binary connection, false on an error response
+bool run_text(connection & conn, const std::string & text, std::string & response)
+{
+    *conn.client << protocol::text_request(0, text);
+
+    protocol::header h;
+    if(! receive_frame(conn, h, response)) {
+        return false;
+    }
+
+    return h.flags == static_cast<std::uint8_t>(protocol::status::OK);
+}
+
+// snapshots are loaded by the server, so they must not depend on cwd
+std::string absolute_path(const std::string & path)
+{
+    if(path.empty() || path[0] == '/') {
+        return path;
+    }
+
+    char * cwd { getcwd(nullptr, 0) };
+
+    if(cwd == nullptr) {
+        return path;
+    }
+
+    const std::string ret { std::string(cwd) + "/" + path };
+    free(cwd);
+
+    return ret;
+}
+
+// width written in a snapshot's header, 0 if it is not one
+std::size_t snapshot_width(const std::string & file)
+{
+    std::ifstream ifs(file, std::ios::binary);
+    std::uint32_t header[3];
+
+    if(! ifs.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != sdr::F_PREFIX) {
+        return 0;
+    }
+
+    return header[2];
+}
+
+// drops and recreates each snapshot's database, then loads it
+bool load_snapshots(const replay_options & opts)
+{
+    if(opts.snapshots.empty()) {
+        return true;
+    }
+
+    connection conn;
+    if(! open_connection(opts, conn)) {
+        return false;
+    }
+
+    for(const snapshot & s : opts.snapshots) {
+        const std::string file { absolute_path(s.file) };
+        const std::size_t width { snapshot_width(file) };
+
+        if(width == 0) {
+            std::cerr << "sdrdb-replay: not a snapshot: " << file << std::endl;
+            return false;
+        }
+
+        std::string response;
+        run_text(conn, "drop " + s.db_name, response);
+
+        if(! run_text(conn, "create " + s.db_name + " " + std::to_string(width), response)
+        || ! run_text(conn, "load " + s.db_name + " " + file, response)) {
+            std::cerr << "sdrdb-replay: unable to load " << file << " into " << s.db_name << ": " << response << std::endl;
+            return false;
+        }
+
+        // the amount loaded, as a u32
+        std::cout << "loaded " << (response.size() == 4 ? protocol::get_u32(response.data()) : 0) << " concepts into " << s.db_name << std::endl;
+    }
+
+    return true;
+}
+
+// op is EPOLL_CTL_ADD or EPOLL_CTL_MOD, writable while output is backed up
+void watch(const int epfd, const int op, connection & conn, const std::size_t index, const bool writable)
+{
+    epoll_event ev;
+    ev.events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.u64 = index;
+
+    epoll_ctl(epfd, op, conn.fd, &ev);
+    conn.writable_watched = writable;
+}
+
+// writes as much output as the socket takes, false if it failed
+bool flush(connection & conn)
+{
+    while(conn.output_offset < conn.output.size()) {
+        const ssize_t sent { ::send(conn.fd, conn.output.data() + conn.output_offset, conn.output.size() - conn.output_offset, MSG_NOSIGNAL) };
+
+        if(sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        conn.output_offset += static_cast<std::size_t>(sent);
+    }
+
+    conn.output.clear();
+    conn.output_offset = 0;
+
+    return true;
+}
+
+// turns the capture into frames for the connections they will go out on
+// request ids are each command's index plus one
+// kinds holds the name of each command kind met
+void prepare(
+    const replay_options & opts,
+    const std::vector<capture::record> & records,
+    std::vector<command> & commands,
+    std::vector<connection> & conns,
+    std::vector<std::string> & kinds,
+    std::size_t & skipped
+) {
+    std::map<std::uint64_t, std::size_t> conn_index;
+    std::map<std::string, std::size_t> kind_index;
+
+    for(const capture::record & rec : records) {
+        const bool binary { (rec.flags & capture::capture_binary) != 0 };
+
+        std::string text;
+        bool tagged { false };
+
+        if(binary) {
+            if(rec.command.size() < protocol::header_size) {
+                ++skipped;
+                continue;
+            }
+
+            const protocol::header h { protocol::get_header(rec.command.data()) };
+
+            if(h.op == static_cast<std::uint16_t>(protocol::opcode::TEXT)) {
+                text = rec.command.substr(protocol::header_size);
+            }
+        } else {
+            tagged = untag(rec.command, text);
+        }
+
+        const std::string name { binary && text.empty()
+            ? opcode_name(protocol::get_header(rec.command.data()).op)
+            : command_name(text)
+        };
+
+        // replayed connections are binary from the start
+        if(name == "binary" || std::find(opts.skip.begin(), opts.skip.end(), name) != opts.skip.end()) {
+            ++skipped;
+            continue;
+        }
+
+        const std::uint32_t id { static_cast<std::uint32_t>(commands.size() + 1) };
+        command cmd;
+
+        if(binary) {
+            std::string id_bytes;
+            protocol::put_u32(id_bytes, id);
+
+            cmd.frame = rec.command;
+            cmd.frame.replace(8, 4, id_bytes);
+        } else {
+            cmd.frame = protocol::text_request(id, text);
+
+            if(tagged) {
+                cmd.frame[6] = static_cast<char>(protocol::flag_async);
+            }
+        }
+
+        const auto c = conn_index.emplace(rec.connection, conn_index.size());
+        if(c.second) {
+            conns.emplace_back();
+        }
+
+        const auto k = kind_index.emplace(name, kinds.size());
+        if(k.second) {
+            kinds.emplace_back(name);
+        }
+
+        cmd.conn = c.first->second;
+        cmd.kind = k.first->second;
+        cmd.due = std::chrono::duration_cast<replay_clock::duration>(
+            std::chrono::duration<double, std::nano>(static_cast<double>(rec.ns) / opts.speed)
+        );
+
+        conns[cmd.conn].commands.emplace_back(commands.size());
+        commands.emplace_back(std::move(cmd));
+    }
+}
+
+// "kind count errors p50 p90 p99 p999 max", nanoseconds, a line each
+void save_latencies(const std::string & path, const std::map<std::string, latencies> & results)
+{
+    std::ofstream ofs(path);
+
+    for(const auto & r : results) {
+        ofs << r.first << "\t" << r.second.ns.size() << "\t" << r.second.errors;
+
+        for(std::size_t p=0; p<percentile_count; ++p) {
+            ofs << "\t" << r.second.percentile(percentiles[p]);
+        }
+
+        ofs << "\n";
+    }
+}
+
+// prints each kind's percentiles as a ratio of those saved at path
+bool compare_latencies(const std::string & path, const std::map<std::string, latencies> & results)
+{
+    std::ifstream ifs(path);
+
+    if(! ifs) {
+        std::cerr << "sdrdb-replay: unable to read baseline: " << path << std::endl;
+        return false;
+    }
+
+    std::cout << "against " << path << std::endl;
+
+    std::string line;
+    while(std::getline(ifs, line)) {
+        std::stringstream ss(line);
+        std::string name;
+        std::uint64_t count, errors;
+        std::uint64_t baseline[percentile_count];
+
+        if(! std::getline(ss, name, '\t') || ! (ss >> count >> errors)) {
+            continue;
+        }
+
+        std::size_t p { 0 };
+        while(p < percentile_count && ss >> baseline[p]) {
+            ++p;
+        }
+
+        const auto it = results.find(name);
+        if(p != percentile_count || it == results.end()) {
+            continue;
+        }
+
+        std::cout << name << " count=" << it->second.ns.size() << "/" << count;
+
+        for(p=0; p<percentile_count; ++p) {
+            std::cout << " " << percentile_names[p] << "=";
+
+            if(baseline[p] == 0) {
+                std::cout << "-";
+            } else {
+                std::cout << "x" << static_cast<double>(it->second.percentile(percentiles[p])) / baseline[p];
+            }
+        }
+
+        std::cout << std::endl;
+    }
+
+    return true;
+}
+
+int run(const replay_options & opts)
+{
+    std::vector<capture::record> records;
+
+    if(! capture::read_file(opts.capture_path, records)) {
+        std::cerr << "sdrdb-replay: not a capture: " << opts.capture_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<command> commands;
+    std::vector<connection> conns;
+    std::vector<std::string> kinds;
+    std::size_t skipped { 0 };
+
+    prepare(opts, records, commands, conns, kinds, skipped);
+
+    std::cout
+        << "capture of " << records.size() << " commands over "
+        << (records.empty() ? 0.0 : records.back().ns / 1e9) << "s, "
+        << commands.size() << " to replay on " << conns.size() << " connections, "
+        << skipped << " skipped" << std::endl;
+
+    if(commands.empty() || ! load_snapshots(opts)) {
+        return commands.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    const int epfd { epoll_create1(0) };
+
+    for(std::size_t i=0; i<conns.size(); ++i) {
+        if(! open_connection(opts, conns[i])) {
+            return EXIT_FAILURE;
+        }
+
+        fcntl(conns[i].fd, F_SETFL, fcntl(conns[i].fd, F_GETFL) | O_NONBLOCK);
+        watch(epfd, EPOLL_CTL_ADD, conns[i], i, false);
+    }
+
+    // when each command went out, or was due when paced, by request id - 1
+    std::vector<replay_clock::time_point> started(commands.size());
+    std::vector<latencies> by_kind(kinds.size());
+    latencies total;
+
+    std::size_t sent { 0 };
+    std::size_t in_flight { 0 };
+    std::size_t next_due { 0 };
+
+    const replay_clock::time_point start { replay_clock::now() };
+
+    // a run that stops hearing back for this long is given up on
+    const replay_clock::duration give_up { std::chrono::seconds(10) };
+    replay_clock::time_point last_heard { start };
+
+    auto send = [&](const std::size_t i, const replay_clock::time_point from) {
+        connection & conn { conns[commands[i].conn] };
+
+        conn.output += commands[i].frame;
+        ++conn.next;
+        ++conn.in_flight;
+
+        started[i] = from;
+        ++sent;
+        ++in_flight;
+    };
+
+    epoll_event events[64];
+
+    while(true) {
+        const replay_clock::time_point now { replay_clock::now() };
+
+        if(sent == commands.size() && in_flight == 0) {
+            break;
+        }
+
+        if(in_flight && now - last_heard >= give_up) {
+            break;
+        }
+
+        if(opts.fast) {
+            for(connection & conn : conns) {
+                while(conn.next < conn.commands.size() && conn.in_flight < opts.depth) {
+                    send(conn.commands[conn.next], now);
+                }
+            }
+        } else {
+            // every command due by now goes out, however far behind
+            while(next_due < commands.size() && start + commands[next_due].due <= now) {
+                send(next_due, start + commands[next_due].due);
+                ++next_due;
+            }
+        }
+
+        for(std::size_t i=0; i<conns.size(); ++i) {
+            connection & conn { conns[i] };
+
+            if(conn.output.empty()) {
+                continue;
+            }
+
+            if(! flush(conn)) {
+                std::cerr << "sdrdb-replay: connection " << i << " failed" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            const bool backed_up { ! conn.output.empty() };
+            if(backed_up != conn.writable_watched) {
+                watch(epfd, EPOLL_CTL_MOD, conn, i, backed_up);
+            }
+        }
+
+        int timeout { 100 };
+        if(! opts.fast && next_due < commands.size()) {
+            const replay_clock::time_point wake { start + commands[next_due].due };
+            timeout = wake > now ? static_cast<int>(std::min<std::int64_t>(100, std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count())) : 0;
+        }
+
+        const int ready { epoll_wait(epfd, events, 64, timeout) };
+
+        for(int e=0; e<ready; ++e) {
+            connection & conn { conns[events[e].data.u64] };
+
+            if(events[e].events & EPOLLOUT) {
+                flush(conn);
+            }
+
+            if(! (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                continue;
+            }
+
+            char buffer[65536];
+            ssize_t got;
+
+            while((got = ::recv(conn.fd, buffer, sizeof(buffer), 0)) > 0) {
+                conn.input.append(buffer, static_cast<std::size_t>(got));
+            }
+
+            if(got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                std::cerr << "sdrdb-replay: server closed connection " << events[e].data.u64 << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            const replay_clock::time_point arrived { replay_clock::now() };
+            std::size_t offset { 0 };
+
+            while(conn.input.size() - offset >= protocol::header_size
+               && conn.input.size() - offset >= protocol::header_size + protocol::get_u32(conn.input.data() + offset)) {
+                const protocol::header h { protocol::get_header(conn.input.data() + offset) };
+                offset += protocol::header_size + h.length;
+
+                if(h.request_id == 0 || h.request_id > commands.size()) {
+                    std::cerr << "sdrdb-replay: response to unknown request " << h.request_id << std::endl;
+                    continue;
+                }
+
+                const std::size_t i { h.request_id - 1 };
+                const std::uint64_t ns { nanoseconds(started[i], arrived) };
+                const bool error { h.flags != static_cast<std::uint8_t>(protocol::status::OK) };
+
+                for(latencies * l : { &total, &by_kind[commands[i].kind] }) {
+                    l->ns.emplace_back(ns);
+                    l->errors += error;
+                }
+
+                --conn.in_flight;
+                --in_flight;
+                last_heard = arrived;
+            }
+
+            conn.input.erase(0, offset);
+        }
+    }
+
+    const double elapsed { std::chrono::duration<double>(replay_clock::now() - start).count() };
+
+    std::map<std::string, latencies> results;
+    results["all"] = std::move(total);
+    for(std::size_t k=0; k<kinds.size(); ++k) {
+        results[kinds[k]] = std::move(by_kind[k]);
+    }
+
+    std::cout << "replayed in " << elapsed << "s, rps=" << static_cast<std::uint64_t>(results["all"].ns.size() / elapsed)
+        << " lost=" << in_flight << " unsent=" << (commands.size() - sent) << std::endl;
+
+    for(auto & r : results) {
+        std::sort(r.second.ns.begin(), r.second.ns.end());
+
+        std::cout << r.first << " done=" << r.second.ns.size() << " errors=" << r.second.errors;
+
+        for(std::size_t p=0; p<percentile_count; ++p) {
+            std::cout << " " << percentile_names[p] << "_us=" << r.second.percentile(percentiles[p]) / 1000;
+        }
+
+        std::cout << std::endl;
+    }
+
+    if(! opts.save_path.empty()) {
+        save_latencies(opts.save_path, results);
+    }
+
+    if(! opts.baseline_path.empty() && ! compare_latencies(opts.baseline_path, results)) {
+        return EXIT_FAILURE;
+    }
+
+    close(epfd);
+
+    return in_flight == 0 && sent == commands.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// "put,update" into names
+std::vector<std::string> parse_names(const std::string & arg)
+{
+    std::vector<std::string> names;
+    std::stringstream ss(arg);
+    std::string item;
+
+    while(std::getline(ss, item, ',')) {
+        if(! item.empty()) {
+            names.emplace_back(tolower(item));
+        }
+    }
+
+    return names;
+}
+
+void display_usage()
+{
+    std::cout
+        << "Usage: sdrdb-replay [OPTION]... CAPTURE" << std::endl
+        << "Replays a capture written by sdrdb-server -C and reports each kind of command's latency." << std::endl
+        << "Options and arguments:" << std::endl
+        << "-h            : show this help" << std::endl
+        << "-v            : show version" << std::endl
+        << "-b arg        : bindpath of the server (default: /tmp/sdrdb.sock)" << std::endl
+        << "-l arg        : DBNAME:FILE, drop and recreate DBNAME from a snapshot first, repeatable" << std::endl
+        << "-F            : as fast as possible rather than at the captured pacing," << std::endl
+        << "                commands on different connections lose their order" << std::endl
+        << "-x arg        : speed up the captured pacing by this factor (default: 1)" << std::endl
+        << "-q arg        : commands in flight on each connection with -F (default: 1)" << std::endl
+        << "-s arg        : comma separated commands to skip, as reported, e.g. put,update,save" << std::endl
+        << "-o arg        : save latencies to this file" << std::endl
+        << "-c arg        : compare latencies with those saved by -o" << std::endl;
+}
+
+void display_version()
+{
+    std::cout << "sdrdb-replay " << SDRDB_VERSION << std::endl;
+}
+
+int main(int argc, char ** argv)
+{
+    replay_options opts;
+
+    {
+        int c;
+        bool ok { true };
+
+        while ((c = getopt (argc, argv, "hvb:l:Fx:q:s:o:c:")) != -1) {
+            try {
+                switch (c) {
+                case 'h':
+                    display_usage();
+                    return EXIT_SUCCESS;
+                case 'v':
+                    display_version();
+                    return EXIT_SUCCESS;
+                case 'b':
+                    opts.bindpath = optarg;
+                    break;
+                case 'l':
+                    {
+                        const std::string arg { optarg };
+                        const std::size_t colon { arg.find(':') };
+
+                        ok = colon != std::string::npos && colon > 0 && colon + 1 < arg.size();
+                        if(ok) {
+                            opts.snapshots.emplace_back(snapshot { arg.substr(0, colon), arg.substr(colon + 1) });
+                        }
+                    }
+                    break;
+                case 'F':
+                    opts.fast = true;
+                    break;
+                case 'x':
+                    opts.speed = std::stod(optarg);
+                    ok = opts.speed > 0.0;
+                    break;
+                case 'q':
+                    opts.depth = std::stoul(optarg);
+                    ok = opts.depth > 0;
+                    break;
+                case 's':
+                    opts.skip = parse_names(optarg);
+                    break;
+                case 'o':
+                    opts.save_path = optarg;
+                    break;
+                case 'c':
+                    opts.baseline_path = optarg;
+                    break;
+                case '?':
+                    ok = false;
+                    break;
+                default:
+                    abort ();
+                }
+            } catch(const std::exception &) {
+                ok = false;
+            }
+
+            if(! ok) {
+                std::cerr << "sdrdb-replay: bad option: -" << static_cast<char>(c == '?' ? optopt : c) << std::endl;
+                display_usage();
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    if(optind + 1 != argc) {
+        std::cerr << "sdrdb-replay: expected one capture file" << std::endl;
+        display_usage();
+        return EXIT_FAILURE;
+    }
+
+    opts.capture_path = argv[optind];
+
+    try {
+        return run(opts);
+    } catch (const libsocket::socket_exception & exc) {
+        std::cerr << exc.mesg << std::endl;
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,189 @@
+#ifndef BGSAVE_H
+#define BGSAVE_H
+
+#include <string>
+#include <sstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// snapshots a database in a forked child
+// the child sees a copy on write image of the server as it was at fork,
+// so it can stream that out while the parent keeps serving and mutating
+//
+// only the forking thread carries on in the child, and any lock another
+// thread held at fork stays held there for good, so the child keeps to:
+//  - the bank, which the caller holds its database's lock on across fork,
+//    so no writer is midway through it
+//  - allocating and writing files through iostreams, which glibc keeps
+//    usable by taking malloc's and stdio's locks around fork and resetting
+//    them in the child
+// it never touches the server's own locks, those of the wal, the capture
+// log, the pool or another database, and leaves by _exit so no static
+// destructor or atexit handler runs; work must keep to the same
+class background_save
+{
+public:
+    // shared with the child through an anonymous shared mapping
+    struct progress
+    {
+        std::atomic<std::uint64_t> written;
+        std::atomic<std::uint64_t> total;
+    };
+
+private:
+    std::mutex mtx;
+    std::thread reaper;
+    progress * shared;
+
+    pid_t pid;
+    std::string db_name;
+    std::string file;
+    std::chrono::steady_clock::time_point started;
+
+    bool has_last;
+    bool last_ok;
+    std::string last_db_name;
+    std::string last_file;
+    std::int64_t last_duration_ms;
+
+    void reap(const pid_t child, const std::function<void(bool)> on_done)
+    {
+        int status { 0 };
+        while(waitpid(child, &status, 0) < 0 && errno == EINTR);
+
+        const bool ok { WIFEXITED(status) && WEXITSTATUS(status) == 0 };
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+
+            has_last = true;
+            last_ok = ok;
+            last_db_name = db_name;
+            last_file = file;
+            last_duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - started
+            ).count();
+        }
+
+        on_done(ok);
+
+        std::lock_guard<std::mutex> lock(mtx);
+        pid = 0;
+    }
+
+public:
+    background_save()
+    : shared(nullptr)
+    , pid(0)
+    , has_last(false)
+    , last_ok(false)
+    , last_duration_ms(0)
+    {
+        void * mem { mmap(nullptr, sizeof(progress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0) };
+
+        if(mem != MAP_FAILED) {
+            shared = new (mem) progress();
+        }
+    }
+
+    ~background_save()
+    {
+        if(reaper.joinable()) {
+            reaper.join();
+        }
+
+        if(shared != nullptr) {
+            munmap(shared, sizeof(progress));
+        }
+    }
+
+    bool running()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return pid != 0;
+    }
+
+    // work runs in the child and returns whether the snapshot was written
+    // on_done runs in the parent, on the reaper thread, once the child exits
+    // returns false if a save is already running or fork fails
+    bool start(
+        const std::string & name,
+        const std::string & path,
+        const std::size_t total,
+        const std::function<bool(progress &)> & work,
+        const std::function<void(bool)> & on_done
+    ) {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        if(pid != 0 || shared == nullptr) {
+            return false;
+        }
+
+        if(reaper.joinable()) {
+            reaper.join();
+        }
+
+        shared->written = 0;
+        shared->total = total;
+
+        const pid_t child { fork() };
+
+        if(child < 0) {
+            return false;
+        }
+
+        if(child == 0) {
+            _exit(work(*shared) ? 0 : 1);
+        }
+
+        pid = child;
+        db_name = name;
+        file = path;
+        started = std::chrono::steady_clock::now();
+
+        reaper = std::thread(&background_save::reap, this, child, on_done);
+
+        return true;
+    }
+
+    std::string status()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::stringstream ss;
+
+        if(pid != 0) {
+            ss  << "running"
+                << " db=" << db_name
+                << " file=" << file
+                << " progress=" << shared->written << "/" << shared->total
+                << " elapsed_ms=" << std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - started
+                ).count();
+        } else {
+            ss << "idle";
+        }
+
+        if(has_last) {
+            ss  << " last_db=" << last_db_name
+                << " last_file=" << last_file
+                << " last_status=" << (last_ok ? "ok" : "failed")
+                << " last_duration_ms=" << last_duration_ms;
+        }
+
+        return ss.str();
+    }
+};
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef CAPTURE_LOG_H
+#define CAPTURE_LOG_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../common/capture.hpp"
+
+// writes every command received to a capture file, see db/common/capture.hpp
+// commands are appended by the event loop as they arrive and written out by
+// a flusher thread, so capturing costs the loop a copy and an uncontended lock
+// nothing is synced, a capture is not worth an fsync
+class capture_log
+{
+private:
+    typedef std::chrono::steady_clock capture_clock;
+
+    // how often pending is written out, and how much wakes the flusher early
+    static constexpr std::size_t flush_ms { 100 };
+    static constexpr std::size_t flush_bytes { 1024 * 1024 };
+
+    // past this much unwritten, commands are dropped rather than held
+    static constexpr std::size_t max_pending { 64 * 1024 * 1024 };
+
+    std::string path;
+    int fd;
+
+    std::mutex mtx;
+    std::condition_variable wake;
+    std::thread flusher;
+
+    std::vector<std::uint8_t> pending;
+    capture_clock::time_point last;
+    bool started;
+    bool stopping;
+
+    std::uint64_t captured;
+    std::uint64_t dropped;
+
+    bool write_out(const std::vector<std::uint8_t> & buf)
+    {
+        std::size_t off { 0 };
+
+        while(off < buf.size()) {
+            const ssize_t n { ::write(fd, buf.data() + off, buf.size() - off) };
+
+            if(n < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+
+                std::cerr << "capture write failed: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+
+            off += static_cast<std::size_t>(n);
+        }
+
+        return true;
+    }
+
+    // caller must hold lock, which is released around the io
+    void flush_pending(std::unique_lock<std::mutex> & lock)
+    {
+        std::vector<std::uint8_t> batch;
+        batch.swap(pending);
+
+        lock.unlock();
+        write_out(batch);
+        lock.lock();
+    }
+
+    void flusher_loop()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+
+        while(! stopping) {
+            wake.wait_for(lock, std::chrono::milliseconds(flush_ms));
+
+            if(! pending.empty()) {
+                flush_pending(lock);
+            }
+        }
+    }
+
+public:
+    explicit capture_log(const std::string & path)
+    : path(path)
+    , fd(-1)
+    , pending()
+    , last()
+    , started(false)
+    , stopping(false)
+    , captured(0)
+    , dropped(0)
+    {}
+
+    ~capture_log()
+    {
+        stop();
+
+        if(fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    // truncates the file and writes its header
+    bool open()
+    {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if(fd < 0) {
+            std::cerr << "capture unable to be opened: " << path << " " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        std::vector<std::uint8_t> header;
+        capture::put_header(header);
+
+        return write_out(header);
+    }
+
+    // the flusher thread is started separately so open can run before daemonizing
+    void start()
+    {
+        if(! flusher.joinable()) {
+            flusher = std::thread(&capture_log::flusher_loop, this);
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+
+        wake.notify_all();
+
+        if(flusher.joinable()) {
+            flusher.join();
+        }
+
+        std::unique_lock<std::mutex> lock(mtx);
+
+        if(! pending.empty() && fd >= 0) {
+            flush_pending(lock);
+        }
+
+        if(dropped) {
+            std::cerr << "capture: dropped " << dropped << " of " << (captured + dropped) << " commands" << std::endl;
+            dropped = 0;
+        }
+    }
+
+    // command is one whole command as received on connection
+    void append(const std::uint64_t connection, const char * command, const std::size_t size, const bool binary)
+    {
+        const capture_clock::time_point now { capture_clock::now() };
+        bool wake_flusher { false };
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+
+            if(pending.size() >= max_pending) {
+                ++dropped;
+                return;
+            }
+
+            // the first record starts the clock, which never runs backwards
+            const std::uint64_t delta { started && now > last
+                ? static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count())
+                : 0
+            };
+
+            if(! started || now > last) {
+                last = now;
+            }
+
+            started = true;
+
+            capture::put_record(pending, delta, connection, binary ? capture::capture_binary : 0, command, size);
+            ++captured;
+
+            wake_flusher = pending.size() >= flush_bytes;
+        }
+
+        if(wake_flusher) {
+            wake.notify_one();
+        }
+    }
+};
+
+#endif
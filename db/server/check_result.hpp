@@ -1,6 +1,7 @@
 #ifndef CHECKRESULT_H
 #define CHECKRESULT_H
 
+#include <utility>
 #include "result_container.hpp"
 
 struct check_result
@@ -13,9 +14,9 @@ struct check_result
     , rc(result_container())
     {}
 
-    check_result(const result_container & rc)
+    check_result(result_container && rc)
     : success(false)
-    , rc(rc)
+    , rc(std::move(rc))
     {}
 
     operator bool()
@@ -33,9 +34,10 @@ struct check_result
         return !success;
     }
 
-    result_container & get_rc()
+    // hands over the error, the check is left holding nothing
+    result_container && get_rc()
     {
-        return rc;
+        return std::move(rc);
     }
 };
 
@@ -0,0 +1,280 @@
+#ifndef COMMAND_STATS_H
+#define COMMAND_STATS_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "../../includes/perf_counters.hpp"
+
+// the commands timed per database
+enum class command_kind : std::uint8_t { NONE, PUT, MPUT, UPDATE, SIMILARITY, USIMILARITY, CLOSEST, MCLOSEST, MATCHING, MATCHINGX };
+
+constexpr std::size_t command_kind_count { 10 };
+
+inline const char * command_name(const command_kind kind)
+{
+    static const char * names[command_kind_count] {
+        "none", "put", "mput", "update", "similarity", "usimilarity", "closest", "mclosest", "matching", "matchingx"
+    };
+
+    return names[static_cast<std::size_t>(kind)];
+}
+
+// a command spends its time being parsed and checked, running against the
+// bank, then being written out
+// total is all of it, and is the only phase of a command answered without
+// running, as from the cache or by failing a check
+enum class phase : std::uint8_t { PARSE, EXECUTE, SERIALISE, TOTAL };
+
+constexpr std::size_t phase_count { 4 };
+
+// log-linear histogram of nanoseconds
+// each power of two is split into sub_count buckets, so a bucket is within
+// 1/sub_count of the values in it, from 1ns up to 2^max_bits ns
+// recording is a single relaxed increment
+class latency_histogram
+{
+private:
+    static constexpr unsigned sub_bits { 3 };
+    static constexpr std::uint64_t sub_count { 1 << sub_bits };
+    static constexpr unsigned max_bits { 40 };
+
+public:
+    static constexpr std::size_t bucket_count { (max_bits - sub_bits + 1) * sub_count };
+
+private:
+    std::atomic<std::uint64_t> buckets[bucket_count];
+
+    static std::size_t bucket(const std::uint64_t ns)
+    {
+        if(ns < sub_count) {
+            return static_cast<std::size_t>(ns);
+        }
+
+        const unsigned msb { static_cast<unsigned>(63 - __builtin_clzll(ns)) };
+
+        if(msb >= max_bits) {
+            return bucket_count - 1;
+        }
+
+        const unsigned shift { msb - sub_bits };
+
+        return static_cast<std::size_t>((shift + 1) * sub_count + ((ns >> shift) - sub_count));
+    }
+
+public:
+    latency_histogram()
+    {
+        for(std::atomic<std::uint64_t> & b : buckets) {
+            b.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    latency_histogram(const latency_histogram &) = delete;
+    latency_histogram & operator=(const latency_histogram &) = delete;
+
+    void record(const std::uint64_t ns)
+    {
+        buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // largest value falling in bucket i
+    static std::uint64_t bucket_high(const std::size_t i)
+    {
+        if(i < sub_count) {
+            return i;
+        }
+
+        const unsigned shift { static_cast<unsigned>(i / sub_count - 1) };
+        const std::uint64_t low { (sub_count + i % sub_count) << shift };
+
+        return low + (static_cast<std::uint64_t>(1) << shift) - 1;
+    }
+
+    // counts must hold bucket_count zeroes or earlier histograms
+    void add_to(std::vector<std::uint64_t> & counts) const
+    {
+        for(std::size_t i=0; i<bucket_count; ++i) {
+            counts[i] += buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    static std::uint64_t total(const std::vector<std::uint64_t> & counts)
+    {
+        std::uint64_t sum { 0 };
+        for(const std::uint64_t c : counts) {
+            sum += c;
+        }
+
+        return sum;
+    }
+
+    // p in [0, 1], 0 for no values
+    static std::uint64_t percentile(const std::vector<std::uint64_t> & counts, const double p)
+    {
+        const std::uint64_t total { latency_histogram::total(counts) };
+
+        if(total == 0) {
+            return 0;
+        }
+
+        const std::uint64_t rank { static_cast<std::uint64_t>(p * (total - 1)) + 1 };
+        std::uint64_t seen { 0 };
+
+        for(std::size_t i=0; i<counts.size(); ++i) {
+            seen += counts[i];
+
+            if(seen >= rank) {
+                return bucket_high(i);
+            }
+        }
+
+        return bucket_high(counts.size() - 1);
+    }
+};
+
+// per command kind counters and phase histograms of one database
+class command_stats
+{
+private:
+    // the count is that of the total histogram, which every command is in
+    struct entry
+    {
+        std::atomic<std::uint64_t> errors;
+        std::atomic<std::uint64_t> bytes_in;
+        std::atomic<std::uint64_t> bytes_out;
+        latency_histogram phases[phase_count];
+
+        // sums of hardware events over the execute phases counted, see -P
+        std::atomic<std::uint64_t> counted;
+        std::atomic<std::uint64_t> events[sdr::perf_event_count];
+
+        entry()
+        : errors(0)
+        , bytes_in(0)
+        , bytes_out(0)
+        , counted(0)
+        {
+            for(std::atomic<std::uint64_t> & e : events) {
+                e.store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    entry entries[command_kind_count];
+
+public:
+    command_stats() = default;
+
+    command_stats(const command_stats &) = delete;
+    command_stats & operator=(const command_stats &) = delete;
+
+    // times in nanoseconds, executed is false for a command that never ran
+    // against the bank, leaving only parse and total
+    void record(
+        const command_kind kind,
+        const bool error,
+        const std::size_t in,
+        const std::size_t out,
+        const bool executed,
+        const std::uint64_t parse_ns,
+        const std::uint64_t execute_ns,
+        const std::uint64_t serialise_ns
+    ) {
+        entry & e { entries[static_cast<std::size_t>(kind)] };
+
+        e.bytes_in.fetch_add(in, std::memory_order_relaxed);
+        e.bytes_out.fetch_add(out, std::memory_order_relaxed);
+
+        if(error) {
+            e.errors.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        e.phases[static_cast<std::size_t>(phase::PARSE)].record(parse_ns);
+
+        if(executed) {
+            e.phases[static_cast<std::size_t>(phase::EXECUTE)].record(execute_ns);
+            e.phases[static_cast<std::size_t>(phase::SERIALISE)].record(serialise_ns);
+        }
+
+        e.phases[static_cast<std::size_t>(phase::TOTAL)].record(parse_ns + execute_ns + serialise_ns);
+    }
+
+    // hardware events of one execute phase
+    void record_events(const command_kind kind, const sdr::perf_values & values)
+    {
+        entry & e { entries[static_cast<std::size_t>(kind)] };
+
+        e.counted.fetch_add(1, std::memory_order_relaxed);
+
+        for(std::size_t i=0; i<sdr::perf_event_count; ++i) {
+            e.events[i].fetch_add(values.values[i], std::memory_order_relaxed);
+        }
+    }
+
+    // one "KIND count=.. errors=.. in=.. out=.. PHASE=p50/p99/p999..." per
+    // kind that has been used, separated by " | ", nanoseconds throughout
+    // followed by hardware event averages when they were counted
+    void describe(const std::string & prefix, std::string & out) const
+    {
+        static const char * phase_names[phase_count] { "parse", "execute", "serialise", "total" };
+
+        std::vector<std::uint64_t> counts;
+
+        for(std::size_t k=1; k<command_kind_count; ++k) {
+            const entry & e { entries[k] };
+
+            counts.assign(latency_histogram::bucket_count, 0);
+            e.phases[static_cast<std::size_t>(phase::TOTAL)].add_to(counts);
+
+            const std::uint64_t count { latency_histogram::total(counts) };
+
+            if(count == 0) {
+                continue;
+            }
+
+            std::stringstream ss;
+
+            if(! out.empty()) {
+                ss << " | ";
+            }
+
+            ss  << prefix << command_name(static_cast<command_kind>(k))
+                << " count=" << count
+                << " errors=" << e.errors.load(std::memory_order_relaxed)
+                << " in=" << e.bytes_in.load(std::memory_order_relaxed)
+                << " out=" << e.bytes_out.load(std::memory_order_relaxed);
+
+            for(std::size_t p=0; p<phase_count; ++p) {
+                counts.assign(latency_histogram::bucket_count, 0);
+                e.phases[p].add_to(counts);
+
+                ss  << " " << phase_names[p] << "="
+                    << latency_histogram::percentile(counts, 0.5) << "/"
+                    << latency_histogram::percentile(counts, 0.99) << "/"
+                    << latency_histogram::percentile(counts, 0.999);
+            }
+
+            // averages per execute phase counted, and instructions per cycle
+            const std::uint64_t counted { e.counted.load(std::memory_order_relaxed) };
+
+            if(counted > 0) {
+                for(std::size_t i=0; i<sdr::perf_event_count; ++i) {
+                    ss << " " << sdr::perf_event_name(i) << "=" << e.events[i].load(std::memory_order_relaxed) / counted;
+                }
+
+                const std::uint64_t cycles { e.events[static_cast<std::size_t>(sdr::perf_event::CYCLES)].load(std::memory_order_relaxed) };
+                const std::uint64_t instructions { e.events[static_cast<std::size_t>(sdr::perf_event::INSTRUCTIONS)].load(std::memory_order_relaxed) };
+
+                ss << " ipc=" << (cycles ? static_cast<double>(instructions) / cycles : 0.0);
+            }
+
+            out += ss.str();
+        }
+    }
+};
+
+#endif
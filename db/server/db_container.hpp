@@ -3,28 +3,60 @@
 
 #include <string>
 #include <iostream>
+#include <vector>
+#include <atomic>
+#include <cstdint>
 #include "../../includes/sdr.hpp"
+#include "rw_lock.hpp"
+#include "command_stats.hpp"
 
+// unique across databases, so a database dropped and created again under
+// the same name never reuses one
+inline std::uint64_t next_generation()
+{
+    static std::atomic<std::uint64_t> counter { 1 };
+    return counter++;
+}
+
+// queries hold lock shared, anything changing bank holds it exclusively
 struct db_container
 {
     std::string name;
     sdr::bank bank;
+    rw_lock lock;
 
-    db_container()
-    : name("undefined")
-    , bank(0)
-    {}
+    // set under lock once removed from databases
+    bool dropped;
 
-    db_container(const db_container & dbc)
-    : name(dbc.name)
-    , bank(dbc.bank)
-    {}
+    // one per position for weighted queries, 1.0 unless set with "weights"
+    // not part of snapshots, the wal logs them again after each one
+    std::vector<double> weights;
+
+    // replaced on every change to bank or weights, see result_cache
+    std::atomic<std::uint64_t> generation;
+
+    // latencies of the commands run against it, see "stats"
+    command_stats stats;
 
     db_container(const std::string & name, const std::size_t width)
     : name(name)
     , bank(sdr::bank(width))
+    , lock()
+    , dropped(false)
+    , weights(width, 1.0)
+    , generation(next_generation())
+    , stats()
     {}
 
+    db_container(const db_container &) = delete;
+    db_container & operator=(const db_container &) = delete;
+
+    // called with lock held exclusively
+    void changed()
+    {
+        generation = next_generation();
+    }
+
     std::size_t get_storage_size() const
     {
         return bank.get_storage_size();
@@ -36,4 +68,4 @@ struct db_container
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,646 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <mutex>
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+#include <cctype>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include <libsocket/exception.hpp>
+#include <libsocket/unixclientstream.hpp>
+#include <libsocket/unixserverstream.hpp>
+
+#include "../../includes/probes.hpp"
+#include "../common/protocol.hpp"
+
+struct connection
+{
+    // never reused, unlike fds
+    std::uint64_t id;
+    std::unique_ptr<libsocket::unix_stream_client> client;
+
+    // received bytes not yet handed to the handler start at input_offset
+    std::string input;
+    std::size_t input_offset;
+
+    // bytes not yet written start at output_offset
+    std::string output;
+    std::size_t output_offset;
+
+    // peer closed its end, finish what was received then close
+    bool eof;
+
+    // reading stopped early while enough commands were buffered
+    bool unread;
+    bool queued;
+
+    // a batch of commands is out with the handler
+    bool busy;
+
+    // tagged commands out with the handler, see is_tagged
+    std::size_t tagged;
+
+    // sent "binary", input is framed from then on, see protocol.hpp
+    bool binary;
+
+    connection(const std::uint64_t id, libsocket::unix_stream_client * client)
+    : id(id)
+    , client(client)
+    , input()
+    , input_offset(0)
+    , output()
+    , output_offset(0)
+    , eof(false)
+    , unread(false)
+    , queued(false)
+    , busy(false)
+    , tagged(0)
+    , binary(false)
+    {}
+};
+
+// output handed back to the event loop from other threads
+struct completion
+{
+    std::uint64_t id;
+    std::string output;
+
+    // the output of a tagged command rather than of a batch
+    bool tagged;
+
+    completion(const std::uint64_t id, std::string && output, const bool tagged)
+    : id(id)
+    , output(std::move(output))
+    , tagged(tagged)
+    {}
+};
+
+class completion_queue
+{
+private:
+    std::mutex mtx;
+    std::vector<completion> items;
+    int efd;
+
+public:
+    completion_queue()
+    : items()
+    , efd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    {
+        if(efd < 0) {
+            throw libsocket::socket_exception(__FILE__, __LINE__, "completion_queue: eventfd failed");
+        }
+    }
+
+    ~completion_queue()
+    {
+        ::close(efd);
+    }
+
+    completion_queue(const completion_queue &) = delete;
+    completion_queue & operator=(const completion_queue &) = delete;
+
+    void push(const std::uint64_t id, std::string && output, const bool tagged)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            items.emplace_back(id, std::move(output), tagged);
+        }
+
+        const std::uint64_t one { 1 };
+        while(::write(efd, &one, sizeof(one)) < 0 && errno == EINTR);
+    }
+
+    void drain(std::vector<completion> & out)
+    {
+        std::uint64_t count;
+        while(::read(efd, &count, sizeof(count)) > 0);
+
+        std::lock_guard<std::mutex> lock(mtx);
+        out.swap(items);
+    }
+
+    int getfd() const
+    {
+        return efd;
+    }
+};
+
+// single threaded, edge triggered epoll reactor over the unix socket
+// commands end at \n or ;, or are whole frames on a binary connection,
+// and are handed to the handler in batches, with
+// at most one batch per connection out at a time so responses stay in order
+// the handler may run the batch anywhere and pushes the batch's output
+// onto the completion queue when done
+// each connection gets a bounded number of commands per batch and stops
+// being read from while its output is backed up, so no client can hold
+// up the others
+// tagged commands, see is_tagged, skip the batching: each goes to the
+// handler on its own as soon as it is read, busy or not, and its response
+// is written whenever it completes
+class event_loop
+{
+public:
+    // a batch is a run of complete commands copied out of the receive
+    // buffer in one go, split it with command_size
+    // binary says whether it holds frames or text commands
+    // tagged batches are a single tagged command
+    typedef std::function<void(std::uint64_t, std::string &&, bool binary, bool tagged)> handler;
+
+private:
+    static constexpr std::size_t buffer_size { 64 * 1024 };
+    static constexpr std::size_t max_events { 256 };
+    static constexpr std::size_t commands_per_turn { 32 };
+    static constexpr std::size_t max_input { 4 * 1024 * 1024 };
+    static constexpr std::size_t max_output { 4 * 1024 * 1024 };
+    static constexpr std::size_t max_command_size { 64 * 1024 * 1024 };
+    static constexpr std::size_t max_tagged { 64 };
+
+    static constexpr std::uint64_t listen_id { 0 };
+    static constexpr std::uint64_t completion_id { ~0ull };
+
+    libsocket::unix_stream_server server;
+    completion_queue & completions;
+    handler handle;
+    int epfd;
+
+    std::uint64_t next_id;
+    std::unordered_map<std::uint64_t, std::unique_ptr<connection>> connections;
+
+    // connections with complete commands left over from their last turn
+    std::vector<std::uint64_t> ready;
+
+    void watch(const int fd, const std::uint64_t id, const std::uint32_t events)
+    {
+        epoll_event ev;
+        ev.events = events;
+        ev.data.u64 = id;
+
+        if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            throw libsocket::socket_exception(__FILE__, __LINE__, "event_loop: epoll_ctl failed");
+        }
+    }
+
+    void accept_all()
+    {
+        while(true) {
+            libsocket::unix_stream_client * client { nullptr };
+
+            try {
+                client = server.accept(SOCK_NONBLOCK);
+            } catch (const libsocket::socket_exception & exc) {
+                // out of fds and the like, existing connections carry on
+                std::cerr << exc.mesg << std::endl;
+                return;
+            }
+
+            if(client == nullptr) {
+                return;
+            }
+
+            const std::uint64_t id { next_id++ };
+            connections[id].reset(new connection(id, client));
+
+            SDR_PROBE2(connection_accept, id, client->getfd());
+
+            watch(client->getfd(), id, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        }
+    }
+
+    std::size_t next_command(const connection & conn) const
+    {
+        return command_size(conn.input.data() + conn.input_offset, conn.input.size() - conn.input_offset, conn.binary);
+    }
+
+    bool has_command(const connection & conn) const
+    {
+        return next_command(conn) != 0;
+    }
+
+    bool oversized(const connection & conn) const
+    {
+        const std::size_t available { conn.input.size() - conn.input_offset };
+
+        if(conn.binary) {
+            return available >= protocol::header_size
+                && protocol::get_u32(conn.input.data() + conn.input_offset) > max_command_size;
+        }
+
+        return available > max_command_size && ! has_command(conn);
+    }
+
+    // whether command is "binary", as parse_input would read it
+    static bool is_binary_switch(const char * command, const std::size_t size)
+    {
+        static const char word[] { "binary" };
+        constexpr std::size_t length { sizeof(word) - 1 };
+
+        std::size_t i { 0 };
+        while(i < size && std::isspace(static_cast<unsigned char>(command[i]))) {
+            ++i;
+        }
+
+        if(size - i < length) {
+            return false;
+        }
+
+        for(std::size_t j=0; j<length; ++j, ++i) {
+            if(std::tolower(static_cast<unsigned char>(command[i])) != word[j]) {
+                return false;
+            }
+        }
+
+        for(; i<size; ++i) {
+            if(! std::isspace(static_cast<unsigned char>(command[i]))) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // "@TAG COMMAND" in text, or a frame with protocol::flag_async set
+    static bool is_tagged(const char * command, const std::size_t size, const bool binary)
+    {
+        if(binary) {
+            return size >= protocol::header_size && (static_cast<std::uint8_t>(command[6]) & protocol::flag_async);
+        }
+
+        std::size_t i { 0 };
+        while(i < size && std::isspace(static_cast<unsigned char>(command[i]))) {
+            ++i;
+        }
+
+        return i < size && command[i] == '@';
+    }
+
+    // drains the socket, as edge triggered epoll will not report it again,
+    // unless plenty of commands are already waiting, in which case the rest
+    // is left in the socket and read once those are handled
+    void read_all(connection & conn)
+    {
+        char buffer[buffer_size];
+
+        while(! conn.eof) {
+            if(conn.input.size() - conn.input_offset >= max_input && has_command(conn)) {
+                conn.unread = true;
+                return;
+            }
+
+            // the fd is read directly rather than through rcv, which throws
+            // on EAGAIN unless libsocket knows the client is nonblocking
+            const ssize_t received { ::recv(conn.client->getfd(), buffer, buffer_size, MSG_DONTWAIT) };
+
+            if(received < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+
+                if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                    conn.unread = false;
+                    return;
+                }
+
+                throw libsocket::socket_exception(__FILE__, __LINE__, "event_loop: recv failed");
+            }
+
+            // nothing is left to read later
+            if(received == 0) {
+                conn.eof = true;
+                conn.unread = false;
+                return;
+            }
+
+            conn.input.append(buffer, static_cast<std::size_t>(received));
+        }
+    }
+
+    void flush(connection & conn)
+    {
+        while(conn.output_offset < conn.output.size()) {
+            const ssize_t sent { ::send(
+                conn.client->getfd(),
+                conn.output.data() + conn.output_offset,
+                conn.output.size() - conn.output_offset,
+                MSG_DONTWAIT | MSG_NOSIGNAL
+            ) };
+
+            if(sent < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+
+                if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return;
+                }
+
+                throw libsocket::socket_exception(__FILE__, __LINE__, "event_loop: send failed");
+            }
+
+            conn.output_offset += static_cast<std::size_t>(sent);
+        }
+
+        conn.output.clear();
+        conn.output_offset = 0;
+    }
+
+    std::size_t pending_output(const connection & conn) const
+    {
+        return conn.output.size() - conn.output_offset;
+    }
+
+    // hands the next batch of commands to the handler, and any tagged
+    // commands met on the way
+    // returns whether complete commands are left that could be handled now
+    bool process(connection & conn)
+    {
+        bool throttled { false };
+
+        if(pending_output(conn) < max_output) {
+            std::size_t start { conn.input_offset };
+            const bool binary { conn.binary };
+
+            // a switch to binary ends the batch, so every batch is one or the other
+            for(std::size_t amount=0; amount < commands_per_turn && conn.binary == binary; ++amount) {
+                const std::size_t size { next_command(conn) };
+
+                if(size == 0) {
+                    break;
+                }
+
+                const char * command { conn.input.data() + conn.input_offset };
+
+                if(is_tagged(command, size, binary)) {
+                    if(conn.tagged >= max_tagged) {
+                        throttled = true;
+                        break;
+                    }
+
+                    // the commands before it go out first, as their own batch
+                    if(conn.input_offset > start) {
+                        conn.busy = true;
+                        handle(conn.id, conn.input.substr(start, conn.input_offset - start), binary, false);
+                    }
+
+                    ++conn.tagged;
+                    handle(conn.id, std::string(command, size), binary, true);
+
+                    conn.input_offset += size;
+                    start = conn.input_offset;
+                    continue;
+                }
+
+                if(conn.busy) {
+                    break;
+                }
+
+                if(! binary) {
+                    conn.binary = is_binary_switch(command, size - 1);
+                }
+
+                conn.input_offset += size;
+            }
+
+            if(conn.input_offset > start) {
+                conn.busy = true;
+                handle(conn.id, conn.input.substr(start, conn.input_offset - start), binary, false);
+            }
+        }
+
+        // compact once the consumed prefix dominates
+        if(conn.input_offset > conn.input.size() / 2) {
+            conn.input.erase(0, conn.input_offset);
+            conn.input_offset = 0;
+        }
+
+        const bool more { has_command(conn) };
+
+        // reported after the responses still owed
+        if(! more && ! conn.busy && ! conn.tagged && oversized(conn)) {
+            const std::string message { "ERR: command too long => closing connection" };
+
+            if(conn.binary) {
+                const protocol::header h { protocol::get_header(conn.input.data() + conn.input_offset) };
+                const std::size_t start { protocol::begin_frame(
+                    conn.output,
+                    h.op,
+                    static_cast<std::uint8_t>(protocol::status::ERR),
+                    static_cast<std::uint8_t>(protocol::result::STRING),
+                    h.request_id
+                ) };
+
+                conn.output += message;
+                protocol::end_frame(conn.output, start);
+            } else {
+                conn.output += message + "\n";
+            }
+
+            conn.input.clear();
+            conn.input_offset = 0;
+            conn.eof = true;
+            conn.unread = false;
+        }
+
+        // a completing tagged command serves the connection again
+        return more && ! throttled;
+    }
+
+    void close(const std::uint64_t id)
+    {
+        SDR_PROBE1(connection_close, id);
+
+        // closing the fd removes it from the epoll set
+        connections.erase(id);
+    }
+
+    // one turn for a connection: handle a batch of commands and write out
+    void serve(connection & conn)
+    {
+        if(conn.unread) {
+            read_all(conn);
+        }
+
+        const bool more { process(conn) || (conn.unread && ! conn.eof) };
+        flush(conn);
+
+        // a busy connection is served again when its batch completes,
+        // a backed up one when epoll reports it writable
+        const bool backed_up { pending_output(conn) >= max_output };
+
+        if(conn.busy) {
+            return;
+        }
+
+        if(more && ! backed_up) {
+            if(! conn.queued) {
+                conn.queued = true;
+                ready.emplace_back(conn.id);
+            }
+        } else if(conn.eof && ! more && ! conn.tagged && pending_output(conn) == 0) {
+            close(conn.id);
+        }
+    }
+
+    void complete_all()
+    {
+        std::vector<completion> done;
+        completions.drain(done);
+
+        for(auto & item : done) {
+            connection * conn { find(item.id) };
+
+            // the client went away meanwhile
+            if(conn == nullptr) {
+                continue;
+            }
+
+            if(item.tagged) {
+                --conn->tagged;
+            } else {
+                conn->busy = false;
+            }
+
+            conn->output += item.output;
+
+            try {
+                serve(*conn);
+            } catch (const libsocket::socket_exception & exc) {
+                close(item.id);
+            }
+        }
+    }
+
+    connection * find(const std::uint64_t id)
+    {
+        const auto it = connections.find(id);
+        return it == connections.end() ? nullptr : it->second.get();
+    }
+
+public:
+    // size of the command at the start of data including its delimiter or
+    // header, 0 if it has not all arrived yet
+    static std::size_t command_size(const char * data, const std::size_t available, const bool binary)
+    {
+        if(binary) {
+            if(available < protocol::header_size) {
+                return 0;
+            }
+
+            const std::size_t size { protocol::header_size + protocol::get_u32(data) };
+            return available >= size ? size : 0;
+        }
+
+        for(std::size_t i=0; i<available; ++i) {
+            if(data[i] == '\n' || data[i] == ';') {
+                return i + 1;
+            }
+        }
+
+        return 0;
+    }
+
+    event_loop(const std::string & bindpath, completion_queue & completions, const handler & handle)
+    : server(bindpath, SOCK_NONBLOCK)
+    , completions(completions)
+    , handle(handle)
+    , epfd(epoll_create1(EPOLL_CLOEXEC))
+    , next_id(1)
+    , connections()
+    , ready()
+    {
+        if(epfd < 0) {
+            throw libsocket::socket_exception(__FILE__, __LINE__, "event_loop: epoll_create1 failed");
+        }
+
+        watch(server.getfd(), listen_id, EPOLLIN | EPOLLET);
+        watch(completions.getfd(), completion_id, EPOLLIN | EPOLLET);
+    }
+
+    ~event_loop()
+    {
+        connections.clear();
+        ::close(epfd);
+        server.destroy();
+    }
+
+    void run()
+    {
+        epoll_event events[max_events];
+
+        while(true) {
+            const int n { epoll_wait(epfd, events, max_events, ready.empty() ? -1 : 0) };
+
+            if(n < 0 && errno != EINTR) {
+                throw libsocket::socket_exception(__FILE__, __LINE__, "event_loop: epoll_wait failed");
+            }
+
+            for(int i=0; i<n; ++i) {
+                const std::uint64_t id { events[i].data.u64 };
+
+                if(id == listen_id) {
+                    accept_all();
+                    continue;
+                }
+
+                if(id == completion_id) {
+                    complete_all();
+                    continue;
+                }
+
+                connection * conn { find(id) };
+                if(conn == nullptr) {
+                    continue;
+                }
+
+                try {
+                    if(events[i].events & EPOLLERR) {
+                        close(id);
+                        continue;
+                    }
+
+                    // a hang up may still leave commands to read
+                    if(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+                        read_all(*conn);
+                    }
+
+                    serve(*conn);
+                } catch (const libsocket::socket_exception & exc) {
+                    close(id);
+                }
+            }
+
+            std::vector<std::uint64_t> turn;
+            turn.swap(ready);
+
+            for(const std::uint64_t id : turn) {
+                connection * conn { find(id) };
+                if(conn == nullptr) {
+                    continue;
+                }
+
+                conn->queued = false;
+
+                try {
+                    serve(*conn);
+                } catch (const libsocket::socket_exception & exc) {
+                    close(id);
+                }
+            }
+        }
+    }
+};
+
+#endif
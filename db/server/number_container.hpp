@@ -2,66 +2,57 @@
 #define NUMBER_CONTAINER
 
 #include <string>
-#include <stdexcept>
-#include <exception>
 #include <cstddef>
 #include <cassert>
 #include "result_container.hpp"
+#include "tokenizer.hpp"
 
 struct number_container
 {
-    std::string s;
+    token s;
     std::size_t n;
-    std::string what_str;
-    bool ok;
+    parse_error error;
 
-    number_container(const std::string & s)
+    number_container(const token & s)
     : s(s)
-    , ok(false)
-
+    , n(0)
+    , error(parse_error::INVALID)
     {}
 
     bool parse()
     {
-        try {
-            n = std::stoul(s);
-            ok = true;
-        } catch(std::out_of_range & e) {
-            ok = false;
-            what_str = "ERR: out of range => " + s;
-        } catch(std::invalid_argument & e) {
-            ok = false;
-            what_str = "ERR: invalid argument => " + s;
-        } catch(std::exception & e) {
-            ok = false;
-            what_str = "ERR: unknown exception encountered => " + s;
-        }
+        error = parse_number(s, n);
 
-        return ok;
+        return error == parse_error::NONE;
     }
 
     operator bool() const
     {
-        return ok;
+        return error == parse_error::NONE;
     }
 
     std::size_t get_n() const
     {
-        assert(ok);
+        assert(error == parse_error::NONE);
         return n;
     }
 
     std::string get_s() const
     {
-        assert(ok);
-        return s;
+        return s.str();
     }
 
+    // the message is only built on failure
     result_container err() const
     {
-        assert(!ok);
-        return result_container(what_str);
+        assert(error != parse_error::NONE);
+
+        if(error == parse_error::RANGE) {
+            return result_container("ERR: out of range => " + s.str());
+        }
+
+        return result_container("ERR: invalid argument => " + s.str());
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,200 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <string>
+#include <sstream>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// bounded lru cache of serialised query responses
+// each entry carries the generation its database had when it was computed
+// and only hits while the database still has it, so a write invalidates
+// every entry of its database at once by bumping the generation, and the
+// stale ones age out
+// split into shards with their own lock and share of the capacity
+class result_cache
+{
+private:
+    static constexpr std::size_t shard_count { 16 };
+
+    // list and map nodes, roughly
+    static constexpr std::size_t entry_overhead { 96 };
+
+    struct entry
+    {
+        std::string key;
+        std::uint64_t generation;
+        std::uint8_t type;
+        std::string value;
+
+        std::size_t size() const
+        {
+            return key.size() + value.size() + entry_overhead;
+        }
+    };
+
+    struct shard
+    {
+        std::mutex mtx;
+
+        // most recently used first
+        std::list<entry> lru;
+
+        // by hash of the key, a colliding key replaces the entry
+        std::unordered_map<std::size_t, std::list<entry>::iterator> index;
+
+        std::size_t bytes;
+
+        shard()
+        : mtx()
+        , lru()
+        , index()
+        , bytes(0)
+        {}
+    };
+
+    std::size_t capacity;
+    shard shards[shard_count];
+
+    std::atomic<std::uint64_t> hits;
+    std::atomic<std::uint64_t> misses;
+    std::atomic<std::uint64_t> evictions;
+
+    // caller holds the shard's lock
+    void erase(shard & s, const std::list<entry>::iterator it, const std::size_t hash)
+    {
+        s.bytes -= it->size();
+        s.index.erase(hash);
+        s.lru.erase(it);
+    }
+
+public:
+    // capacity in bytes, 0 disables the cache
+    explicit result_cache(const std::size_t capacity)
+    : capacity(capacity)
+    , hits(0)
+    , misses(0)
+    , evictions(0)
+    {}
+
+    result_cache(const result_cache &) = delete;
+    result_cache & operator=(const result_cache &) = delete;
+
+    bool enabled() const
+    {
+        return capacity != 0;
+    }
+
+    // appends the cached response to out on a hit
+    bool get(const std::string & key, const std::uint64_t generation, std::string & out, std::uint8_t & type)
+    {
+        const std::size_t hash { std::hash<std::string>()(key) };
+        shard & s { shards[hash % shard_count] };
+
+        {
+            std::lock_guard<std::mutex> lock(s.mtx);
+
+            const auto found = s.index.find(hash);
+
+            if(found != s.index.end() && found->second->key == key) {
+                const std::list<entry>::iterator it { found->second };
+
+                if(it->generation == generation) {
+                    s.lru.splice(s.lru.begin(), s.lru, it);
+                    out += it->value;
+                    type = it->type;
+                    ++hits;
+
+                    return true;
+                }
+
+                // written to since, it will not hit again
+                erase(s, it, hash);
+            }
+        }
+
+        ++misses;
+
+        return false;
+    }
+
+    void put(
+        const std::string & key,
+        const std::uint64_t generation,
+        const std::uint8_t type,
+        const char * value,
+        const std::size_t size
+    ) {
+        const std::size_t hash { std::hash<std::string>()(key) };
+        shard & s { shards[hash % shard_count] };
+        const std::size_t limit { capacity / shard_count };
+
+        if(key.size() + size + entry_overhead > limit) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(s.mtx);
+
+        const auto found = s.index.find(hash);
+        if(found != s.index.end()) {
+            erase(s, found->second, hash);
+        }
+
+        s.lru.emplace_front(entry { key, generation, type, std::string(value, size) });
+        s.index[hash] = s.lru.begin();
+        s.bytes += s.lru.front().size();
+
+        while(s.bytes > limit) {
+            const std::list<entry>::iterator last { std::prev(s.lru.end()) };
+
+            erase(s, last, std::hash<std::string>()(last->key));
+            ++evictions;
+        }
+    }
+
+    void clear()
+    {
+        for(shard & s : shards) {
+            std::lock_guard<std::mutex> lock(s.mtx);
+
+            s.lru.clear();
+            s.index.clear();
+            s.bytes = 0;
+        }
+    }
+
+    std::string status()
+    {
+        std::size_t entries { 0 };
+        std::size_t bytes { 0 };
+
+        for(shard & s : shards) {
+            std::lock_guard<std::mutex> lock(s.mtx);
+
+            entries += s.lru.size();
+            bytes += s.bytes;
+        }
+
+        const std::uint64_t h { hits };
+        const std::uint64_t m { misses };
+
+        std::stringstream ss;
+        ss  << "hits=" << h
+            << " misses=" << m
+            << " hit_rate=" << (h + m ? static_cast<double>(h) / (h + m) : 0.0)
+            << " evictions=" << evictions
+            << " entries=" << entries
+            << " bytes=" << bytes
+            << " capacity=" << capacity;
+
+        return ss.str();
+    }
+};
+
+#endif
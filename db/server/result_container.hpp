@@ -4,108 +4,149 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <new>
+#include <cstddef>
 #include <cassert>
 
-enum class result_type { NONE, BOOL, SIZET, STRING, VECSIZET, VECPAIRSIZETSIZET };
+enum class result_type { NONE, BOOL, SIZET, STRING, VECSIZET, VECPAIRSIZETSIZET, DOUBLE, VECPAIRSIZETDOUBLE, VECVECPAIRSIZETSIZET };
 
+// holds one result by value, tagged by type
+// move only, so a result vector goes from the bank to the serialiser
+// without being copied and is freed with the container
 struct result_container
 {
+    typedef std::vector<std::size_t> vec_sizet;
+    typedef std::vector<std::pair<std::size_t, std::size_t>> vec_pair_sizet_sizet;
+    typedef std::vector<std::pair<std::size_t, double>> vec_pair_sizet_double;
+    typedef std::vector<vec_pair_sizet_sizet> vec_vec_pair_sizet_sizet;
+
     result_type type;
-    void * data;
+
+    union {
+        bool b;
+        std::size_t n;
+        double d;
+        std::string s;
+        vec_sizet vs;
+        vec_pair_sizet_sizet vpss;
+        vec_pair_sizet_double vpsd;
+        vec_vec_pair_sizet_sizet vvpss;
+    };
 
     result_container()
     : type(result_type::NONE)
-    , data(nullptr)
-    {}
-
-    result_container(const result_container & rc)
-    : type(rc.type)
-    , data(rc.data)
     {}
 
     result_container(const bool res)
     : type(result_type::BOOL)
-    , data(static_cast<void*>(new bool(res)))
+    , b(res)
     {}
 
     result_container(const std::size_t res)
     : type(result_type::SIZET)
-    , data(static_cast<void*>(new std::size_t(res)))
+    , n(res)
     {}
 
-    result_container(const std::string & res)
+    result_container(const double res)
+    : type(result_type::DOUBLE)
+    , d(res)
+    {}
+
+    result_container(std::string res)
     : type(result_type::STRING)
-    , data(static_cast<void*>(new std::string(res)))
+    , s(std::move(res))
     {}
 
-    result_container(const std::vector<std::size_t> & res)
+    result_container(vec_sizet res)
     : type(result_type::VECSIZET)
-    , data(static_cast<void*>(new std::vector<std::size_t>(res)))
+    , vs(std::move(res))
     {}
 
-    result_container(const std::vector<std::pair<std::size_t, std::size_t>> & res)
+    result_container(vec_pair_sizet_sizet res)
     : type(result_type::VECPAIRSIZETSIZET)
-    , data(static_cast<void*>(new std::vector<std::pair<std::size_t, std::size_t>>(res)))
+    , vpss(std::move(res))
+    {}
+
+    result_container(vec_pair_sizet_double res)
+    : type(result_type::VECPAIRSIZETDOUBLE)
+    , vpsd(std::move(res))
     {}
 
-    operator bool*()
+    result_container(vec_vec_pair_sizet_sizet res)
+    : type(result_type::VECVECPAIRSIZETSIZET)
+    , vvpss(std::move(res))
+    {}
+
+    result_container(result_container && rc)
+    : type(result_type::NONE)
     {
-        assert(type == result_type::BOOL);
-        return static_cast<bool*>(data);
+        take(std::move(rc));
     }
 
-    operator bool*() const
+    result_container & operator=(result_container && rc)
     {
-        assert(type == result_type::BOOL);
-        return static_cast<bool*>(data);
+        if(this != &rc) {
+            destroy();
+            take(std::move(rc));
+        }
+
+        return *this;
     }
 
-    operator std::size_t*()
+    result_container(const result_container &) = delete;
+    result_container & operator=(const result_container &) = delete;
+
+    ~result_container()
     {
-        assert(type == result_type::SIZET);
-        return static_cast<std::size_t*>(data);
+        destroy();
     }
 
-    operator std::size_t*() const
+    operator const bool*() const
+    {
+        assert(type == result_type::BOOL);
+        return &b;
+    }
+
+    operator const std::size_t*() const
     {
         assert(type == result_type::SIZET);
-        return static_cast<std::size_t*>(data);
+        return &n;
     }
 
-    operator std::string*()
+    operator const double*() const
     {
-        assert(type == result_type::STRING);
-        return static_cast<std::string*>(data);
+        assert(type == result_type::DOUBLE);
+        return &d;
     }
 
-    operator std::string*() const
+    operator const std::string*() const
     {
         assert(type == result_type::STRING);
-        return static_cast<std::string*>(data);
+        return &s;
     }
 
-    operator std::vector<std::size_t>*()
+    operator const vec_sizet*() const
     {
         assert(type == result_type::VECSIZET);
-        return static_cast<std::vector<std::size_t>*>(data);
+        return &vs;
     }
 
-    operator std::vector<std::size_t>*() const
+    operator const vec_pair_sizet_sizet*() const
     {
-        assert(type == result_type::VECSIZET);
-        return static_cast<std::vector<std::size_t>*>(data);
+        assert(type == result_type::VECPAIRSIZETSIZET);
+        return &vpss;
     }
 
-    operator std::vector<std::pair<std::size_t, std::size_t>>*()
+    operator const vec_pair_sizet_double*() const
     {
-        assert(type == result_type::VECPAIRSIZETSIZET);
-        return static_cast<std::vector<std::pair<std::size_t, std::size_t>>*>(data);
+        assert(type == result_type::VECPAIRSIZETDOUBLE);
+        return &vpsd;
     }
 
-    operator std::vector<std::pair<std::size_t, std::size_t>>*() const
+    operator const vec_vec_pair_sizet_sizet*() const
     {
-        assert(type == result_type::VECPAIRSIZETSIZET);
-        return static_cast<std::vector<std::pair<std::size_t, std::size_t>>*>(data);
+        assert(type == result_type::VECVECPAIRSIZETSIZET);
+        return &vvpss;
     }
 
     result_type get_type() const
@@ -113,7 +154,72 @@ struct result_container
         return type;
     }
 
+    // errors are strings starting with ERR:, see render_error
+    bool is_error() const
+    {
+        return type == result_type::STRING && s.compare(0, 4, "ERR:") == 0;
+    }
+
+private:
+    void destroy()
+    {
+        switch(type) {
+            case result_type::STRING:
+                s.~basic_string();
+                break;
+            case result_type::VECSIZET:
+                vs.~vec_sizet();
+                break;
+            case result_type::VECPAIRSIZETSIZET:
+                vpss.~vec_pair_sizet_sizet();
+                break;
+            case result_type::VECPAIRSIZETDOUBLE:
+                vpsd.~vec_pair_sizet_double();
+                break;
+            case result_type::VECVECPAIRSIZETSIZET:
+                vvpss.~vec_vec_pair_sizet_sizet();
+                break;
+            default:
+                break;
+        }
+
+        type = result_type::NONE;
+    }
 
+    // this must hold nothing, rc keeps its type but is left moved from
+    void take(result_container && rc)
+    {
+        switch(rc.type) {
+            case result_type::BOOL:
+                b = rc.b;
+                break;
+            case result_type::SIZET:
+                n = rc.n;
+                break;
+            case result_type::DOUBLE:
+                d = rc.d;
+                break;
+            case result_type::STRING:
+                new (&s) std::string(std::move(rc.s));
+                break;
+            case result_type::VECSIZET:
+                new (&vs) vec_sizet(std::move(rc.vs));
+                break;
+            case result_type::VECPAIRSIZETSIZET:
+                new (&vpss) vec_pair_sizet_sizet(std::move(rc.vpss));
+                break;
+            case result_type::VECPAIRSIZETDOUBLE:
+                new (&vpsd) vec_pair_sizet_double(std::move(rc.vpsd));
+                break;
+            case result_type::VECVECPAIRSIZETSIZET:
+                new (&vvpss) vec_vec_pair_sizet_sizet(std::move(rc.vvpss));
+                break;
+            default:
+                break;
+        }
+
+        type = rc.type;
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,76 @@
+#ifndef RW_LOCK_H
+#define RW_LOCK_H
+
+#include <pthread.h>
+
+// many readers or one writer
+// writers are preferred so a steady stream of queries cannot starve put/update
+class rw_lock
+{
+private:
+    pthread_rwlock_t rwlock;
+
+public:
+    rw_lock()
+    {
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        pthread_rwlock_init(&rwlock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+    }
+
+    ~rw_lock()
+    {
+        pthread_rwlock_destroy(&rwlock);
+    }
+
+    rw_lock(const rw_lock &) = delete;
+    rw_lock & operator=(const rw_lock &) = delete;
+
+    // exclusive, usable with std::lock_guard
+    void lock()
+    {
+        pthread_rwlock_wrlock(&rwlock);
+    }
+
+    void unlock()
+    {
+        pthread_rwlock_unlock(&rwlock);
+    }
+
+    void lock_shared()
+    {
+        pthread_rwlock_rdlock(&rwlock);
+    }
+
+    void unlock_shared()
+    {
+        pthread_rwlock_unlock(&rwlock);
+    }
+};
+
+class shared_guard
+{
+private:
+    rw_lock & rwl;
+
+public:
+    explicit shared_guard(rw_lock & rwl)
+    : rwl(rwl)
+    {
+        rwl.lock_shared();
+    }
+
+    ~shared_guard()
+    {
+        rwl.unlock_shared();
+    }
+
+    shared_guard(const shared_guard &) = delete;
+    shared_guard & operator=(const shared_guard &) = delete;
+};
+
+#endif
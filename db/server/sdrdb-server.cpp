@@ -13,20 +13,40 @@
 #include <type_traits>
 #include <cstddef>
 #include <stdexcept>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <set>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
 
 #include <sparsehash/dense_hash_map>
 #include <libsocket/exception.hpp>
-#include <libsocket/unixclientstream.hpp>
-#include <libsocket/unixserverstream.hpp>
 
 #include "../../includes/sdr.hpp"
+#include "../../includes/perf_counters.hpp"
+#include "../../includes/probes.hpp"
 #include "db_container.hpp"
 #include "result_container.hpp"
 #include "check_result.hpp"
 #include "number_container.hpp"
+#include "tokenizer.hpp"
+#include "wal.hpp"
+#include "bgsave.hpp"
+#include "event_loop.hpp"
+#include "rw_lock.hpp"
+#include "thread_pool.hpp"
+#include "result_cache.hpp"
+#include "single_flight.hpp"
+#include "slow_log.hpp"
+#include "capture_log.hpp"
+#include "../common/protocol.hpp"
 
 #ifndef SDRDB_VERSION
 #define SDRDB_VERSION "0.1-alpha"
@@ -37,7 +57,239 @@ bool verbose { false };
 template <typename T, typename U>
 using hash_map = google::dense_hash_map<T, U, std::hash<T>>;
 
-hash_map<std::string, db_container> databases;
+typedef std::shared_ptr<db_container> db_ptr;
+
+// lookups hold databases_lock shared, create and drop hold it exclusively
+// a db_ptr keeps its database alive for a command racing a drop
+hash_map<std::string, db_ptr> databases;
+rw_lock databases_lock;
+
+// null unless started with -w
+std::unique_ptr<write_ahead_log> wal;
+
+background_save bgsave;
+
+// files a save or background save is writing and has yet to log, so two
+// never rename over one file and log their snapshots in the other order
+std::mutex snapshot_files_lock;
+std::set<std::string> snapshot_files;
+
+// names temporary snapshot files apart, with the pid for forked children
+std::atomic<std::uint64_t> snapshot_counter { 0 };
+
+// set up in main, see -c
+std::unique_ptr<result_cache> cache;
+
+single_flight flights;
+
+// null unless started with -S
+std::unique_ptr<slow_log> slowlog;
+
+// null unless started with -C
+std::unique_ptr<capture_log> capturelog;
+
+// set with -P, when the hardware counters could be opened
+bool count_events { false };
+
+// each worker's own counters, opened the first time it runs a command
+sdr::perf_counters * thread_counters()
+{
+    thread_local std::unique_ptr<sdr::perf_counters> counters;
+
+    if(! counters) {
+        counters.reset(new sdr::perf_counters());
+    }
+
+    return counters->available() ? counters.get() : nullptr;
+}
+
+typedef std::chrono::steady_clock stats_clock;
+
+// the command a worker is running and when its phases started, filled in
+// as it goes and recorded against its database once written out
+// see command_stats
+struct request_sample
+{
+    command_kind kind;
+    db_ptr db;
+    stats_clock::time_point begin;
+    stats_clock::time_point execute_begin;
+    stats_clock::time_point execute_end;
+    bool executed;
+    bool error;
+
+    // for the slow log, the size of the database run against and what a
+    // closest query did
+    std::size_t concepts;
+    sdr::query_stats plan;
+
+    // hardware events of the execute phase, with -P
+    sdr::perf_values events;
+    bool counted;
+
+    // amount of results of a closest or matching query, for query_end
+    std::size_t results;
+
+    void start()
+    {
+        kind = command_kind::NONE;
+        results = 0;
+        executed = false;
+        error = false;
+        counted = false;
+        concepts = 0;
+        plan = sdr::query_stats();
+        begin = stats_clock::now();
+    }
+
+    // passed to the bank only while there is a slow log to explain to
+    sdr::query_stats * explain()
+    {
+        return slowlog ? &plan : nullptr;
+    }
+
+    void track(const command_kind k, const db_ptr & d)
+    {
+        kind = k;
+        db = d;
+    }
+};
+
+thread_local request_sample sample;
+
+std::uint64_t nanoseconds(const stats_clock::time_point from, const stats_clock::time_point to)
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+}
+
+// marks the bank call of a command as its execute phase, firing the
+// query_start and query_end probes around it
+// called with db_it locked
+struct execute_phase
+{
+    const db_container & db_it;
+    sdr::perf_counters * counters;
+    sdr::perf_values before;
+
+    explicit execute_phase(const db_container & db_it)
+    : db_it(db_it)
+    , counters(count_events ? thread_counters() : nullptr)
+    , before()
+    {
+        sample.concepts = db_it.get_storage_size();
+
+        SDR_PROBE3(query_start, db_it.name.c_str(), command_name(sample.kind), sample.concepts);
+
+        if(counters && ! counters->read(before)) {
+            counters = nullptr;
+        }
+
+        sample.execute_begin = stats_clock::now();
+    }
+
+    ~execute_phase()
+    {
+        sample.execute_end = stats_clock::now();
+        sample.executed = true;
+
+        sdr::perf_values after;
+        if(counters && counters->read(after)) {
+            sample.events = after - before;
+            sample.counted = true;
+        }
+
+        SDR_PROBE4(query_end, db_it.name.c_str(), command_name(sample.kind), nanoseconds(sample.execute_begin, sample.execute_end), sample.results);
+    }
+};
+
+// frames are logged as their header fields then their name and arguments
+void describe_frame(const char * frame, std::string & out)
+{
+    const protocol::header h { protocol::get_header(frame) };
+    const char * body { frame + protocol::header_size };
+
+    out += "op=" + std::to_string(h.op) + " flags=" + std::to_string(h.flags) + " id=" + std::to_string(h.request_id);
+
+    if(h.op == static_cast<std::uint16_t>(protocol::opcode::TEXT)) {
+        out += ' ';
+        out.append(body, h.length);
+        return;
+    }
+
+    if(h.extra > h.length) {
+        return;
+    }
+
+    out += ' ';
+    out.append(body, h.extra);
+
+    for(std::size_t i=h.extra; i + 4 <= h.length && out.size() < slow_entry::command_capacity; i += 4) {
+        out += ' ';
+        out += std::to_string(protocol::get_u32(body + i));
+    }
+}
+
+void log_slow(const char * command, const std::size_t in, const std::size_t out, const bool binary, const std::uint64_t total_ns)
+{
+    slow_entry e;
+    e.when = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count());
+    e.total_ns = total_ns;
+    e.parse_ns = sample.executed ? nanoseconds(sample.begin, sample.execute_begin) : total_ns;
+    e.execute_ns = sample.executed ? nanoseconds(sample.execute_begin, sample.execute_end) : 0;
+    e.serialise_ns = sample.executed ? total_ns - e.parse_ns - e.execute_ns : 0;
+    e.concepts = sample.concepts;
+    e.postings = sample.plan.postings;
+    e.candidates = sample.plan.candidates;
+    e.accumulate_ns = sample.plan.accumulate_ns;
+    e.select_ns = sample.plan.select_ns;
+    e.bytes_out = out;
+
+    if(binary) {
+        std::string described;
+        describe_frame(command, described);
+        e.set_command(described.data(), described.size());
+    } else {
+        // without the newline
+        e.set_command(command, in - 1);
+    }
+
+    slowlog->push(e);
+}
+
+// command is the one just run, in and out are its bytes and those of its
+// response
+void record_sample(const char * command, const std::size_t in, const std::size_t out, const bool binary)
+{
+    const stats_clock::time_point end { stats_clock::now() };
+    const std::uint64_t total_ns { nanoseconds(sample.begin, end) };
+
+    if(slowlog && slowlog->is_slow(total_ns)) {
+        log_slow(command, in, out, binary, total_ns);
+    }
+
+    if(sample.kind == command_kind::NONE || ! sample.db) {
+        return;
+    }
+
+    if(sample.counted) {
+        sample.db->stats.record_events(sample.kind, sample.events);
+    }
+
+    if(sample.executed) {
+        sample.db->stats.record(
+            sample.kind, sample.error, in, out, true,
+            nanoseconds(sample.begin, sample.execute_begin),
+            nanoseconds(sample.execute_begin, sample.execute_end),
+            nanoseconds(sample.execute_end, end)
+        );
+    } else {
+        sample.db->stats.record(sample.kind, sample.error, in, out, false, total_ns, 0, 0);
+    }
+
+    sample.db.reset();
+}
 
 std::string tolower(const std::string & s)
 {
@@ -64,35 +316,162 @@ bool is_number(const std::string & s)
     return ! s.empty() && it == s.end();
 }
 
-std::string trim(const std::string & s)
+// one past the last lsn this thread appended and has not synced yet
+thread_local std::uint64_t unsynced { 0 };
+
+// whether a record this thread appended since its last sync was refused
+thread_local bool unlogged { false };
+
+// records this thread has appended, so a worker can tell which commands logged
+thread_local std::size_t wal_appends { 0 };
+
+// whether this thread logged a snapshot since its last sync, see wal_sync
+thread_local bool snapshotted { false };
+
+// must be called with the database's lock held, so the log order matches
+// the order mutations were applied in
+void wal_append(const wal_record & rec)
 {
-    std::string ret { s };
-    ret.erase(ret.begin(), std::find_if(ret.begin(), ret.end(), std::not1(std::ptr_fun<int, int>(std::isspace))));
-    ret.erase(std::find_if(ret.rbegin(), ret.rend(), std::not1(std::ptr_fun<int, int>(std::isspace))).base(), ret.end());
-    return ret;
+    if(wal) {
+        std::uint64_t lsn;
+
+        if(wal->append(rec, lsn)) {
+            unsynced = lsn + 1;
+            snapshotted = snapshotted || rec.op == wal_op::SNAPSHOT;
+        } else {
+            unlogged = true;
+        }
+
+        ++wal_appends;
+    }
+}
+
+// waits until this thread's records are durable, see sync_policy
+// called once locks are released so a slow fsync blocks only the caller
+// a new snapshot may leave most of the log dead, so it is compacted here too
+// false if the wal has failed, and they may not survive a restart
+bool wal_sync()
+{
+    bool ok { ! unlogged };
+
+    if(wal && unsynced) {
+        ok = wal->sync(unsynced - 1) && ok;
+    }
+
+    if(wal && snapshotted && ok) {
+        wal->compact();
+    }
+
+    unsynced = 0;
+    unlogged = false;
+    snapshotted = false;
+
+    return ok;
+}
+
+db_ptr find_database(const std::string & name)
+{
+    shared_guard guard(databases_lock);
+
+    const auto db = databases.find(name);
+    if(db == databases.end()) {
+        return db_ptr();
+    }
+
+    return db->second;
 }
 
-std::vector<std::size_t> unpack(const std::vector<number_container> & v)
+// snapshots are referenced from the wal, so they must not depend on cwd
+std::string absolute_path(const std::string & path)
 {
-    std::vector<std::size_t> ret;
-    ret.reserve(v.size());
+    if(path.empty() || path[0] == '/') {
+        return path;
+    }
 
-    for(auto & i : v) {
-        ret.emplace_back(i.get_n());
+    char * cwd { getcwd(nullptr, 0) };
+
+    if(cwd == nullptr) {
+        return path;
     }
 
+    const std::string ret { std::string(cwd) + "/" + path };
+    free(cwd);
+
     return ret;
 }
 
+// flushes a file or directory to disk, false if that failed
+bool sync_path(const std::string & path)
+{
+    const int fd { ::open(path.c_str(), O_RDONLY) };
+
+    if(fd < 0) {
+        std::cerr << "unable to open for sync: " << path << " " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    const bool ok { ::fsync(fd) == 0 };
+
+    if(! ok) {
+        std::cerr << "sync failed: " << path << " " << std::strerror(errno) << std::endl;
+    }
+
+    ::close(fd);
+    return ok;
+}
+
+// false if file is already being written, see snapshot_files
+bool claim_snapshot_file(const std::string & file)
+{
+    std::lock_guard<std::mutex> lock(snapshot_files_lock);
+
+    if(! snapshot_files.insert(file).second) {
+        std::cerr << "snapshot already being written to " << file << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void release_snapshot_file(const std::string & file)
+{
+    std::lock_guard<std::mutex> lock(snapshot_files_lock);
+    snapshot_files.erase(file);
+}
+
+// written beside file, synced and renamed over it, so a snapshot the wal
+// refers to is never left half written or lost to a crash
+bool write_snapshot(
+    const sdr::bank & bank,
+    const std::string & file,
+    const std::function<void(std::size_t)> & progress = std::function<void(std::size_t)>()
+) {
+    const std::string tmp { file + ".tmp." + std::to_string(getpid()) + "." + std::to_string(++snapshot_counter) };
+
+    if(! bank.save_to_file(tmp, progress) || ! sync_path(tmp)) {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    if(rename(tmp.c_str(), file.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    // the rename itself lives in the directory
+    const std::size_t slash { file.rfind('/') };
+    return sync_path(slash == std::string::npos ? "." : (slash == 0 ? "/" : file.substr(0, slash)));
+}
+
 result_container render_error(const std::string & s, const std::string & piece)
 {
     std::stringstream ss;
-    ss  << "ERR: " <<  s << " => " << piece << std::endl;
+    ss  << "ERR: " <<  s << " => " << piece;
 
     const std::string rstr { ss.str() };
 
     if(verbose) {
-        std::cerr << rstr;
+        std::cerr << rstr << std::endl;
     }
 
     return result_container(rstr);
@@ -109,16 +488,19 @@ check_result syntax_eq_check(const std::string & a, const std::string & b)
     }
 }
 
-check_result number_check(const std::string & str)
+check_result number_check(const token & str)
 {
-    if(! is_number(str)) {
-        return check_result(render_error("not a number", str));
+    std::size_t n;
+
+    if(parse_number(str, n) == parse_error::INVALID) {
+        return check_result(render_error("not a number", str.str()));
     } else {
         return check_result(true);
     }
 }
 
-check_result argument_length_check_lt(const std::vector<std::string> & pieces, const std::size_t len)
+template <typename T>
+check_result argument_length_check_lt(const std::vector<T> & pieces, const std::size_t len)
 {
     if(pieces.size() < len) {
         std::stringstream ss;
@@ -129,7 +511,8 @@ check_result argument_length_check_lt(const std::vector<std::string> & pieces, c
     }
 }
 
-check_result argument_length_check_eq(const std::vector<std::string> & pieces, const std::size_t len)
+template <typename T>
+check_result argument_length_check_eq(const std::vector<T> & pieces, const std::size_t len)
 {
     if(pieces.size() != len) {
         std::stringstream ss;
@@ -140,23 +523,51 @@ check_result argument_length_check_eq(const std::vector<std::string> & pieces, c
     }
 }
 
-check_result positions_smaller_than_width_check(const db_container & db_it, const std::vector<number_container> & positions)
-{
-    for(const number_container pos : positions) {
-        if(pos.get_n() >= db_it.get_width()) {
-            return check_result(render_error("position too large for db", pos.get_s()));
+check_result positions_smaller_than_width_check(
+    const db_container & db_it,
+    std::vector<std::size_t>::const_iterator first,
+    std::vector<std::size_t>::const_iterator last
+) {
+    for(; first != last; ++first) {
+        if(*first >= db_it.get_width()) {
+            return check_result(render_error("position too large for db", std::to_string(*first)));
         }
     }
 
     return check_result(true);
 }
 
+check_result concept_exists_check(const db_container & db_it, const std::size_t concept_id)
+{
+    if(! concept_id) {
+        return check_result(render_error("concept not found", std::to_string(concept_id)));
+    }
+    if(concept_id >= db_it.get_storage_size()) {
+        return check_result(render_error("id larger than amount in storage", std::to_string(concept_id)));
+    }
+
+    return check_result(true);
+}
+
+// returns false if name is taken
 bool create_database(const std::string & name, const std::size_t width)
 {
-    databases[name] = db_container(name, width);
+    std::lock_guard<rw_lock> guard(databases_lock);
+
+    if(databases.find(name) != databases.end()) {
+        return false;
+    }
+
+    const db_ptr db { std::make_shared<db_container>(name, width) };
 
     // add empty row for 0
-    databases[name].bank.insert(sdr::concept({}));
+    db->bank.insert(sdr::concept({}));
+
+    databases[name] = db;
+
+    wal_record rec(wal_op::CREATE, name);
+    rec.width = width;
+    wal_append(rec);
 
     if(verbose) {
         std::cout << "database " << name << " created" << std::endl;
@@ -165,10 +576,26 @@ bool create_database(const std::string & name, const std::size_t width)
     return true;
 }
 
-bool drop_database(const db_container & db_it)
+// returns false if db_name does not exist
+bool drop_database(const std::string & db_name)
 {
-    const std::string & db_name { db_it.name };
-    databases.erase(db_name);
+    std::lock_guard<rw_lock> guard(databases_lock);
+
+    const auto db = databases.find(db_name);
+    if(db == databases.end()) {
+        return false;
+    }
+
+    // waits out commands still running on it
+    // anything that looked it up before the erase sees dropped and bails
+    {
+        std::lock_guard<rw_lock> db_guard(db->second->lock);
+        db->second->dropped = true;
+    }
+
+    databases.erase(db);
+
+    wal_append(wal_record(wal_op::DROP, db_name));
 
     if(verbose) {
         std::cout << "database " << db_name << " dropped" << std::endl;
@@ -184,7 +611,10 @@ bool clear(db_container & db_it)
     db_it.bank.clear();
 
     // add empty row for 0
-    databases[db_name].bank.insert(sdr::concept({}));
+    db_it.bank.insert(sdr::concept({}));
+    db_it.changed();
+
+    wal_append(wal_record(wal_op::CLEAR, db_name));
 
     if(verbose) {
         std::cout << "database " << db_name << " cleared" << std::endl;
@@ -198,6 +628,12 @@ bool resize(db_container & db_it, const std::size_t width)
     const std::string & db_name { db_it.name };
 
     db_it.bank.resize(width);
+    db_it.weights.resize(width, 1.0);
+    db_it.changed();
+
+    wal_record rec(wal_op::RESIZE, db_name);
+    rec.width = width;
+    wal_append(rec);
 
     if(verbose) {
         std::cout << "database " << db_name << " resized" << std::endl;
@@ -208,7 +644,14 @@ bool resize(db_container & db_it, const std::size_t width)
 
 std::size_t insert(db_container & db_it, const std::vector<std::size_t> & trait_positions)
 {
+    const execute_phase timed(db_it);
+
     const sdr::position_t position { db_it.bank.insert(sdr::concept(trait_positions)) };
+    db_it.changed();
+
+    wal_record rec(wal_op::PUT, db_it.name);
+    rec.traits = trait_positions;
+    wal_append(rec);
 
     if(verbose) {
         std::cout << position << std::endl;
@@ -217,9 +660,48 @@ std::size_t insert(db_container & db_it, const std::vector<std::size_t> & trait_
     return position;
 }
 
+// traits holds every concept's traits back to back, sizes how many each has
+// returns the first and last id given out, which are consecutive
+std::vector<std::size_t> insert_many(db_container & db_it, const std::vector<std::size_t> & traits, const std::vector<std::size_t> & sizes)
+{
+    const execute_phase timed(db_it);
+
+    std::vector<sdr::concept> concepts;
+    concepts.reserve(sizes.size());
+
+    auto it = traits.begin();
+    for(const std::size_t size : sizes) {
+        concepts.emplace_back(std::vector<sdr::position_t>(it, it + size));
+        it += size;
+    }
+
+    const sdr::position_t first { db_it.bank.bulk_insert(concepts) };
+    const sdr::position_t last  { first + sizes.size() - 1 };
+    db_it.changed();
+
+    wal_record rec(wal_op::MPUT, db_it.name);
+    rec.traits = traits;
+    rec.sizes = sizes;
+    wal_append(rec);
+
+    if(verbose) {
+        std::cout << first << " " << last << std::endl;
+    }
+
+    return std::vector<std::size_t> { first, last };
+}
+
 bool update(db_container & db_it, const std::size_t concept_id, const std::vector<std::size_t> & trait_positions)
 {
+    const execute_phase timed(db_it);
+
     db_it.bank.update(concept_id, sdr::concept(trait_positions));
+    db_it.changed();
+
+    wal_record rec(wal_op::UPDATE, db_it.name);
+    rec.concept_id = concept_id;
+    rec.traits = trait_positions;
+    wal_append(rec);
 
     if(verbose) {
         std::cout << "OK" << std::endl;
@@ -228,137 +710,585 @@ bool update(db_container & db_it, const std::size_t concept_id, const std::vecto
     return true;
 }
 
-std::size_t similarity(const db_container & db_it, const std::size_t concept_a_id, const std::size_t concept_b_id)
+bool set_weights(db_container & db_it, const std::vector<std::size_t> & positions, const std::vector<double> & weights)
 {
-    const std::size_t result { db_it.bank.similarity(concept_a_id, concept_b_id) };
+    for(std::size_t i=0; i<positions.size(); ++i) {
+        db_it.weights[positions[i]] = weights[i];
+    }
+    db_it.changed();
+
+    wal_record rec(wal_op::WEIGHTS, db_it.name);
+    rec.traits = positions;
+    rec.weights = weights;
+    wal_append(rec);
 
     if(verbose) {
-        std::cout << result << std::endl;
+        std::cout << "database " << db_it.name << " weights set" << std::endl;
     }
 
-    return result;
+    return true;
 }
 
-std::size_t usimilarity(const db_container & db_it, const std::size_t concept_id, const std::vector<std::size_t> & concept_positions)
+// snapshots hold no weights, so replay skipping everything before one
+// would lose them, this logs them again after the snapshot record
+void log_weights(const db_container & db_it)
 {
-    const std::size_t result { db_it.bank.union_similarity(concept_id, concept_positions) };
+    wal_record rec(wal_op::WEIGHTS, db_it.name);
 
-    if(verbose) {
-        std::cout << result << std::endl;
+    for(std::size_t i=0; i<db_it.weights.size(); ++i) {
+        if(db_it.weights[i] != 1.0) {
+            rec.traits.emplace_back(i);
+            rec.weights.emplace_back(db_it.weights[i]);
+        }
     }
 
-    return result;
+    if(! rec.traits.empty()) {
+        wal_append(rec);
+    }
 }
 
-std::vector<std::pair<std::size_t, std::size_t>> closest(const db_container & db_it, const std::size_t amount, const std::size_t concept_id)
+bool save(const db_container & db_it, const std::string & file)
 {
-    const std::vector<std::pair<std::size_t, std::size_t>> results { db_it.bank.closest(concept_id, amount) };
+    const std::string path { absolute_path(file) };
 
-    if(verbose) {
-        for(std::size_t i=0; i<results.size(); ++i) {
-            const std::pair<std::size_t, std::size_t> item { results[i] };
+    if(! claim_snapshot_file(path)) {
+        return false;
+    }
 
-            std::cout << item.first << ":" << item.second;
-            if(i != results.size() - 1) {
-                std::cout << " ";
-            }
-        }
+    if(! write_snapshot(db_it.bank, path)) {
+        release_snapshot_file(path);
+        return false;
+    }
 
-        std::cout << std::endl;
+    // everything logged for this database up to now is in file
+    if(wal) {
+        wal_record rec(wal_op::SNAPSHOT, db_it.name);
+        rec.width = db_it.get_width();
+        rec.base_lsn = wal->get_next_lsn();
+        rec.file = path;
+        wal_append(rec);
+        log_weights(db_it);
     }
 
-    return results;
+    release_snapshot_file(path);
+
+    if(verbose) {
+        std::cout << "database " << db_it.name << " saved to " << file << std::endl;
+    }
+
+    return true;
 }
 
-std::vector<std::size_t> matching(const db_container & db_it, const std::vector<std::size_t> & trait_positions)
+// the snapshot is written by a forked child, see background_save
+// the caller must hold the database's lock, so no writer is midway through
+// changing the bank at fork
+bool start_bgsave(const db_container & db_it, const std::string & file)
 {
-    const std::vector<std::size_t> results { db_it.bank.matching(sdr::concept(trait_positions)) };
+    wal_record rec(wal_op::SNAPSHOT, db_it.name);
+    rec.width = db_it.get_width();
+    rec.base_lsn = wal ? wal->get_next_lsn() : 0;
+    rec.file = absolute_path(file);
 
-    if(verbose) {
-        for(std::size_t i=0; i<results.size(); ++i) {
-            const std::size_t item { results[i] };
+    if(! claim_snapshot_file(rec.file)) {
+        return false;
+    }
+
+    const sdr::bank & bank { db_it.bank };
+
+    const bool started { bgsave.start(db_it.name, rec.file, db_it.get_storage_size(), [&](background_save::progress & p) {
+        return write_snapshot(bank, rec.file, [&](const std::size_t written) {
+            p.written = written;
+        });
+    }, [rec](const bool ok) {
+        if(ok) {
+            const db_ptr db { find_database(rec.db_name) };
+
+            if(db) {
+                shared_guard guard(db->lock);
 
-            std::cout << item;
-            if(i != results.size() - 1) {
-                std::cout << " ";
+                wal_append(rec);
+                log_weights(*db);
             }
+
+            if(! wal_sync()) {
+                std::cerr << "background save of " << rec.db_name << " not logged, the wal failed" << std::endl;
+            }
+        }
+
+        release_snapshot_file(rec.file);
+
+        if(verbose) {
+            std::cout << "background save of " << rec.db_name << " to " << rec.file << (ok ? " done" : " failed") << std::endl;
         }
+    }) };
 
-        std::cout << std::endl;
+    if(! started) {
+        release_snapshot_file(rec.file);
+    } else if(verbose) {
+        std::cout << "background save of " << db_it.name << " started" << std::endl;
     }
 
-    return results;
+    return started;
 }
 
-std::vector<std::size_t> matchingx(const db_container & db_it, const std::size_t amount, const std::vector<std::size_t> & trait_positions)
+// loads into a fresh bank first so a bad file leaves the database untouched
+std::size_t load(db_container & db_it, const std::string & file)
 {
-    const std::vector<std::size_t> results { db_it.bank.matching(sdr::concept(trait_positions), amount) };
+    sdr::bank loaded(db_it.get_width());
+    const std::size_t amount { loaded.load_from_file(file) };
+
+    if(! amount) {
+        return 0;
+    }
+
+    db_it.bank = std::move(loaded);
+    db_it.changed();
+
+    if(wal) {
+        wal_record rec(wal_op::SNAPSHOT, db_it.name);
+        rec.width = db_it.get_width();
+        rec.base_lsn = wal->get_next_lsn();
+        rec.file = absolute_path(file);
+        wal_append(rec);
+        log_weights(db_it);
+    }
 
     if(verbose) {
-        for(std::size_t i=0; i<results.size(); ++i) {
-            const std::size_t item { results[i] };
+        std::cout << "database " << db_it.name << " loaded " << amount << " concepts from " << file << std::endl;
+    }
 
-            std::cout << item;
-            if(i != results.size() - 1) {
-                std::cout << " ";
-            }
-        }
+    return amount;
+}
 
-        std::cout << std::endl;
+template <typename T>
+void print_results(const std::vector<T> & results)
+{
+    for(std::size_t i=0; i<results.size(); ++i) {
+        std::cout << results[i];
+        if(i != results.size() - 1) {
+            std::cout << " ";
+        }
     }
 
-    return results;
+    std::cout << std::endl;
 }
 
-result_container parse_input(const std::string & input)
+template <typename T>
+void print_results(const std::vector<std::pair<std::size_t, T>> & results)
 {
-    std::istringstream iss(input);
+    for(std::size_t i=0; i<results.size(); ++i) {
+        std::cout << results[i].first << ":" << results[i].second;
+        if(i != results.size() - 1) {
+            std::cout << " ";
+        }
+    }
 
-    std::vector<std::string> pieces;
+    std::cout << std::endl;
+}
 
-    {
-        std::string piece;
+// the concept queried with, a, is either a stored concept's id or an
+// sdr::concept from the request, see traits_check
+template <typename Concept>
+std::size_t similarity(const db_container & db_it, const Concept & a, const std::size_t concept_b_id)
+{
+    const execute_phase timed(db_it);
 
-        while(std::getline(iss, piece, ' ')) {
-            const std::string & trimmed { trim(piece) };
+    const std::size_t result { db_it.bank.similarity(a, concept_b_id) };
 
-            if(! trimmed.empty()) {
-                pieces.emplace_back(trimmed);
-            }
-        }
+    if(verbose) {
+        std::cout << result << std::endl;
     }
 
-    // empty input shouldnt be passed here to start with
-    // but.. how can we trust that?
-    if(pieces.size() == 0) {
-        return result_container();
-    }
+    return result;
+}
 
-    // comment
-    if(pieces[0][0] == '#') {
-        return result_container();
+template <typename Concept>
+double weighted_similarity(const db_container & db_it, const Concept & a, const std::size_t concept_b_id)
+{
+    const execute_phase timed(db_it);
+
+    const double result { db_it.bank.weighted_similarity(a, concept_b_id, db_it.weights) };
+
+    if(verbose) {
+        std::cout << result << std::endl;
     }
 
-    const std::string & command { tolower(pieces[0]) };
+    return result;
+}
 
-    if(command == "create") {
-        {
-            check_result check { argument_length_check_eq(pieces, 3) };
-            if(! check) {
-                return result_container(check.get_rc());
-            }
-        }
+template <typename Concept>
+std::size_t usimilarity(const db_container & db_it, const Concept & a, const std::vector<std::size_t> & concept_positions)
+{
+    const execute_phase timed(db_it);
 
-        const std::string & db_name  { pieces[1] };
-        const auto db = databases.find(db_name);
-        if(db != databases.end()) {
-            return render_error("database already exists", db_name);
-        }
+    const std::size_t result { db_it.bank.union_similarity(a, concept_positions) };
 
-        const std::string & db_width { pieces[2] };
+    if(verbose) {
+        std::cout << result << std::endl;
+    }
 
-        {
-            check_result check { number_check(db_width) };
+    return result;
+}
+
+template <typename Concept>
+double weighted_usimilarity(const db_container & db_it, const Concept & a, const std::vector<std::size_t> & concept_positions)
+{
+    const execute_phase timed(db_it);
+
+    const double result { db_it.bank.weighted_union_similarity(a, concept_positions, db_it.weights) };
+
+    if(verbose) {
+        std::cout << result << std::endl;
+    }
+
+    return result;
+}
+
+// results are returned by move, straight through to the result_container
+template <typename Concept>
+std::vector<std::pair<std::size_t, std::size_t>> closest(const db_container & db_it, const std::size_t amount, const Concept & a)
+{
+    const execute_phase timed(db_it);
+
+    std::vector<std::pair<std::size_t, std::size_t>> results { db_it.bank.closest(a, amount, sample.explain()) };
+    sample.results = results.size();
+
+    if(verbose) {
+        print_results(results);
+    }
+
+    return results;
+}
+
+template <typename Concept>
+std::vector<std::pair<std::size_t, double>> weighted_closest(const db_container & db_it, const std::size_t amount, const Concept & a)
+{
+    const execute_phase timed(db_it);
+
+    std::vector<std::pair<std::size_t, double>> results { db_it.bank.weighted_closest(a, amount, db_it.weights, sample.explain()) };
+    sample.results = results.size();
+
+    if(verbose) {
+        print_results(results);
+    }
+
+    return results;
+}
+
+std::vector<std::vector<std::pair<std::size_t, std::size_t>>> mclosest(const db_container & db_it, const std::size_t amount, const std::vector<std::size_t> & concept_ids)
+{
+    const execute_phase timed(db_it);
+
+    std::vector<std::vector<std::pair<std::size_t, std::size_t>>> results { db_it.bank.batch_closest(concept_ids, amount) };
+    sample.results = results.size();
+
+    if(verbose) {
+        for(auto & result : results) {
+            print_results(result);
+        }
+    }
+
+    return results;
+}
+
+std::vector<std::size_t> matching(const db_container & db_it, const std::vector<std::size_t> & trait_positions)
+{
+    const execute_phase timed(db_it);
+
+    std::vector<std::size_t> results { db_it.bank.matching(sdr::concept(trait_positions)) };
+    sample.results = results.size();
+
+    if(verbose) {
+        print_results(results);
+    }
+
+    return results;
+}
+
+std::vector<std::size_t> matchingx(const db_container & db_it, const std::size_t amount, const std::vector<std::size_t> & trait_positions)
+{
+    const execute_phase timed(db_it);
+
+    std::vector<std::size_t> results { db_it.bank.matching(sdr::concept(trait_positions), amount) };
+    sample.results = results.size();
+
+    if(verbose) {
+        print_results(results);
+    }
+
+    return results;
+}
+
+// reused by every command a thread parses, so parsing allocates nothing
+// once they have grown to fit
+thread_local std::vector<token> pieces_scratch;
+thread_local std::vector<std::size_t> numbers_scratch;
+thread_local std::vector<std::size_t> traits_scratch;
+
+// parses pieces [first, last) into numbers, which is cleared first
+check_result numbers_check(
+    const std::vector<token> & pieces,
+    const std::size_t first,
+    const std::size_t last,
+    std::vector<std::size_t> & numbers
+) {
+    numbers.clear();
+
+    for(std::size_t i=first; i<last; ++i) {
+        number_container n(pieces[i]);
+        if(! n.parse()) {
+            return check_result(n.err());
+        }
+
+        numbers.emplace_back(n.get_n());
+    }
+
+    return check_result(true);
+}
+
+check_result numbers_check(const std::vector<token> & pieces, const std::size_t first, std::vector<std::size_t> & numbers)
+{
+    return numbers_check(pieces, first, pieces.size(), numbers);
+}
+
+// true if pieces[pos] is the "traits" keyword, which queries with the
+// traits after it in place of a stored concept
+bool is_traits_keyword(const std::vector<token> & pieces, const std::size_t pos)
+{
+    return pos < pieces.size() && pieces[pos].iequals("traits");
+}
+
+// traits of a concept that is scored but not stored
+// sorted and without repeats, as the bank expects of a concept
+check_result concept_traits_check(const db_container & db_it, std::vector<std::size_t> & traits)
+{
+    if(traits.empty()) {
+        return check_result(render_error("no traits given", "traits"));
+    }
+
+    {
+        check_result check { positions_smaller_than_width_check(db_it, traits.begin(), traits.end()) };
+        if(! check) {
+            return check_result(check.get_rc());
+        }
+    }
+
+    std::sort(traits.begin(), traits.end());
+    traits.erase(std::unique(traits.begin(), traits.end()), traits.end());
+
+    return check_result(true);
+}
+
+// parses lists of numbers separated by "," from first on
+// a "," need not stand apart, so "1 2, 3" and "1 2 ,3" read as "1 2 , 3"
+// traits gets every list back to back, sizes the length of each
+check_result concepts_check(
+    const std::vector<token> & pieces,
+    const std::size_t first,
+    std::vector<std::size_t> & traits,
+    std::vector<std::size_t> & sizes
+) {
+    traits.clear();
+    sizes.clear();
+
+    std::size_t size { 0 };
+
+    for(std::size_t i=first; i<pieces.size(); ++i) {
+        const token & piece { pieces[i] };
+        std::size_t start { 0 };
+
+        for(std::size_t j=0; j<=piece.size; ++j) {
+            if(j < piece.size && piece[j] != ',') {
+                continue;
+            }
+
+            if(j > start) {
+                number_container n(token(piece.data + start, j - start));
+                if(! n.parse()) {
+                    return check_result(n.err());
+                }
+
+                traits.emplace_back(n.get_n());
+                ++size;
+            }
+
+            if(j < piece.size) {
+                if(! size) {
+                    return check_result(render_error("empty concept", piece.str()));
+                }
+
+                sizes.emplace_back(size);
+                size = 0;
+            }
+
+            start = j + 1;
+        }
+    }
+
+    if(! size) {
+        return check_result(render_error("empty concept", pieces.back().str()));
+    }
+
+    sizes.emplace_back(size);
+
+    return check_result(true);
+}
+
+// bytes held by a database, as counted by its bank's allocators, with its
+// amount largest columns
+// slack is what column hash tables hold beyond their entries
+// called with db_it locked
+std::string describe_memory(const db_container & db_it, const std::size_t amount)
+{
+    const sdr::memory_usage & m { db_it.bank.get_memory_usage() };
+
+    std::vector<std::pair<std::size_t, std::size_t>> columns;
+    columns.reserve(m.columns.size());
+
+    std::size_t column_bytes { m.column_array.get() };
+    std::size_t slack { 0 };
+
+    for(std::size_t i=0; i<m.columns.size(); ++i) {
+        const std::size_t bytes { m.columns[i].get() };
+        const std::size_t used { db_it.bank.get_column_size(i) * sizeof(sdr::position_t) };
+
+        column_bytes += bytes;
+        slack += bytes > used ? bytes - used : 0;
+        columns.emplace_back(std::make_pair(i, bytes));
+    }
+
+    const std::size_t weights { db_it.weights.capacity() * sizeof(double) };
+    const std::size_t total { column_bytes + m.storage.get() + m.scratch.get() + weights };
+
+    std::stringstream ss;
+    ss  << "total=" << total
+        << " columns=" << column_bytes
+        << " column_slack=" << slack
+        << " storage=" << m.storage.get()
+        << " scratch=" << m.scratch.get()
+        << " scratch_peak=" << m.scratch.get_peak()
+        << " weights=" << weights;
+
+    if(amount > 0) {
+        const std::size_t shown { std::min(amount, columns.size()) };
+
+        std::partial_sort(columns.begin(), columns.begin() + shown, columns.end(), [](
+            const std::pair<std::size_t, std::size_t> & a,
+            const std::pair<std::size_t, std::size_t> & b
+        ) {
+            return a.second > b.second;
+        });
+
+        // POSITION:BYTES:ENTRIES
+        ss << " largest=";
+
+        for(std::size_t i=0; i<shown; ++i) {
+            ss  << (i ? "," : "")
+                << columns[i].first << ":" << columns[i].second << ":" << db_it.bank.get_column_size(columns[i].first);
+        }
+    }
+
+    return ss.str();
+}
+
+// where TYPE is in "query DBNAME [weighted] [async] TYPE ...", which may be
+// past the end of pieces
+std::size_t query_type_position(const std::vector<token> & pieces)
+{
+    const bool weighted { pieces.size() > 2 && pieces[2].iequals("weighted") };
+    const bool async    { pieces.size() > static_cast<std::size_t>(2 + weighted) && pieces[2 + weighted].iequals("async") };
+
+    return static_cast<std::size_t>(2 + weighted + async);
+}
+
+command_kind query_kind(const token & qtype)
+{
+    if(qtype == "similarity") {
+        return command_kind::SIMILARITY;
+    } else if(qtype == "usimilarity") {
+        return command_kind::USIMILARITY;
+    } else if(qtype == "closest") {
+        return command_kind::CLOSEST;
+    } else if(qtype == "matching") {
+        return command_kind::MATCHING;
+    } else if(qtype == "matchingx") {
+        return command_kind::MATCHINGX;
+    }
+
+    return command_kind::NONE;
+}
+
+// the kind of a "query" or "mquery" command
+command_kind text_query_kind(const std::vector<token> & pieces)
+{
+    if(pieces[0].iequals("mquery")) {
+        return command_kind::MCLOSEST;
+    }
+
+    const std::size_t qtype_pos { query_type_position(pieces) };
+
+    return qtype_pos < pieces.size() ? query_kind(pieces[qtype_pos]) : command_kind::NONE;
+}
+
+command_kind binary_kind(const protocol::opcode op)
+{
+    switch(op) {
+        case protocol::opcode::PUT:
+            return command_kind::PUT;
+        case protocol::opcode::UPDATE:
+            return command_kind::UPDATE;
+        case protocol::opcode::SIMILARITY:
+            return command_kind::SIMILARITY;
+        case protocol::opcode::USIMILARITY:
+            return command_kind::USIMILARITY;
+        case protocol::opcode::CLOSEST:
+            return command_kind::CLOSEST;
+        case protocol::opcode::MATCHING:
+            return command_kind::MATCHING;
+        case protocol::opcode::MATCHINGX:
+            return command_kind::MATCHINGX;
+        case protocol::opcode::MPUT:
+            return command_kind::MPUT;
+        case protocol::opcode::MCLOSEST:
+            return command_kind::MCLOSEST;
+        default:
+            return command_kind::NONE;
+    }
+}
+
+// tagged is set for commands sent as "@TAG COMMAND", which run apart from
+// the rest of their connection's commands, see event_loop
+result_container parse_input(const char * begin, const char * end, const bool tagged)
+{
+    std::vector<token> & pieces { pieces_scratch };
+    tokenize(begin, end, pieces);
+
+    // empty input shouldnt be passed here to start with
+    // but.. how can we trust that?
+    if(pieces.size() == 0) {
+        return result_container();
+    }
+
+    // comment
+    if(pieces[0][0] == '#') {
+        return result_container();
+    }
+
+    const token & command { pieces[0] };
+
+    if(command.iequals("create")) {
+        {
+            check_result check { argument_length_check_eq(pieces, 3) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        const std::string db_name { pieces[1].str() };
+        const token & db_width { pieces[2] };
+
+        {
+            check_result check { number_check(db_width) };
             if(! check) {
                 return result_container(check.get_rc());
             }
@@ -369,8 +1299,20 @@ result_container parse_input(const std::string & input)
             return width.err();
         }
 
-        return result_container(create_database(db_name, width.get_n()));
-    } else if(command == "drop") {
+        if(! create_database(db_name, width.get_n())) {
+            return render_error("database already exists", db_name);
+        }
+
+        return result_container(true);
+    } else if(command.iequals("binary")) {
+        // the event loop does not switch for a tagged command
+        if(tagged) {
+            return render_error("binary cannot be tagged", command.str());
+        }
+
+        // the event loop reads frames from here on, see protocol.hpp
+        return result_container(true);
+    } else if(command.iequals("drop")) {
         {
             check_result check { argument_length_check_eq(pieces, 2) };
             if(! check) {
@@ -378,15 +1320,14 @@ result_container parse_input(const std::string & input)
             }
         }
 
-        const std::string & db_name { pieces[1] };
+        const std::string db_name { pieces[1].str() };
 
-        const auto db = databases.find(db_name);
-        if(db == databases.end()) {
+        if(! drop_database(db_name)) {
             return render_error("database not found", db_name);
         }
 
-        return result_container(drop_database(db->second));
-    } else if(command == "clear") {
+        return result_container(true);
+    } else if(command.iequals("clear")) {
         {
             check_result check { argument_length_check_eq(pieces, 2) };
             if(! check) {
@@ -394,14 +1335,19 @@ result_container parse_input(const std::string & input)
             }
         }
 
-        const std::string & db_name { pieces[1] };
-        const auto db = databases.find(db_name);
-        if(db == databases.end()) {
+        const std::string db_name { pieces[1].str() };
+        const db_ptr db { find_database(db_name) };
+        if(! db) {
+            return render_error("database not found", db_name);
+        }
+
+        std::lock_guard<rw_lock> guard(db->lock);
+        if(db->dropped) {
             return render_error("database not found", db_name);
         }
 
-        return result_container(clear(db->second));
-     } else if(command == "resize") {
+        return result_container(clear(*db));
+     } else if(command.iequals("resize")) {
         {
             check_result check { argument_length_check_eq(pieces, 3) };
             if(! check) {
@@ -409,13 +1355,18 @@ result_container parse_input(const std::string & input)
             }
         }
 
-        const std::string & db_name { pieces[1] };
-        const auto db = databases.find(db_name);
-        if(db == databases.end()) {
+        const std::string db_name { pieces[1].str() };
+        const db_ptr db { find_database(db_name) };
+        if(! db) {
+            return render_error("database not found", db_name);
+        }
+
+        std::lock_guard<rw_lock> guard(db->lock);
+        if(db->dropped) {
             return render_error("database not found", db_name);
         }
 
-        const std::string & db_width { pieces[2] };
+        const token & db_width { pieces[2] };
         {
             check_result check { number_check(db_width) };
             if(! check) {
@@ -428,400 +1379,1887 @@ result_container parse_input(const std::string & input)
             return width.err();
         }
 
-        return result_container(resize(db->second, width.get_n()));
-     } else if(command == "put") {
-        {
-            check_result check { argument_length_check_lt(pieces, 3) };
-            if(! check) {
-                return result_container(check.get_rc());
-            }
-        }
+        return result_container(resize(*db, width.get_n()));
+     } else if(command.iequals("put")) {
+        {
+            check_result check { argument_length_check_lt(pieces, 3) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        std::vector<std::size_t> & trait_positions { numbers_scratch };
+        {
+            check_result check { numbers_check(pieces, 2, trait_positions) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        const std::string db_name { pieces[1].str() };
+        const db_ptr db { find_database(db_name) };
+        if(! db) {
+            return render_error("database not found", db_name);
+        }
+
+        sample.track(command_kind::PUT, db);
+
+        std::lock_guard<rw_lock> guard(db->lock);
+        if(db->dropped) {
+            return render_error("database not found", db_name);
+        }
+        db_container & db_it { *db };
+
+        {
+            check_result check { positions_smaller_than_width_check(db_it, trait_positions.begin(), trait_positions.end()) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        return result_container(insert(db_it, trait_positions));
+     } else if(command.iequals("mput")) {
+        //mput DBNAME TRAITS... [, TRAITS...]...
+        {
+            check_result check { argument_length_check_lt(pieces, 3) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        std::vector<std::size_t> & traits { numbers_scratch };
+        thread_local std::vector<std::size_t> sizes;
+        {
+            check_result check { concepts_check(pieces, 2, traits, sizes) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        const std::string db_name { pieces[1].str() };
+        const db_ptr db { find_database(db_name) };
+        if(! db) {
+            return render_error("database not found", db_name);
+        }
+
+        sample.track(command_kind::MPUT, db);
+
+        std::lock_guard<rw_lock> guard(db->lock);
+        if(db->dropped) {
+            return render_error("database not found", db_name);
+        }
+        db_container & db_it { *db };
+
+        {
+            check_result check { positions_smaller_than_width_check(db_it, traits.begin(), traits.end()) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        return result_container(insert_many(db_it, traits, sizes));
+     }  else if(command.iequals("update")) {
+        //update DBNAME CONCEPT_ID TRAITS....
+        {
+            check_result check { argument_length_check_lt(pieces, 3) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        number_container concept_id(pieces[2]);
+        if(! concept_id.parse()) {
+            return concept_id.err();
+        }
+
+        std::vector<std::size_t> & trait_positions { numbers_scratch };
+        {
+            check_result check { numbers_check(pieces, 3, trait_positions) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        const std::string db_name { pieces[1].str() };
+        const db_ptr db { find_database(db_name) };
+        if(! db) {
+            return render_error("database not found", db_name);
+        }
+
+        sample.track(command_kind::UPDATE, db);
+
+        std::lock_guard<rw_lock> guard(db->lock);
+        if(db->dropped) {
+            return render_error("database not found", db_name);
+        }
+        db_container & db_it { *db };
+
+        {
+            check_result check { concept_exists_check(db_it, concept_id.get_n()) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        {
+            check_result check { positions_smaller_than_width_check(db_it, trait_positions.begin(), trait_positions.end()) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        return result_container(update(db_it, concept_id.get_n(), trait_positions));
+     } else if(command.iequals("weights")) {
+        //weights DBNAME POSITION WEIGHT [POSITION WEIGHT]...
+        {
+            check_result check { argument_length_check_lt(pieces, 4) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        if(pieces.size() % 2 != 0) {
+            return render_error("expected position weight pairs", pieces.back().str());
+        }
+
+        std::vector<std::size_t> & positions { numbers_scratch };
+        thread_local std::vector<double> weights;
+
+        positions.clear();
+        weights.clear();
+
+        for(std::size_t i=2; i<pieces.size(); i += 2) {
+            number_container pos(pieces[i]);
+            if(! pos.parse()) {
+                return pos.err();
+            }
+
+            double w;
+            if(parse_double(pieces[i + 1], w) != parse_error::NONE) {
+                return render_error("not a weight", pieces[i + 1].str());
+            }
+
+            positions.emplace_back(pos.get_n());
+            weights.emplace_back(w);
+        }
+
+        const std::string db_name { pieces[1].str() };
+        const db_ptr db { find_database(db_name) };
+        if(! db) {
+            return render_error("database not found", db_name);
+        }
+
+        std::lock_guard<rw_lock> guard(db->lock);
+        if(db->dropped) {
+            return render_error("database not found", db_name);
+        }
+        db_container & db_it { *db };
+
+        {
+            check_result check { positions_smaller_than_width_check(db_it, positions.begin(), positions.end()) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        return result_container(set_weights(db_it, positions, weights));
+     } else if(command.iequals("query")) {
+        {
+            check_result check { argument_length_check_lt(pieces, 4) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        const bool weighted         { pieces[2].iequals("weighted") };
+        const bool async            { pieces[weighted ? 3 : 2].iequals("async") };
+        const std::size_t qtype_pos { query_type_position(pieces) };
+
+        {
+            check_result check { argument_length_check_lt(pieces, qtype_pos + 1) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        // async only says the query is expected to take a while, which
+        // is what a tag is for
+        if(async && ! tagged) {
+            return render_error("async queries need a tag, as in @ID query", "async");
+        }
+
+        const token & qtype { pieces[qtype_pos] };
+
+        const std::string db_name { pieces[1].str() };
+        const db_ptr db { find_database(db_name) };
+        if(! db) {
+            return render_error("database not found", db_name);
+        }
+
+        sample.track(query_kind(qtype), db);
+
+        shared_guard guard(db->lock);
+        const db_container & db_it { *db };
+
+        if(qtype == "similarity") {
+            if(async) {
+                return render_error("similarity cannot be async", "async");
+            }
+
+            if(is_traits_keyword(pieces, qtype_pos + 2)) {
+                //similarity CONCEPT traits TRAIT...
+                number_container concept_id(pieces[qtype_pos + 1]);
+                if(! concept_id.parse()) {
+                    return concept_id.err();
+                }
+
+                {
+                    check_result check { concept_exists_check(db_it, concept_id.get_n()) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                std::vector<std::size_t> & traits { traits_scratch };
+                {
+                    check_result check { numbers_check(pieces, qtype_pos + 3, traits) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                {
+                    check_result check { concept_traits_check(db_it, traits) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                const sdr::concept concept(traits);
+
+                if(weighted) {
+                    return result_container(weighted_similarity(db_it, concept, concept_id.get_n()));
+                }
+
+                return result_container(similarity(db_it, concept, concept_id.get_n()));
+            }
+
+            {
+                check_result check { argument_length_check_eq(pieces, qtype_pos + 3) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            number_container concept_a_id(pieces[qtype_pos + 1]);
+            if(! concept_a_id.parse()) {
+                return concept_a_id.err();
+            }
+
+            {
+                check_result check { concept_exists_check(db_it, concept_a_id.get_n()) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            number_container concept_b_id(pieces[qtype_pos + 2]);
+            if(! concept_b_id.parse()) {
+                return concept_b_id.err();
+            }
+
+            {
+                check_result check { concept_exists_check(db_it, concept_b_id.get_n()) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            if(weighted) {
+                return result_container(weighted_similarity(db_it, concept_a_id.get_n(), concept_b_id.get_n()));
+            }
+
+            return result_container(similarity(db_it, concept_a_id.get_n(), concept_b_id.get_n()));
+        } else if(qtype == "usimilarity") {
+            if(async) {
+                return render_error("usimilarity cannot be async", "async");
+            }
+
+            std::size_t traits_pos { qtype_pos + 1 };
+            while(traits_pos < pieces.size() && ! is_traits_keyword(pieces, traits_pos)) {
+                ++traits_pos;
+            }
+
+            if(traits_pos < pieces.size()) {
+                //usimilarity CONCEPT... traits TRAIT...
+                if(traits_pos == qtype_pos + 1) {
+                    return render_error("no concepts given", "traits");
+                }
+
+                std::vector<std::size_t> & concept_positions { numbers_scratch };
+                {
+                    check_result check { numbers_check(pieces, qtype_pos + 1, traits_pos, concept_positions) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                for(const std::size_t concept_id : concept_positions) {
+                    check_result check { concept_exists_check(db_it, concept_id) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                std::vector<std::size_t> & traits { traits_scratch };
+                {
+                    check_result check { numbers_check(pieces, traits_pos + 1, traits) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                {
+                    check_result check { concept_traits_check(db_it, traits) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                const sdr::concept concept(traits);
+
+                if(weighted) {
+                    return result_container(weighted_usimilarity(db_it, concept, concept_positions));
+                }
+
+                return result_container(usimilarity(db_it, concept, concept_positions));
+            }
+
+            {
+                check_result check { argument_length_check_lt(pieces, qtype_pos + 3) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            number_container concept_id(pieces[qtype_pos + 1]);
+            if(! concept_id.parse()) {
+                return concept_id.err();
+            }
+
+            {
+                check_result check { concept_exists_check(db_it, concept_id.get_n()) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            std::vector<std::size_t> & concept_positions { numbers_scratch };
+            {
+                check_result check { numbers_check(pieces, qtype_pos + 2, concept_positions) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            if(weighted) {
+                return result_container(weighted_usimilarity(db_it, concept_id.get_n(), concept_positions));
+            }
+
+            return result_container(usimilarity(db_it, concept_id.get_n(), concept_positions));
+        } else if(qtype == "closest") {
+            {
+                check_result check { argument_length_check_lt(pieces, qtype_pos + 3) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            const token & amount_str { pieces[qtype_pos + 1] };
+            {
+                check_result check { number_check(amount_str) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            number_container amount(amount_str);
+            if(! amount.parse()) {
+                return amount.err();
+            }
+
+            if(is_traits_keyword(pieces, qtype_pos + 2)) {
+                //closest AMOUNT traits TRAIT...
+                std::vector<std::size_t> & traits { traits_scratch };
+                {
+                    check_result check { numbers_check(pieces, qtype_pos + 3, traits) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                {
+                    check_result check { concept_traits_check(db_it, traits) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                const sdr::concept concept(traits);
+
+                if(weighted) {
+                    return result_container(weighted_closest(db_it, amount.get_n(), concept));
+                }
+
+                return result_container(closest(db_it, amount.get_n(), concept));
+            }
+
+            {
+                check_result check { argument_length_check_eq(pieces, qtype_pos + 3) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            number_container concept_id(pieces[qtype_pos + 2]);
+            if(! concept_id.parse()) {
+                return concept_id.err();
+            }
+
+            {
+                check_result check { concept_exists_check(db_it, concept_id.get_n()) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            if(weighted) {
+                return result_container(weighted_closest(db_it, amount.get_n(), concept_id.get_n()));
+            }
+
+            return result_container(closest(db_it, amount.get_n(), concept_id.get_n()));
+        } else if(qtype == "matching") {
+            if(weighted) {
+                return render_error("matching cannot be weighted", "weighted");
+            }
+
+            if(async) {
+                return render_error("matching cannot be async", "async");
+            }
+
+            {
+                check_result check { argument_length_check_lt(pieces, qtype_pos + 2) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            std::vector<std::size_t> & trait_positions { numbers_scratch };
+            {
+                check_result check { numbers_check(pieces, qtype_pos + 1, trait_positions) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            {
+                check_result check { positions_smaller_than_width_check(db_it, trait_positions.begin(), trait_positions.end()) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            return result_container(matching(db_it, trait_positions));
+        } else if(qtype == "matchingx") {
+            if(weighted) {
+                return render_error("matchingx cannot be weighted", "weighted");
+            }
+
+            if(async) {
+                return render_error("matchingx cannot be async", "async");
+            }
+
+            {
+                check_result check { argument_length_check_lt(pieces, qtype_pos + 3) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            const token & amount_str { pieces[qtype_pos + 1] };
+            {
+                check_result check { number_check(amount_str) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            number_container amount(amount_str);
+            if(! amount.parse()) {
+                return amount.err();
+            }
+
+            std::vector<std::size_t> & trait_positions { numbers_scratch };
+            {
+                check_result check { numbers_check(pieces, qtype_pos + 2, trait_positions) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            {
+                check_result check { positions_smaller_than_width_check(db_it, trait_positions.begin(), trait_positions.end()) };
+                if(! check) {
+                    return result_container(check.get_rc());
+                }
+            }
+
+            return result_container(matchingx(db_it, amount.get_n(), trait_positions));
+        } else {
+            return render_error("bad syntax", command.str());
+        }
+     } else if(command.iequals("mquery")) {
+        //mquery DBNAME closest AMOUNT CONCEPT_ID...
+        {
+            check_result check { argument_length_check_lt(pieces, 5) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        if(pieces[2] != "closest") {
+            return render_error("bad syntax", pieces[2].str());
+        }
+
+        const token & amount_str { pieces[3] };
+        {
+            check_result check { number_check(amount_str) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        number_container amount(amount_str);
+        if(! amount.parse()) {
+            return amount.err();
+        }
+
+        std::vector<std::size_t> & concept_ids { numbers_scratch };
+        {
+            check_result check { numbers_check(pieces, 4, concept_ids) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        const std::string db_name { pieces[1].str() };
+        const db_ptr db { find_database(db_name) };
+        if(! db) {
+            return render_error("database not found", db_name);
+        }
+
+        sample.track(command_kind::MCLOSEST, db);
+
+        shared_guard guard(db->lock);
+        const db_container & db_it { *db };
+
+        for(const std::size_t concept_id : concept_ids) {
+            check_result check { concept_exists_check(db_it, concept_id) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        return result_container(mclosest(db_it, amount.get_n(), concept_ids));
+     } else if(command.iequals("save")) {
+        //save DBNAME FILE
+        {
+            check_result check { argument_length_check_eq(pieces, 3) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        const std::string db_name { pieces[1].str() };
+        const db_ptr db { find_database(db_name) };
+        if(! db) {
+            return render_error("database not found", db_name);
+        }
+
+        shared_guard guard(db->lock);
+
+        const std::string file { pieces[2].str() };
+        if(! save(*db, file)) {
+            return render_error("unable to save", file);
+        }
+
+        return result_container(true);
+     } else if(command.iequals("stats")) {
+        //stats
+        //stats DBNAME
+        if(pieces.size() == 1) {
+            std::vector<db_ptr> all;
+
+            {
+                shared_guard guard(databases_lock);
+
+                for(const auto & it : databases) {
+                    all.emplace_back(it.second);
+                }
+            }
+
+            std::string out;
+            for(const db_ptr & db : all) {
+                db->stats.describe(db->name + " ", out);
+            }
+
+            return result_container(std::move(out));
+        }
+
+        {
+            check_result check { argument_length_check_eq(pieces, 2) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        const std::string db_name { pieces[1].str() };
+        const db_ptr db { find_database(db_name) };
+        if(! db) {
+            return render_error("database not found", db_name);
+        }
+
+        std::string out;
+        db->stats.describe("", out);
+
+        return result_container(std::move(out));
+     } else if(command.iequals("slowlog")) {
+        //slowlog get [AMOUNT]
+        //slowlog reset
+        //slowlog status
+        {
+            check_result check { argument_length_check_lt(pieces, 2) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        if(! slowlog) {
+            return render_error("slow log is off, start with -S", pieces[1].str());
+        }
+
+        if(pieces[1].iequals("reset") && pieces.size() == 2) {
+            slowlog->reset();
+            return result_container(true);
+        }
+
+        if(pieces[1].iequals("status") && pieces.size() == 2) {
+            return result_container(slowlog->status());
+        }
+
+        if(! pieces[1].iequals("get") || pieces.size() > 3) {
+            return render_error("bad syntax", pieces[1].str());
+        }
+
+        std::size_t amount { 10 };
+
+        if(pieces.size() == 3) {
+            number_container n(pieces[2]);
+            if(! n.parse()) {
+                return n.err();
+            }
+
+            amount = n.get_n();
+        }
+
+        return result_container(slowlog->get(amount));
+     } else if(command.iequals("info")) {
+        //info cache
+        //info inflight
+        //info memory [DBNAME [AMOUNT]]
+        {
+            check_result check { argument_length_check_lt(pieces, 2) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        if(pieces[1].iequals("memory")) {
+            if(pieces.size() == 2) {
+                std::vector<db_ptr> all;
+
+                {
+                    shared_guard guard(databases_lock);
+
+                    for(const auto & it : databases) {
+                        all.emplace_back(it.second);
+                    }
+                }
+
+                std::string out;
+                for(const db_ptr & db : all) {
+                    shared_guard guard(db->lock);
+
+                    if(! out.empty()) {
+                        out += " | ";
+                    }
+
+                    out += db->name + " " + describe_memory(*db, 0);
+                }
+
+                return result_container(std::move(out));
+            }
+
+            if(pieces.size() > 4) {
+                return render_error("bad syntax", pieces[4].str());
+            }
+
+            std::size_t amount { 10 };
+
+            if(pieces.size() == 4) {
+                number_container n(pieces[3]);
+                if(! n.parse()) {
+                    return n.err();
+                }
+
+                amount = n.get_n();
+            }
+
+            const std::string db_name { pieces[2].str() };
+            const db_ptr db { find_database(db_name) };
+            if(! db) {
+                return render_error("database not found", db_name);
+            }
+
+            shared_guard guard(db->lock);
+
+            return result_container(describe_memory(*db, amount));
+        }
+
+        {
+            check_result check { argument_length_check_eq(pieces, 2) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        if(pieces[1].iequals("cache")) {
+            return result_container(cache->status());
+        }
+
+        if(pieces[1].iequals("inflight")) {
+            return result_container(flights.status());
+        }
+
+        return render_error("unknown info section", pieces[1].str());
+     } else if(command.iequals("bgsave")) {
+        //bgsave DBNAME FILE
+        //bgsave status
+        if(pieces.size() == 2 && pieces[1].iequals("status")) {
+            return result_container(bgsave.status());
+        }
+
+        {
+            check_result check { argument_length_check_eq(pieces, 3) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        const std::string db_name { pieces[1].str() };
+        const db_ptr db { find_database(db_name) };
+        if(! db) {
+            return render_error("database not found", db_name);
+        }
+
+        shared_guard guard(db->lock);
+
+        if(bgsave.running()) {
+            return render_error("background save already running", db_name);
+        }
+
+        const std::string file { pieces[2].str() };
+        if(! start_bgsave(*db, file)) {
+            return render_error("unable to start background save", file);
+        }
+
+        return result_container(true);
+     } else if(command.iequals("load")) {
+        //load DBNAME FILE
+        {
+            check_result check { argument_length_check_eq(pieces, 3) };
+            if(! check) {
+                return result_container(check.get_rc());
+            }
+        }
+
+        const std::string db_name { pieces[1].str() };
+        const db_ptr db { find_database(db_name) };
+        if(! db) {
+            return render_error("database not found", db_name);
+        }
+
+        std::lock_guard<rw_lock> guard(db->lock);
+        if(db->dropped) {
+            return render_error("database not found", db_name);
+        }
+
+        const std::string file { pieces[2].str() };
+        const std::size_t amount { load(*db, file) };
+        if(! amount) {
+            return render_error("unable to load", file);
+        }
+
+        return result_container(amount);
+     } else {
+        return render_error("unknown command", command.str());
+    }
+}
+
+result_container parse_input(const std::string & input)
+{
+    return parse_input(input.data(), input.data() + input.size(), false);
+}
+
+// the binary counterparts of put, update and query, see protocol.hpp
+// args were checked to be whole u32s, but not their amount or range
+result_container run_binary_write(db_container & db_it, const protocol::opcode op, const std::vector<std::size_t> & args)
+{
+    switch(op) {
+        case protocol::opcode::PUT:
+            {
+                {
+                    check_result check { argument_length_check_lt(args, 1) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                {
+                    check_result check { positions_smaller_than_width_check(db_it, args.begin(), args.end()) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                return result_container(insert(db_it, args));
+            }
+        case protocol::opcode::UPDATE:
+            {
+                {
+                    check_result check { argument_length_check_lt(args, 1) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                {
+                    check_result check { concept_exists_check(db_it, args[0]) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                {
+                    check_result check { positions_smaller_than_width_check(db_it, args.begin() + 1, args.end()) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                return result_container(update(db_it, args[0], std::vector<std::size_t>(args.begin() + 1, args.end())));
+            }
+        case protocol::opcode::MPUT:
+            {
+                {
+                    check_result check { argument_length_check_lt(args, 2) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                std::vector<std::size_t> traits;
+                std::vector<std::size_t> sizes;
+                traits.reserve(args.size());
+
+                for(std::size_t i=0; i<args.size(); ) {
+                    const std::size_t size { args[i++] };
+
+                    if(size == 0 || size > args.size() - i) {
+                        return render_error("malformed concept list", std::to_string(i - 1));
+                    }
+
+                    traits.insert(traits.end(), args.begin() + i, args.begin() + i + size);
+                    sizes.emplace_back(size);
+                    i += size;
+                }
+
+                {
+                    check_result check { positions_smaller_than_width_check(db_it, traits.begin(), traits.end()) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                return result_container(insert_many(db_it, traits, sizes));
+            }
+        default:
+            return render_error("unknown opcode", std::to_string(static_cast<unsigned>(op)));
+    }
+}
+
+// with traits set, the first concept of similarity, usimilarity and closest
+// is replaced by the traits at the end of args, see protocol::flag_traits
+result_container run_binary_query(
+    const db_container & db_it,
+    const protocol::opcode op,
+    const bool weighted,
+    const bool traits,
+    const std::vector<std::size_t> & args
+) {
+    switch(op) {
+        case protocol::opcode::SIMILARITY:
+            if(traits) {
+                {
+                    check_result check { argument_length_check_lt(args, 2) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                {
+                    check_result check { concept_exists_check(db_it, args[0]) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                std::vector<std::size_t> concept_traits(args.begin() + 1, args.end());
+                {
+                    check_result check { concept_traits_check(db_it, concept_traits) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                const sdr::concept concept(concept_traits);
+
+                if(weighted) {
+                    return result_container(weighted_similarity(db_it, concept, args[0]));
+                }
+
+                return result_container(similarity(db_it, concept, args[0]));
+            } else {
+                {
+                    check_result check { argument_length_check_eq(args, 2) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                for(const std::size_t concept_id : args) {
+                    check_result check { concept_exists_check(db_it, concept_id) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                if(weighted) {
+                    return result_container(weighted_similarity(db_it, args[0], args[1]));
+                }
+
+                return result_container(similarity(db_it, args[0], args[1]));
+            }
+        case protocol::opcode::USIMILARITY:
+            if(traits) {
+                // the amount of concepts comes first
+                {
+                    check_result check { argument_length_check_lt(args, 3) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                if(args[0] == 0 || args[0] > args.size() - 2) {
+                    return render_error("malformed concept list", std::to_string(args[0]));
+                }
+
+                const std::vector<std::size_t> concept_positions(args.begin() + 1, args.begin() + 1 + args[0]);
+
+                for(const std::size_t concept_id : concept_positions) {
+                    check_result check { concept_exists_check(db_it, concept_id) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                std::vector<std::size_t> concept_traits(args.begin() + 1 + args[0], args.end());
+                {
+                    check_result check { concept_traits_check(db_it, concept_traits) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                const sdr::concept concept(concept_traits);
+
+                if(weighted) {
+                    return result_container(weighted_usimilarity(db_it, concept, concept_positions));
+                }
+
+                return result_container(usimilarity(db_it, concept, concept_positions));
+            } else {
+                {
+                    check_result check { argument_length_check_lt(args, 2) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                {
+                    check_result check { concept_exists_check(db_it, args[0]) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                const std::vector<std::size_t> concept_positions(args.begin() + 1, args.end());
+
+                if(weighted) {
+                    return result_container(weighted_usimilarity(db_it, args[0], concept_positions));
+                }
+
+                return result_container(usimilarity(db_it, args[0], concept_positions));
+            }
+        case protocol::opcode::CLOSEST:
+            if(traits) {
+                {
+                    check_result check { argument_length_check_lt(args, 2) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                std::vector<std::size_t> concept_traits(args.begin() + 1, args.end());
+                {
+                    check_result check { concept_traits_check(db_it, concept_traits) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                const sdr::concept concept(concept_traits);
+
+                if(weighted) {
+                    return result_container(weighted_closest(db_it, args[0], concept));
+                }
+
+                return result_container(closest(db_it, args[0], concept));
+            } else {
+                {
+                    check_result check { argument_length_check_eq(args, 2) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                {
+                    check_result check { concept_exists_check(db_it, args[1]) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                if(weighted) {
+                    return result_container(weighted_closest(db_it, args[0], args[1]));
+                }
+
+                return result_container(closest(db_it, args[0], args[1]));
+            }
+        case protocol::opcode::MATCHING:
+            {
+                {
+                    check_result check { argument_length_check_lt(args, 1) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                {
+                    check_result check { positions_smaller_than_width_check(db_it, args.begin(), args.end()) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                return result_container(matching(db_it, args));
+            }
+        case protocol::opcode::MATCHINGX:
+            {
+                {
+                    check_result check { argument_length_check_lt(args, 2) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                {
+                    check_result check { positions_smaller_than_width_check(db_it, args.begin() + 1, args.end()) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                return result_container(matchingx(db_it, args[0], std::vector<std::size_t>(args.begin() + 1, args.end())));
+            }
+        case protocol::opcode::MCLOSEST:
+            {
+                if(weighted) {
+                    return render_error("mclosest cannot be weighted", "weighted");
+                }
+
+                {
+                    check_result check { argument_length_check_lt(args, 2) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                const std::vector<std::size_t> concept_ids(args.begin() + 1, args.end());
+
+                for(const std::size_t concept_id : concept_ids) {
+                    check_result check { concept_exists_check(db_it, concept_id) };
+                    if(! check) {
+                        return result_container(check.get_rc());
+                    }
+                }
+
+                return result_container(mclosest(db_it, args[0], concept_ids));
+            }
+        default:
+            return render_error("unknown opcode", std::to_string(static_cast<unsigned>(op)));
+    }
+}
+
+result_container run_binary(const protocol::header & h, const char * body)
+{
+    if(h.op == static_cast<std::uint16_t>(protocol::opcode::TEXT)) {
+        return parse_input(body, body + h.length, h.flags & protocol::flag_async);
+    }
+
+    if(h.extra > h.length || (h.length - h.extra) % 4 != 0) {
+        return render_error("malformed frame", std::to_string(h.request_id));
+    }
+
+    const std::string db_name(body, h.extra);
+
+    std::vector<std::size_t> args;
+    args.reserve((h.length - h.extra) / 4);
+
+    for(std::size_t i=h.extra; i<h.length; i += 4) {
+        args.emplace_back(protocol::get_u32(body + i));
+    }
+
+    const db_ptr db { find_database(db_name) };
+    if(! db) {
+        return render_error("database not found", db_name);
+    }
+
+    const protocol::opcode op { static_cast<protocol::opcode>(h.op) };
+    sample.track(binary_kind(op), db);
+
+    if(op == protocol::opcode::PUT || op == protocol::opcode::UPDATE || op == protocol::opcode::MPUT) {
+        std::lock_guard<rw_lock> guard(db->lock);
+        if(db->dropped) {
+            return render_error("database not found", db_name);
+        }
+
+        return run_binary_write(*db, op, args);
+    }
+
+    shared_guard guard(db->lock);
+
+    return run_binary_query(*db, op, h.flags & protocol::flag_weighted, h.flags & protocol::flag_traits, args);
+}
+
+// applies a record from the wal without logging it again
+void replay_record(const wal_record & rec)
+{
+    // snapshots are restored by replay_wal
+    if(rec.op == wal_op::SNAPSHOT) {
+        return;
+    }
+
+    if(rec.op == wal_op::CREATE) {
+        create_database(rec.db_name, rec.width);
+        return;
+    }
+
+    if(rec.op == wal_op::DROP) {
+        if(! drop_database(rec.db_name)) {
+            std::cerr << "wal: database not found => " << rec.db_name << std::endl;
+        }
+        return;
+    }
+
+    const db_ptr db { find_database(rec.db_name) };
+    if(! db) {
+        std::cerr << "wal: database not found => " << rec.db_name << std::endl;
+        return;
+    }
+
+    db_container & db_it { *db };
+
+    for(const std::size_t t : rec.traits) {
+        if(t >= db_it.get_width()) {
+            std::cerr << "wal: position too large for db => " << rec.db_name << std::endl;
+            return;
+        }
+    }
+
+    switch(rec.op) {
+        case wal_op::CLEAR:
+            clear(db_it);
+            break;
+        case wal_op::RESIZE:
+            resize(db_it, rec.width);
+            break;
+        case wal_op::PUT:
+            insert(db_it, rec.traits);
+            break;
+        case wal_op::MPUT:
+            insert_many(db_it, rec.traits, rec.sizes);
+            break;
+        case wal_op::WEIGHTS:
+            set_weights(db_it, rec.traits, rec.weights);
+            break;
+        case wal_op::UPDATE:
+            if(rec.concept_id == 0 || rec.concept_id >= db_it.get_storage_size()) {
+                std::cerr << "wal: concept not found => " << rec.concept_id << std::endl;
+                return;
+            }
+            update(db_it, rec.concept_id, rec.traits);
+            break;
+        default:
+            break;
+    }
+}
+
+// false if the snapshot could not be loaded, in which case the records it
+// stands in for are gone and the database cannot be rebuilt
+bool restore_snapshot(const wal_record & rec)
+{
+    const db_ptr db { std::make_shared<db_container>(rec.db_name, rec.width) };
+    databases[rec.db_name] = db;
+
+    if(! db->bank.load_from_file(rec.file)) {
+        std::cerr << "wal: unable to restore snapshot of " << rec.db_name << " => " << rec.file << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// rebuilds every database from its latest snapshot plus the records after it
+// the log is read twice, once for the snapshots and once to replay, so its
+// records are never all held at once
+bool replay_wal(const std::string & path, const sync_policy policy)
+{
+    std::unique_ptr<write_ahead_log> log(new write_ahead_log(path, policy));
+    std::vector<wal_record> snapshots;
+
+    hash_map<std::string, std::size_t> latest;
+    latest.set_empty_key("");
+
+    const bool opened { log->open([&](const std::uint64_t, const wal_record & rec) {
+        if(rec.op != wal_op::SNAPSHOT) {
+            return;
+        }
+
+        const auto snapshot = latest.find(rec.db_name);
+
+        if(snapshot == latest.end()) {
+            latest[rec.db_name] = snapshots.size();
+            snapshots.emplace_back(rec);
+        } else {
+            snapshots[snapshot->second] = rec;
+        }
+    }) };
+
+    if(! opened) {
+        return false;
+    }
+
+    hash_map<std::string, bool> restored;
+    restored.set_empty_key("");
+
+    bool ok { true };
+    std::size_t replayed { 0 };
+
+    log->replay([&](const std::uint64_t lsn, const wal_record & rec) {
+        ++replayed;
+
+        if(! ok) {
+            return;
+        }
+
+        const auto snapshot = latest.find(rec.db_name);
+
+        if(snapshot != latest.end()) {
+            const wal_record & srec { snapshots[snapshot->second] };
+
+            if(lsn < srec.base_lsn) {
+                return;
+            }
+
+            if(! restored[rec.db_name]) {
+                if(! restore_snapshot(srec)) {
+                    ok = false;
+                    return;
+                }
+
+                restored[rec.db_name] = true;
+            }
+        }
+
+        replay_record(rec);
+    });
+
+    if(! ok) {
+        return false;
+    }
+
+    for(auto & snapshot : latest) {
+        if(! restored[snapshot.first] && ! restore_snapshot(snapshots[snapshot.second])) {
+            return false;
+        }
+    }
+
+    std::cout << "replayed " << replayed << " records from " << path << std::endl;
+
+    // only log from here on, so replayed records are not written twice
+    wal = std::move(log);
+
+    return true;
+}
+
+void append_number(std::string & output, std::size_t n)
+{
+    char buffer[20];
+    char * it { buffer + sizeof(buffer) };
+
+    do {
+        *--it = static_cast<char>('0' + n % 10);
+        n /= 10;
+    } while(n);
+
+    output.append(it, static_cast<std::size_t>(buffer + sizeof(buffer) - it));
+}
+
+// shortest of %g's forms, enough digits to tell scores apart
+void append_number(std::string & output, const double d)
+{
+    char buffer[32];
+    const int len { std::snprintf(buffer, sizeof(buffer), "%.10g", d) };
+
+    output.append(buffer, static_cast<std::size_t>(len));
+}
+
+template <typename T>
+void append_pairs(std::string & output, const std::vector<std::pair<std::size_t, T>> & vec)
+{
+    for(std::size_t i=0; i<vec.size(); ++i) {
+        if(i) {
+            output += ' ';
+        }
+
+        append_number(output, vec[i].first);
+        output += ':';
+        append_number(output, vec[i].second);
+    }
+}
+
+// every response is exactly one line, written straight into output
+void render_result(const result_container & res, std::string & output)
+{
+    sample.error = res.is_error();
+
+    switch(res.get_type()) {
+        case result_type::NONE:
+            return;
+        case result_type::BOOL:
+            {
+                const bool * m { res };
+                output += *m ? '1' : '0';
+            }
+            break;
+        case result_type::SIZET:
+            {
+                const std::size_t * m { res };
+                append_number(output, *m);
+            }
+            break;
+        case result_type::DOUBLE:
+            {
+                const double * m { res };
+                append_number(output, *m);
+            }
+            break;
+        case result_type::STRING:
+            {
+                const std::string * m { res };
+                output += *m;
+            }
+            break;
+        case result_type::VECSIZET:
+            {
+                const result_container::vec_sizet * vec { res };
+
+                for(std::size_t i=0; i<vec->size(); ++i) {
+                    if(i) {
+                        output += ' ';
+                    }
+
+                    append_number(output, (*vec)[i]);
+                }
+            }
+            break;
+        case result_type::VECPAIRSIZETSIZET:
+            {
+                const result_container::vec_pair_sizet_sizet * vec { res };
+                append_pairs(output, *vec);
+            }
+            break;
+        case result_type::VECPAIRSIZETDOUBLE:
+            {
+                const result_container::vec_pair_sizet_double * vec { res };
+                append_pairs(output, *vec);
+            }
+            break;
+        case result_type::VECVECPAIRSIZETSIZET:
+            {
+                const result_container::vec_vec_pair_sizet_sizet * vecs { res };
+
+                for(std::size_t i=0; i<vecs->size(); ++i) {
+                    if(i) {
+                        output += " | ";
+                    }
+
+                    append_pairs(output, (*vecs)[i]);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+
+    output += '\n';
+}
+
+// one response frame per request frame, even for comments
+void render_frame(const result_container & res, const protocol::header & h, std::string & output)
+{
+    const result_type type { res.get_type() };
+
+    const protocol::status status { res.is_error() ? protocol::status::ERR : protocol::status::OK };
+    sample.error = res.is_error();
+
+    const std::size_t start { protocol::begin_frame(
+        output,
+        h.op,
+        static_cast<std::uint8_t>(status),
+        static_cast<std::uint8_t>(type),
+        h.request_id
+    ) };
+
+    switch(type) {
+        case result_type::NONE:
+            break;
+        case result_type::BOOL:
+            {
+                const bool * m { res };
+                protocol::put_u32(output, *m ? 1 : 0);
+            }
+            break;
+        case result_type::SIZET:
+            {
+                const std::size_t * m { res };
+                protocol::put_u32(output, static_cast<std::uint32_t>(*m));
+            }
+            break;
+        case result_type::DOUBLE:
+            {
+                const double * m { res };
+                protocol::put_f64(output, *m);
+            }
+            break;
+        case result_type::STRING:
+            {
+                const std::string * m { res };
+                output += *m;
+            }
+            break;
+        case result_type::VECSIZET:
+            {
+                const result_container::vec_sizet * vec { res };
+                output.reserve(output.size() + vec->size() * 4);
+
+                for(const std::size_t item : *vec) {
+                    protocol::put_u32(output, static_cast<std::uint32_t>(item));
+                }
+            }
+            break;
+        case result_type::VECPAIRSIZETSIZET:
+            {
+                const result_container::vec_pair_sizet_sizet * vec { res };
+                output.reserve(output.size() + vec->size() * 8);
+
+                for(auto & item : *vec) {
+                    protocol::put_u32(output, static_cast<std::uint32_t>(item.first));
+                    protocol::put_u32(output, static_cast<std::uint32_t>(item.second));
+                }
+            }
+            break;
+        case result_type::VECPAIRSIZETDOUBLE:
+            {
+                const result_container::vec_pair_sizet_double * vec { res };
+                output.reserve(output.size() + vec->size() * 12);
+
+                for(auto & item : *vec) {
+                    protocol::put_u32(output, static_cast<std::uint32_t>(item.first));
+                    protocol::put_f64(output, item.second);
+                }
+            }
+            break;
+        case result_type::VECVECPAIRSIZETSIZET:
+            {
+                const result_container::vec_vec_pair_sizet_sizet * vecs { res };
+                protocol::put_u32(output, static_cast<std::uint32_t>(vecs->size()));
+
+                for(auto & vec : *vecs) {
+                    protocol::put_u32(output, static_cast<std::uint32_t>(vec.size()));
+                    output.reserve(output.size() + vec.size() * 8);
+
+                    for(auto & item : vec) {
+                        protocol::put_u32(output, static_cast<std::uint32_t>(item.first));
+                        protocol::put_u32(output, static_cast<std::uint32_t>(item.second));
+                    }
+                }
+            }
+            break;
+        default:
+            break;
+    }
+
+    protocol::end_frame(output, start);
+}
+
+thread_local std::vector<token> key_pieces;
+thread_local std::string cache_key;
+
+// queries are keyed by their words separated by single spaces, without
+// async, which changes nothing about the response
+// untagged async queries are errors, which are not cached
+// returns false for anything else
+bool text_cache_key(const char * begin, const char * end, const bool tagged, std::string & key, token & db_name)
+{
+    std::vector<token> & pieces { key_pieces };
+    tokenize(begin, end, pieces);
+
+    if(pieces.size() < 3 || ! (pieces[0].iequals("query") || pieces[0].iequals("mquery"))) {
+        return false;
+    }
 
-        const std::string & db_name { pieces[1] };
-        const auto db = databases.find(db_name);
-        if(db == databases.end()) {
-            return render_error("database not found", db_name);
-        }
-        db_container & db_it { db->second };
+    key.assign(1, 't');
+    db_name = pieces[1];
 
-        const std::vector<std::string> trait_strs(std::begin(pieces) +  2, std::end(pieces));
-        std::vector<number_container> trait_positions(std::begin(trait_strs), std::end(trait_strs));
-        for(number_container & n :  trait_positions) {
-            std::cout << "pre parse" << std::endl;
-            if(! n.parse()) {
-                return n.err();
+    for(const token & piece : pieces) {
+        if(piece.iequals("async")) {
+            if(! tagged) {
+                return false;
             }
+
+            continue;
         }
 
-        std::cout << "past parse" << std::endl;
+        key += ' ';
+        key.append(piece.data, piece.size);
+    }
 
-        {
-            check_result check { positions_smaller_than_width_check(db_it, trait_positions) };
-            if(! check) {
-                return result_container(check.get_rc());
-            }
-        }
+    return true;
+}
 
-        std::cout << "post pos small" << std::endl;
+// answers queries from the cache while their database is unchanged, and
+// shares one run between identical queries arriving while it is going
+// the generation is read before running the query, so a write racing it
+// leaves the entry under a generation that is already gone
+void render_text(const char * begin, const char * end, const bool tagged, std::string & output)
+{
+    std::string & key { cache_key };
+    token db_name;
+
+    const db_ptr db {
+        text_cache_key(begin, end, tagged, key, db_name)
+            ? find_database(db_name.str())
+            : db_ptr()
+    };
+
+    if(! db) {
+        render_result(parse_input(begin, end, tagged), output);
+        return;
+    }
 
+    sample.track(text_query_kind(key_pieces), db);
 
-        return result_container(insert(db_it, unpack(trait_positions)));
-     }  else if(command == "update") {
-        //update DBNAME CONCEPT_ID TRAITS....
-        {
-            check_result check { argument_length_check_lt(pieces, 3) };
-            if(! check) {
-                return result_container(check.get_rc());
-            }
-        }
+    const std::uint64_t generation { db->generation };
+    std::uint8_t type;
 
+    if(cache->enabled() && cache->get(key, generation, output, type)) {
+        return;
+    }
 
-        const std::string & db_name { pieces[1] };
-        const auto db = databases.find(db_name);
-        if(db == databases.end()) {
-            return render_error("database not found", db_name);
-        }
-        db_container & db_it { db->second };
+    single_flight::ticket flight(flights, key, generation);
 
-        const std::string & concept_str  { pieces[2] };
-        number_container concept_id(concept_str);
-        if(! concept_id.parse()) {
-            return concept_id.err();
-        }
+    if(! flight.leader() && flight.wait(output, type)) {
+        return;
+    }
 
-        if(! concept_id.get_n()) {
-            return render_error("concept not found", concept_str);
-        }
-        if(concept_id.get_n() >= db_it.get_storage_size()) {
-            return render_error("id larger than amount in storage", concept_str);
-        }
+    const result_container res { parse_input(begin, end, tagged) };
 
-        const std::vector<std::string> trait_strs(std::begin(pieces) + 3, std::end(pieces));
-        std::vector<number_container> trait_positions(std::begin(trait_strs), std::end(trait_strs));
-        for(number_container & n :  trait_positions) {
-            if(! n.parse()) {
-                return n.err();
-            }
-        }
+    const std::size_t start { output.size() };
+    render_result(res, output);
 
-        {
-            check_result check { positions_smaller_than_width_check(db_it, trait_positions) };
-            if(! check) {
-                return result_container(check.get_rc());
-            }
-        }
+    if(! res.is_error() && res.get_type() != result_type::NONE) {
+        const std::uint8_t res_type { static_cast<std::uint8_t>(res.get_type()) };
 
-        return result_container(update(db_it, concept_id.get_n(), unpack(trait_positions)));
-     } else if(command == "query") {
-        {
-            check_result check { argument_length_check_lt(pieces, 4) };
-            if(! check) {
-                return result_container(check.get_rc());
-            }
-        }
+        flight.finish(res_type, output.data() + start, output.size() - start);
 
-        const std::string & db_name { pieces[1] };
-        const auto db = databases.find(db_name);
-        if(db == databases.end()) {
-            return render_error("database not found", db_name);
+        if(cache->enabled()) {
+            cache->put(key, generation, res_type, output.data() + start, output.size() - start);
         }
-        const db_container & db_it { db->second };
+    }
+}
 
-        const bool weighted         { tolower(pieces[2]) == "weighted" };
-        const bool async            { tolower(pieces[weighted ? 3 : 2]) == "async" };
-        const std::size_t qtype_pos { static_cast<std::size_t>(2 + weighted + async) };
+// frames are keyed by opcode, the flags that change the result and the body
+bool binary_cache_key(const protocol::header & h, const char * body, std::string & key)
+{
+    switch(static_cast<protocol::opcode>(h.op)) {
+        case protocol::opcode::SIMILARITY:
+        case protocol::opcode::USIMILARITY:
+        case protocol::opcode::CLOSEST:
+        case protocol::opcode::MATCHING:
+        case protocol::opcode::MATCHINGX:
+        case protocol::opcode::MCLOSEST:
+            break;
+        default:
+            return false;
+    }
 
-        const std::string & qtype { pieces[qtype_pos] };
+    if(h.extra > h.length) {
+        return false;
+    }
 
-        if(qtype == "similarity") {
-            if(async) {
-                return render_error("similarity cannot be async", "async");
-            }
-            {
-                check_result check { argument_length_check_eq(pieces, qtype_pos + 3) };
-                if(! check) {
-                    return result_container(check.get_rc());
-                }
-            }
+    key.assign(1, 'b');
+    protocol::put_u16(key, h.op);
+    key += static_cast<char>(h.flags & (protocol::flag_weighted | protocol::flag_traits));
+    key.append(body, h.length);
 
-            const std::string & concept_a_str { pieces[qtype_pos + 1] };
-            number_container concept_a_id(concept_a_str);
-            if(! concept_a_id.parse()) {
-                return concept_a_id.err();
-            }
+    return true;
+}
 
-            if(! concept_a_id.get_n()) {
-                return render_error("concept not found", concept_a_str);
-            }
-            if(concept_a_id.get_n() >= db_it.get_storage_size()) {
-                return render_error("id larger than amount in storage", concept_a_str);
-            }
+void render_binary(const protocol::header & h, const char * body, std::string & output)
+{
+    std::string & key { cache_key };
 
-            const std::string & concept_b_str { pieces[qtype_pos + 2] };
-            number_container concept_b_id(concept_b_str);
-            if(! concept_b_id.parse()) {
-                return concept_b_id.err();
-            }
+    const db_ptr db {
+        binary_cache_key(h, body, key)
+            ? find_database(std::string(body, h.extra))
+            : db_ptr()
+    };
 
-            if(! concept_b_id.get_n()) {
-                return render_error("concept not found", concept_b_str);
-            }
-            if(concept_b_id.get_n() >= db_it.get_storage_size()) {
-                return render_error("id larger than amount in storage", concept_b_str);
-            }
+    if(! db) {
+        render_frame(run_binary(h, body), h, output);
+        return;
+    }
 
-            return result_container(similarity(db_it, concept_a_id.get_n(), concept_b_id.get_n()));
-        } else if(qtype == "usimilarity") {
-            if(async) {
-                return render_error("usimilarity cannot be async", "async");
-            }
-            {
-                check_result check { argument_length_check_lt(pieces, qtype_pos + 3) };
-                if(! check) {
-                    return result_container(check.get_rc());
-                }
-            }
+    sample.track(binary_kind(static_cast<protocol::opcode>(h.op)), db);
 
-            const std::string & concept_str { pieces[qtype_pos + 1] };
-            number_container concept_id(concept_str);
-            if(! concept_id.parse()) {
-                return concept_id.err();
-            }
+    const std::uint64_t generation { db->generation };
+    std::uint8_t type;
 
-            if(! concept_id.get_n()) {
-                return render_error("concept not found", concept_str);
-            }
-            if(concept_id.get_n() >= db_it.get_storage_size()) {
-                return render_error("id larger than amount in storage", concept_str);
-            }
+    const std::size_t start { protocol::begin_frame(output, h.op, static_cast<std::uint8_t>(protocol::status::OK), 0, h.request_id) };
 
-            const std::vector<std::string> concept_strs(std::begin(pieces) + qtype_pos + 2, std::end(pieces));
-            std::vector<number_container> concept_positions(std::begin(concept_strs), std::end(concept_strs));
-            for(number_container & n :  concept_positions) {
-                if(! n.parse()) {
-                    return n.err();
-                }
-            }
+    if(cache->enabled() && cache->get(key, generation, output, type)) {
+        output[start + 7] = static_cast<char>(type);
+        protocol::end_frame(output, start);
+        return;
+    }
 
-            return result_container(usimilarity(db_it, concept_id.get_n(), unpack(concept_positions)));
-        } else if(qtype == "closest") {
-            {
-                check_result check { argument_length_check_eq(pieces, qtype_pos + 3) };
-                if(! check) {
-                    return result_container(check.get_rc());
-                }
-            }
+    single_flight::ticket flight(flights, key, generation);
 
-            const std::string & amount_str { pieces[qtype_pos + 1] };
-            {
-                check_result check { number_check(amount_str) };
-                if(! check) {
-                    return result_container(check.get_rc());
-                }
-            }
+    if(! flight.leader() && flight.wait(output, type)) {
+        output[start + 7] = static_cast<char>(type);
+        protocol::end_frame(output, start);
+        return;
+    }
 
-            number_container amount(amount_str);
-            if(! amount.parse()) {
-                return amount.err();
-            }
+    output.resize(start);
 
-            const std::string & concept_str { pieces[qtype_pos + 2] };
-            number_container concept_id(concept_str);
-            if(! concept_id.parse()) {
-                return concept_id.err();
-            }
+    const result_container res { run_binary(h, body) };
+    render_frame(res, h, output);
 
-            if(! concept_id.get_n()) {
-                return render_error("concept not found", concept_str);
-            }
-            if(concept_id.get_n() >= db_it.get_storage_size()) {
-                return render_error("id larger than amount in storage", concept_str);
-            }
+    if(! res.is_error()) {
+        const std::uint8_t res_type { static_cast<std::uint8_t>(res.get_type()) };
+        const std::size_t value { start + protocol::header_size };
 
-            return result_container(closest(db_it, amount, concept_id.get_n()));
-        } else if(qtype == "matching") {
-            if(weighted) {
-                return render_error("matching cannot be weighted", "weighted");
-            }
+        flight.finish(res_type, output.data() + value, output.size() - value);
 
-            if(async) {
-                return render_error("matching cannot be async", "async");
-            }
+        if(cache->enabled()) {
+            cache->put(key, generation, res_type, output.data() + value, output.size() - value);
+        }
+    }
+}
 
-            {
-                check_result check { argument_length_check_lt(pieces, qtype_pos + 2) };
-                if(! check) {
-                    return result_container(check.get_rc());
-                }
-            }
+// "@TAG COMMAND" is answered with "@TAG RESPONSE", so the client can match
+// it up when it overtakes or is overtaken by other responses
+void run_tagged(const char * begin, const char * end, std::string & output)
+{
+    while(begin < end && is_space(*begin)) {
+        ++begin;
+    }
 
-            const std::vector<std::string> trait_strs(std::begin(pieces) + qtype_pos + 1, std::end(pieces));
-            std::vector<number_container> trait_positions(std::begin(trait_strs), std::end(trait_strs));
-            for(number_container & n :  trait_positions) {
-                if(! n.parse()) {
-                    return n.err();
-                }
-            }
+    // skip the @
+    const char * tag { ++begin };
+    while(begin < end && ! is_space(*begin)) {
+        ++begin;
+    }
 
-            {
-                check_result check { positions_smaller_than_width_check(db_it, trait_positions) };
-                if(! check) {
-                    return result_container(check.get_rc());
-                }
-            }
+    const std::size_t start { output.size() };
 
-            return result_container(matching(db_it, unpack(trait_positions)));
-        } else if(qtype == "matchingx") {
-            if(async) {
-                return render_error("matchingx cannot be async", "async");
-            }
+    output += '@';
+    output.append(tag, static_cast<std::size_t>(begin - tag));
+    output += ' ';
 
-            {
-                check_result check { argument_length_check_lt(pieces, qtype_pos + 3) };
-                if(! check) {
-                    return result_container(check.get_rc());
-                }
-            }
+    const std::size_t prefixed { output.size() };
+    render_text(begin, end, true, output);
 
-            {
-                check_result check { number_check(pieces[qtype_pos + 1]) };
-                if(! check) {
-                    return result_container(check.get_rc());
-                }
-            }
+    // like an untagged comment, nothing to answer
+    if(output.size() == prefixed) {
+        output.resize(start);
+    }
+}
 
-            const std::string & amount_str { pieces[qtype_pos + 1] };
+// a command of a batch that appended to the wal, and where its response is
+struct logged_response
+{
+    const char * command;
+    std::size_t begin;
+    std::size_t end;
+};
+
+// with the wal failed, the changes of logged commands may not survive a
+// restart, so their responses are swapped for an error rather than acked
+void refuse_unlogged(const std::vector<logged_response> & logged, const bool binary, const bool tagged, std::string & output)
+{
+    std::string rebuilt;
+    std::size_t copied { 0 };
 
-            number_container amount(amount_str);
-            if(! amount.parse()) {
-                return amount.err();
-            }
+    for(const logged_response & l : logged) {
+        rebuilt.append(output, copied, l.begin - copied);
 
-            const std::vector<std::string> trait_strs(std::begin(pieces) + qtype_pos + 2, std::end(pieces));
-            std::vector<number_container> trait_positions(std::begin(trait_strs), std::end(trait_strs));
-            for(number_container & n :  trait_positions) {
-                if(! n.parse()) {
-                    return n.err();
-                }
-            }
+        const result_container err { render_error("write ahead log failed, change may be lost", "see server log") };
 
-            {
-                check_result check { positions_smaller_than_width_check(db_it, trait_positions) };
-                if(! check) {
-                    return result_container(check.get_rc());
-                }
+        if(binary) {
+            render_frame(err, protocol::get_header(l.command), rebuilt);
+        } else {
+            // keep the @TAG a tagged response starts with
+            const std::size_t space { output.find(' ', l.begin) };
+
+            if(tagged && space < l.end) {
+                rebuilt.append(output, l.begin, space + 1 - l.begin);
             }
 
-            return result_container(matchingx(db_it, amount.get_n(), unpack(trait_positions)));
-        } else {
-            return render_error("bad syntax", command);
+            render_result(err, rebuilt);
         }
-     } else if(command == "save") {
-        return result_container();
-     } else {
-        return render_error("unknown command", command);
+
+        copied = l.end;
     }
+
+    rebuilt.append(output, copied, std::string::npos);
+    output.swap(rebuilt);
 }
 
-int serverloop(const std::string & bindpath)
+int serverloop(const std::string & bindpath, const std::size_t workers)
 {
-    constexpr std::size_t buffer_size { 128 };
-
     try {
-        libsocket::unix_stream_server server(bindpath);
-
-        while(true) {
-            std::unique_ptr<libsocket::unix_stream_client> client(server.accept());
-            std::string input;
-
-            while(true) {
-                std::string answer;
-                answer.resize(buffer_size);
-                *client >> answer;
-
-
-                if(verbose) {
-                    std::cout << answer;
-                }
-                input.append(answer);
-
-                for(char c : answer) {
-                    if(c == '\n') {
-                        goto breaker;
-                    }
-                }
-            } breaker:;
-
-            result_container res { parse_input(input) };
-            switch(res.get_type()) {
-                case result_type::NONE:
-                    break;
-                case result_type::BOOL:
-                    {
-                        const bool * m { res };
-                        const std::string s { *m ? "1\n" : "0\n" };
-                        *client << s;
-                    }
-                    break;
-                case result_type::SIZET:
-                    {
-                        const std::size_t * m { res };
-                        std::stringstream ss;
-                        ss << *m << "\n";
-                        *client << ss.str();
-                    }
-                    break;
-                case result_type::STRING:
-                    {
-                        const std::string * s { res };
-                        *client << *s << "\n";
-                    }
-                    break;
-                case result_type::VECSIZET:
-                    {
-                        const std::vector<std::size_t> * vec { res };
-                        const std::size_t vsize { (*vec).size() };
-                        std::stringstream ss;
-
-                        for(std::size_t i=0; i<vsize; ++i) {
-                            ss << (*vec)[i];
-
-                            if(i < vsize - 1) {
-                                ss << " ";
-                            }
-                        }
+        completion_queue completions;
+        thread_pool pool(workers);
+
+        event_loop loop(bindpath, completions, [&](const std::uint64_t conn_id, std::string && batch, const bool binary, const bool tagged) {
+            // recorded as received, ahead of any queueing in the pool
+            if(capturelog) {
+                for(std::size_t offset=0; offset < batch.size(); ) {
+                    const std::size_t size { event_loop::command_size(batch.data() + offset, batch.size() - offset, binary) };
+                    capturelog->append(conn_id, batch.data() + offset, size, binary);
+                    offset += size;
+                }
+            }
 
-                        ss << "\n";
+            std::shared_ptr<std::string> commands(new std::string(std::move(batch)));
 
-                        *client << ss.str();
-                    }
-                    break;
-                case result_type::VECPAIRSIZETSIZET:
-                    {
-                        const std::vector<std::pair<std::size_t, std::size_t>> * vec { res };
-                        const std::size_t vsize { (*vec).size() };
-                        std::stringstream ss;
+            pool.submit([&completions, conn_id, commands, binary, tagged]() {
+                std::string output;
+                std::vector<logged_response> logged;
+
+                // commands are parsed in place, straight out of the batch
+                const char * it { commands->data() };
+                const char * const end { it + commands->size() };
+
+                while(it < end) {
+                    const std::size_t size { event_loop::command_size(it, static_cast<std::size_t>(end - it), binary) };
+                    const std::size_t written { output.size() };
+                    const std::size_t appends { wal_appends };
+                    sample.start();
 
-                        for(std::size_t i=0; i<(*vec).size(); ++i) {
-                            const std::pair<std::size_t, std::size_t> & item = (*vec)[i];
-                            ss << item.first << ":" << item.second;
+                    if(binary) {
+                        const protocol::header h { protocol::get_header(it) };
 
-                            if(i < vsize - 1) {
-                                ss << " ";
-                            }
+                        if(verbose) {
+                            std::cout << "frame op=" << h.op << " id=" << h.request_id << std::endl;
                         }
 
-                        ss << "\n";
+                        render_binary(h, it + protocol::header_size, output);
+                    } else {
+                        if(verbose) {
+                            std::cout << std::string(it, size - 1) << std::endl;
+                        }
 
-                        *client << ss.str();
+                        if(tagged) {
+                            run_tagged(it, it + size - 1, output);
+                        } else {
+                            render_text(it, it + size - 1, false, output);
+                        }
                     }
-                    break;
-                default:
-                    break;
-            }
-        }
 
-        server.destroy();
+                    record_sample(it, size, output.size() - written, binary);
+
+                    if(wal_appends != appends) {
+                        logged.emplace_back(logged_response { it, written, output.size() });
+                    }
+
+                    it += size;
+                }
+
+                // responses go out only once what they acknowledge is durable
+                if(! wal_sync()) {
+                    refuse_unlogged(logged, binary, tagged, output);
+                }
+
+                completions.push(conn_id, std::move(output), tagged);
+            });
+        });
+
+        loop.run();
     } catch (const libsocket::socket_exception & exc) {
         std::cerr << exc.mesg << std::endl;
         return EXIT_FAILURE;
@@ -839,7 +3277,14 @@ void display_usage()
         << "-v            : show version" << std::endl
         << "-V            : set verbose" << std::endl
         << "-b arg        : set bindpath for server" << std::endl
-        << "-d            : run as daemon" << std::endl;
+        << "-d            : run as daemon" << std::endl
+        << "-w arg        : write ahead log file, replayed on startup" << std::endl
+        << "-s arg        : wal sync policy: always, everysec (default), none" << std::endl
+        << "-t arg        : worker threads (default: number of cores)" << std::endl
+        << "-c arg        : query cache size in megabytes, 0 disables it (default: 64)" << std::endl
+        << "-S arg        : log commands taking at least this many microseconds, see slowlog (default: off)" << std::endl
+        << "-P            : count hardware events of each command, see stats" << std::endl
+        << "-C arg        : capture every command received to this file, see sdrdb-replay" << std::endl;
 }
 
 void display_version()
@@ -850,13 +3295,21 @@ void display_version()
 int main(int argc, char ** argv)
 {
     databases.set_empty_key("");
+    databases.set_deleted_key("\n");
 
     std::string bindpath { "/tmp/sdrdb.sock" };
     bool daemonize { false };
+    std::string wal_path;
+    sync_policy policy { sync_policy::EVERYSEC };
+    std::size_t workers { std::max(1u, std::thread::hardware_concurrency()) };
+    std::size_t cache_mb { 64 };
+    bool log_slow_commands { false };
+    std::size_t slow_us { 0 };
+    std::string capture_path;
     {
         int c;
 
-        while ((c = getopt (argc, argv, "vVhb:d")) != -1) {
+        while ((c = getopt (argc, argv, "vVhb:dw:s:t:c:S:PC:")) != -1) {
             switch (c) {
             case 'v':
                 display_version();
@@ -875,6 +3328,66 @@ int main(int argc, char ** argv)
             case 'd':
                 daemonize = true;
                 break;
+            case 'w':
+                wal_path = optarg;
+                break;
+            case 's':
+                {
+                    const std::string p { tolower(optarg) };
+
+                    if(p == "always") {
+                        policy = sync_policy::ALWAYS;
+                    } else if(p == "everysec") {
+                        policy = sync_policy::EVERYSEC;
+                    } else if(p == "none") {
+                        policy = sync_policy::NONE;
+                    } else {
+                        std::cerr << "sdrdb-server: unknown sync policy: " << optarg << std::endl;
+                        display_usage();
+                        return EXIT_FAILURE;
+                    }
+                }
+                break;
+            case 't':
+                {
+                    if(! is_number(optarg) || std::stoul(optarg) == 0) {
+                        std::cerr << "sdrdb-server: bad worker thread count: " << optarg << std::endl;
+                        display_usage();
+                        return EXIT_FAILURE;
+                    }
+
+                    workers = std::stoul(optarg);
+                }
+                break;
+            case 'c':
+                {
+                    if(! is_number(optarg)) {
+                        std::cerr << "sdrdb-server: bad cache size: " << optarg << std::endl;
+                        display_usage();
+                        return EXIT_FAILURE;
+                    }
+
+                    cache_mb = std::stoul(optarg);
+                }
+                break;
+            case 'P':
+                count_events = true;
+                break;
+            case 'C':
+                capture_path = optarg;
+                break;
+            case 'S':
+                {
+                    if(! is_number(optarg)) {
+                        std::cerr << "sdrdb-server: bad slow log threshold: " << optarg << std::endl;
+                        display_usage();
+                        return EXIT_FAILURE;
+                    }
+
+                    log_slow_commands = true;
+                    slow_us = std::stoul(optarg);
+                }
+                break;
             case '?':
                 std::cerr << "sdrdb-server: invalid option" << std::endl;
                 display_usage();
@@ -885,6 +3398,46 @@ int main(int argc, char ** argv)
         }
     }
 
+    cache.reset(new result_cache(cache_mb * 1024 * 1024));
+
+    if(log_slow_commands) {
+        slowlog.reset(new slow_log(slow_us));
+    }
+
+    if(count_events) {
+        const sdr::perf_counters counters;
+
+        if(! counters.available()) {
+            std::cerr << "sdrdb-server: hardware counters unavailable, -P ignored" << std::endl;
+            count_events = false;
+        } else {
+            std::cout << "counting";
+
+            for(std::size_t i=0; i<sdr::perf_event_count; ++i) {
+                if(counters.available(static_cast<sdr::perf_event>(i))) {
+                    std::cout << " " << sdr::perf_event_name(i);
+                }
+            }
+
+            std::cout << std::endl;
+        }
+    }
+
+    if(! wal_path.empty()) {
+        if(! replay_wal(absolute_path(wal_path), policy)) {
+            std::cerr << "unable to replay wal, not starting => " << wal_path << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(! capture_path.empty()) {
+        capturelog.reset(new capture_log(absolute_path(capture_path)));
+
+        if(! capturelog->open()) {
+            return EXIT_FAILURE;
+        }
+    }
+
     std::cout << "sdrdb-server started" << std::endl;
 
     if(daemonize) {
@@ -894,7 +3447,19 @@ int main(int argc, char ** argv)
         }
     }
 
-    return serverloop(bindpath);
+    // a client hanging up mid response must not take the server down
+    signal(SIGPIPE, SIG_IGN);
+
+    // threads do not survive daemon()'s fork
+    if(wal) {
+        wal->start();
+    }
+
+    if(capturelog) {
+        capturelog->start();
+    }
+
+    return serverloop(bindpath, workers);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,173 @@
+#ifndef SINGLE_FLIGHT_H
+#define SINGLE_FLIGHT_H
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <sstream>
+#include <cstdint>
+#include <cstddef>
+
+// table of queries being run right now
+// the first worker to run a query leads it, workers given the same query
+// against the same database generation meanwhile wait for the leader and
+// copy its response, so a burst of identical queries is run only once
+// whether or not the response is cached afterwards
+class single_flight
+{
+private:
+    struct call
+    {
+        std::condition_variable done_cv;
+        bool done;
+
+        // false when the leader had nothing to share, as for errors
+        bool shared;
+        std::uint8_t type;
+        std::string value;
+
+        call()
+        : done_cv()
+        , done(false)
+        , shared(false)
+        , type(0)
+        , value()
+        {}
+    };
+
+    std::mutex mtx;
+    std::unordered_map<std::string, std::shared_ptr<call>> calls;
+
+    std::atomic<std::uint64_t> leaders;
+    std::atomic<std::uint64_t> coalesced;
+
+public:
+    // joins the call for key at generation, leading it if there is none
+    // a leader that goes away without finishing lets its followers run
+    // the query themselves
+    class ticket
+    {
+    private:
+        single_flight & owner;
+        std::string key;
+        std::shared_ptr<call> c;
+        bool leading;
+
+    public:
+        ticket(single_flight & owner, const std::string & query, const std::uint64_t generation)
+        : owner(owner)
+        , key(query)
+        , c()
+        , leading(false)
+        {
+            key.append(reinterpret_cast<const char *>(&generation), sizeof(generation));
+
+            std::lock_guard<std::mutex> lock(owner.mtx);
+
+            std::shared_ptr<call> & found { owner.calls[key] };
+
+            if(! found) {
+                found = std::make_shared<call>();
+                leading = true;
+                ++owner.leaders;
+            } else {
+                ++owner.coalesced;
+            }
+
+            c = found;
+        }
+
+        ticket(const ticket &) = delete;
+        ticket & operator=(const ticket &) = delete;
+
+        ~ticket()
+        {
+            if(leading) {
+                finish(0, nullptr, 0);
+            }
+        }
+
+        bool leader() const
+        {
+            return leading;
+        }
+
+        // followers only, appends the leader's response to out
+        // false when there was nothing to share
+        bool wait(std::string & out, std::uint8_t & type)
+        {
+            std::unique_lock<std::mutex> lock(owner.mtx);
+
+            while(! c->done) {
+                c->done_cv.wait(lock);
+            }
+
+            if(! c->shared) {
+                return false;
+            }
+
+            out += c->value;
+            type = c->type;
+
+            return true;
+        }
+
+        // leader only, hands the response to the followers, nullptr for none
+        void finish(const std::uint8_t type, const char * value, const std::size_t size)
+        {
+            if(! leading) {
+                return;
+            }
+
+            leading = false;
+
+            // followers read these only once done is set
+            if(value) {
+                c->shared = true;
+                c->type = type;
+                c->value.assign(value, size);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(owner.mtx);
+
+                c->done = true;
+                owner.calls.erase(key);
+            }
+
+            c->done_cv.notify_all();
+        }
+    };
+
+    single_flight()
+    : mtx()
+    , calls()
+    , leaders(0)
+    , coalesced(0)
+    {}
+
+    single_flight(const single_flight &) = delete;
+    single_flight & operator=(const single_flight &) = delete;
+
+    std::string status()
+    {
+        std::size_t running { 0 };
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            running = calls.size();
+        }
+
+        std::stringstream ss;
+        ss  << "leaders=" << leaders
+            << " coalesced=" << coalesced
+            << " running=" << running;
+
+        return ss.str();
+    }
+};
+
+#endif
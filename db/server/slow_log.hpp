@@ -0,0 +1,211 @@
+#ifndef SLOW_LOG_H
+#define SLOW_LOG_H
+
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// one command that took at least the slow log's threshold
+// times in nanoseconds, when in microseconds since the epoch
+struct slow_entry
+{
+    std::uint64_t id;
+    std::uint64_t when;
+    std::uint64_t total_ns;
+    std::uint64_t parse_ns;
+    std::uint64_t execute_ns;
+    std::uint64_t serialise_ns;
+
+    // size of the database and what a closest did, see sdr::query_stats
+    std::uint64_t concepts;
+    std::uint64_t postings;
+    std::uint64_t candidates;
+    std::uint64_t accumulate_ns;
+    std::uint64_t select_ns;
+
+    std::uint64_t bytes_out;
+
+    // the command, cut short past command_capacity bytes
+    std::uint64_t command_size;
+    char command[256];
+
+    static constexpr std::size_t command_capacity { sizeof(command) };
+
+    void set_command(const char * data, const std::size_t size)
+    {
+        command_size = std::min(size, command_capacity);
+        std::memcpy(command, data, command_size);
+    }
+};
+
+// lock free ring of the latest slow commands
+// each slot is guarded by a sequence number, odd while a writer is in it,
+// and holds its entry as words written and read one at a time, so readers
+// never block writers and retry a slot that changed under them
+class slow_log
+{
+private:
+    static constexpr std::size_t slot_count { 128 };
+    static constexpr std::size_t word_count { sizeof(slow_entry) / sizeof(std::uint64_t) };
+
+    static_assert(sizeof(slow_entry) % sizeof(std::uint64_t) == 0, "slow_entry must be whole words");
+
+    struct slot
+    {
+        std::atomic<std::uint64_t> seq;
+        std::atomic<std::uint64_t> words[word_count];
+    };
+
+    std::uint64_t threshold_ns;
+
+    // ids of the next entry and of the first not cleared by reset
+    std::atomic<std::uint64_t> next;
+    std::atomic<std::uint64_t> floor;
+
+    // entries given up on because a writer a whole lap behind still had
+    // their slot
+    std::atomic<std::uint64_t> dropped;
+
+    slot slots[slot_count];
+
+    // false while the slot is being written, or was never written
+    bool read(const slot & s, slow_entry & e) const
+    {
+        std::uint64_t words[word_count];
+
+        for(int attempt=0; attempt<4; ++attempt) {
+            const std::uint64_t before { s.seq.load(std::memory_order_acquire) };
+
+            if(before == 0) {
+                return false;
+            }
+
+            if(before & 1) {
+                continue;
+            }
+
+            for(std::size_t i=0; i<word_count; ++i) {
+                words[i] = s.words[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if(s.seq.load(std::memory_order_relaxed) == before) {
+                std::memcpy(&e, words, sizeof(e));
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+public:
+    explicit slow_log(const std::uint64_t threshold_us)
+    : threshold_ns(threshold_us * 1000)
+    , next(0)
+    , floor(0)
+    , dropped(0)
+    {
+        for(slot & s : slots) {
+            s.seq.store(0, std::memory_order_relaxed);
+
+            for(std::atomic<std::uint64_t> & w : s.words) {
+                w.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    slow_log(const slow_log &) = delete;
+    slow_log & operator=(const slow_log &) = delete;
+
+    bool is_slow(const std::uint64_t ns) const
+    {
+        return ns >= threshold_ns;
+    }
+
+    // sets e.id
+    void push(slow_entry & e)
+    {
+        e.id = next.fetch_add(1, std::memory_order_relaxed);
+        slot & s { slots[e.id % slot_count] };
+
+        std::uint64_t seq { s.seq.load(std::memory_order_relaxed) };
+
+        if((seq & 1) || ! s.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) {
+            ++dropped;
+            return;
+        }
+
+        std::atomic_thread_fence(std::memory_order_release);
+
+        std::uint64_t words[word_count];
+        std::memcpy(words, &e, sizeof(e));
+
+        for(std::size_t i=0; i<word_count; ++i) {
+            s.words[i].store(words[i], std::memory_order_relaxed);
+        }
+
+        s.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // forgets everything logged so far
+    void reset()
+    {
+        floor = next.load();
+    }
+
+    // the latest amount entries, newest first, separated by " | "
+    // the command goes last as it has spaces in it
+    std::string get(const std::size_t amount) const
+    {
+        const std::uint64_t last { next.load() };
+        const std::uint64_t first { std::max<std::uint64_t>(floor.load(), last > slot_count ? last - slot_count : 0) };
+
+        std::stringstream ss;
+        std::size_t found { 0 };
+        slow_entry e;
+
+        for(std::uint64_t id=last; id>first && found<amount; --id) {
+            // overwritten by a newer entry or still being written
+            if(! read(slots[(id - 1) % slot_count], e) || e.id != id - 1) {
+                continue;
+            }
+
+            if(found++ > 0) {
+                ss << " | ";
+            }
+
+            ss  << "id=" << e.id
+                << " when=" << e.when
+                << " total_us=" << e.total_ns / 1000
+                << " parse_us=" << e.parse_ns / 1000
+                << " execute_us=" << e.execute_ns / 1000
+                << " serialise_us=" << e.serialise_ns / 1000
+                << " concepts=" << e.concepts
+                << " postings=" << e.postings
+                << " candidates=" << e.candidates
+                << " accumulate_us=" << e.accumulate_ns / 1000
+                << " select_us=" << e.select_ns / 1000
+                << " out=" << e.bytes_out
+                << " command=" << std::string(e.command, e.command_size);
+        }
+
+        return ss.str();
+    }
+
+    std::string status() const
+    {
+        std::stringstream ss;
+        ss  << "threshold_us=" << threshold_ns / 1000
+            << " logged=" << next.load()
+            << " dropped=" << dropped.load();
+
+        return ss.str();
+    }
+};
+
+#endif
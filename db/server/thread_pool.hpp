@@ -0,0 +1,94 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstddef>
+
+class thread_pool
+{
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mtx;
+    std::condition_variable available;
+    bool stopping;
+
+    void work()
+    {
+        while(true) {
+            std::function<void()> task;
+
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+
+                while(! stopping && tasks.empty()) {
+                    available.wait(lock);
+                }
+
+                if(tasks.empty()) {
+                    return;
+                }
+
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+
+            task();
+        }
+    }
+
+public:
+    explicit thread_pool(const std::size_t amount)
+    : workers()
+    , tasks()
+    , stopping(false)
+    {
+        for(std::size_t i=0; i<amount; ++i) {
+            workers.emplace_back(&thread_pool::work, this);
+        }
+    }
+
+    // finishes every queued task first
+    ~thread_pool()
+    {
+        stop();
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+
+        available.notify_all();
+
+        for(auto & worker : workers) {
+            if(worker.joinable()) {
+                worker.join();
+            }
+        }
+    }
+
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            tasks.emplace_back(std::move(task));
+        }
+
+        available.notify_one();
+    }
+
+    std::size_t size() const
+    {
+        return workers.size();
+    }
+};
+
+#endif
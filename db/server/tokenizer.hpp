@@ -0,0 +1,155 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+
+// a word of a command, pointing into the buffer it was read from
+// only valid for as long as that buffer is
+struct token
+{
+    const char * data;
+    std::size_t size;
+
+    token()
+    : data(nullptr)
+    , size(0)
+    {}
+
+    token(const char * data, const std::size_t size)
+    : data(data)
+    , size(size)
+    {}
+
+    bool empty() const
+    {
+        return size == 0;
+    }
+
+    char operator[](const std::size_t i) const
+    {
+        return data[i];
+    }
+
+    std::string str() const
+    {
+        return std::string(data, size);
+    }
+
+    bool operator==(const char * s) const
+    {
+        return std::strlen(s) == size && std::memcmp(data, s, size) == 0;
+    }
+
+    bool operator!=(const char * s) const
+    {
+        return ! (*this == s);
+    }
+
+    // lower must be lowercase
+    bool iequals(const char * lower) const
+    {
+        std::size_t i { 0 };
+
+        for(; i<size && lower[i] != '\0'; ++i) {
+            const char c { data[i] >= 'A' && data[i] <= 'Z' ? static_cast<char>(data[i] - 'A' + 'a') : data[i] };
+
+            if(c != lower[i]) {
+                return false;
+            }
+        }
+
+        return i == size && lower[i] == '\0';
+    }
+};
+
+inline bool is_space(const char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+// splits [begin, end) on whitespace in a single pass
+// tokens is cleared first and keeps its capacity, so a reused vector
+// stops allocating once it has seen the longest command
+inline void tokenize(const char * begin, const char * end, std::vector<token> & tokens)
+{
+    tokens.clear();
+
+    while(begin < end) {
+        while(begin < end && is_space(*begin)) {
+            ++begin;
+        }
+
+        const char * start { begin };
+
+        while(begin < end && ! is_space(*begin)) {
+            ++begin;
+        }
+
+        if(begin > start) {
+            tokens.emplace_back(start, static_cast<std::size_t>(begin - start));
+        }
+    }
+}
+
+enum class parse_error { NONE, INVALID, RANGE };
+
+// base 10, digits only, no exceptions
+inline parse_error parse_number(const token & t, std::size_t & n)
+{
+    if(t.empty()) {
+        return parse_error::INVALID;
+    }
+
+    constexpr std::size_t max { static_cast<std::size_t>(-1) };
+    n = 0;
+
+    for(std::size_t i=0; i<t.size; ++i) {
+        const unsigned digit { static_cast<unsigned>(t[i] - '0') };
+
+        if(digit > 9) {
+            return parse_error::INVALID;
+        }
+
+        if(n > (max - digit) / 10) {
+            return parse_error::RANGE;
+        }
+
+        n = n * 10 + digit;
+    }
+
+    return parse_error::NONE;
+}
+
+// finite decimal or exponent notation, no exceptions
+// strtod needs a terminated string, which a token is not
+inline parse_error parse_double(const token & t, double & d)
+{
+    char buffer[64];
+
+    if(t.empty() || t.size >= sizeof(buffer)) {
+        return parse_error::INVALID;
+    }
+
+    std::memcpy(buffer, t.data, t.size);
+    buffer[t.size] = '\0';
+
+    char * end;
+    d = std::strtod(buffer, &end);
+
+    if(end != buffer + t.size) {
+        return parse_error::INVALID;
+    }
+
+    if(! std::isfinite(d)) {
+        return parse_error::RANGE;
+    }
+
+    return parse_error::NONE;
+}
+
+#endif
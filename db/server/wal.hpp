@@ -0,0 +1,899 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <limits>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../../includes/codec.hpp"
+
+enum class wal_op : std::uint8_t { CREATE = 1, DROP, CLEAR, RESIZE, PUT, UPDATE, SNAPSHOT, WEIGHTS, MPUT, BASE };
+
+// ALWAYS   : a write returns once it is on disk, concurrent writers share fsyncs
+// EVERYSEC : a write returns at once, the log is flushed and synced every second
+// NONE     : a write returns at once, the log is flushed every second, the os syncs
+enum class sync_policy { ALWAYS, EVERYSEC, NONE };
+
+struct wal_record
+{
+    wal_op op;
+    std::string db_name;
+
+    // CREATE RESIZE SNAPSHOT
+    std::size_t width;
+
+    // UPDATE
+    std::size_t concept_id;
+
+    // PUT UPDATE MPUT, and the positions weights go to for WEIGHTS
+    std::vector<std::size_t> traits;
+
+    // MPUT, how many of traits belong to each concept, in order
+    std::vector<std::size_t> sizes;
+
+    // WEIGHTS, one per entry of traits
+    std::vector<double> weights;
+
+    // SNAPSHOT: every record of db_name before base_lsn is contained in file
+    // BASE: the lsn of the record after it, see write_ahead_log::compact
+    std::uint64_t base_lsn;
+    std::string file;
+
+    wal_record(const wal_op op, const std::string & db_name)
+    : op(op)
+    , db_name(db_name)
+    , width(0)
+    , concept_id(0)
+    , traits()
+    , sizes()
+    , weights()
+    , base_lsn(0)
+    , file()
+    {}
+};
+
+// each record is framed as:
+//   u32 payload length
+//   u32 fnv-1a checksum of payload
+//   payload: u8 op, then varint fields
+// a torn or corrupt tail is cut off during replay
+// a compacted log starts with a BASE record, so lsns carry on across rewrites
+class write_ahead_log
+{
+private:
+    typedef std::function<bool(std::uint64_t, const wal_record &)> visitor;
+
+    static constexpr std::uint64_t no_snapshot { std::numeric_limits<std::uint64_t>::max() };
+
+    // how much is read from the log at once
+    static constexpr std::size_t read_size { 1024 * 1024 };
+
+    // records that must be dead before the log is worth rewriting
+    static constexpr std::uint64_t compact_min { 1024 };
+
+    std::string path;
+    sync_policy policy;
+    int fd;
+
+    // bytes of whole records written to fd
+    off_t written;
+
+    std::mutex mtx;
+    std::condition_variable flushed;
+    std::condition_variable wake;
+    std::thread flusher;
+
+    std::vector<std::uint8_t> pending;
+    std::uint64_t next_lsn;
+    std::uint64_t synced_lsn;
+    bool flushing;
+    bool stopping;
+
+    // a write or sync failed, after which nothing more is written or
+    // reported durable, as the log may be torn
+    bool failed;
+
+    // lsn of the first record in the file
+    std::uint64_t first_lsn;
+
+    // base lsn of each live database's latest snapshot, or no_snapshot
+    std::unordered_map<std::string, std::uint64_t> snapshots;
+    bool compacting;
+
+    static std::uint32_t checksum(const std::uint8_t * data, const std::size_t len)
+    {
+        std::uint32_t h { 2166136261u };
+
+        for(std::size_t i=0; i<len; ++i) {
+            h ^= data[i];
+            h *= 16777619u;
+        }
+
+        return h;
+    }
+
+    static void put_u32(std::vector<std::uint8_t> & out, const std::uint32_t v)
+    {
+        const std::size_t start { out.size() };
+        out.resize(start + sizeof(std::uint32_t));
+        std::memcpy(&out[start], &v, sizeof(std::uint32_t));
+    }
+
+    static void put_string(std::vector<std::uint8_t> & out, const std::string & s)
+    {
+        sdr::put_varint(out, static_cast<std::uint32_t>(s.size()));
+        out.insert(out.end(), s.begin(), s.end());
+    }
+
+    static void put_u64(std::vector<std::uint8_t> & out, const std::uint64_t v)
+    {
+        sdr::put_varint(out, static_cast<std::uint32_t>(v));
+        sdr::put_varint(out, static_cast<std::uint32_t>(v >> 32));
+    }
+
+    // traits are sorted and delta coded
+    static void put_traits(std::vector<std::uint8_t> & out, const std::vector<std::size_t> & traits)
+    {
+        put_traits(out, traits.begin(), traits.end());
+    }
+
+    static void put_traits(
+        std::vector<std::uint8_t> & out,
+        const std::vector<std::size_t>::const_iterator begin,
+        const std::vector<std::size_t>::const_iterator end
+    ) {
+        std::vector<std::size_t> sorted(begin, end);
+        std::sort(sorted.begin(), sorted.end());
+
+        sdr::put_varint(out, static_cast<std::uint32_t>(sorted.size()));
+
+        std::size_t last { 0 };
+        for(const std::size_t t : sorted) {
+            sdr::put_varint(out, static_cast<std::uint32_t>(t - last));
+            last = t;
+        }
+    }
+
+    // positions as given, each followed by its weight as 8 raw bytes
+    static void put_weights(std::vector<std::uint8_t> & out, const std::vector<std::size_t> & positions, const std::vector<double> & weights)
+    {
+        sdr::put_varint(out, static_cast<std::uint32_t>(positions.size()));
+
+        for(std::size_t i=0; i<positions.size(); ++i) {
+            sdr::put_varint(out, static_cast<std::uint32_t>(positions[i]));
+
+            const std::size_t start { out.size() };
+            out.resize(start + sizeof(double));
+            std::memcpy(&out[start], &weights[i], sizeof(double));
+        }
+    }
+
+    static const std::uint8_t * get_string(const std::uint8_t * in, const std::uint8_t * end, std::string & s)
+    {
+        std::uint32_t len;
+        in = sdr::get_varint(in, end, len);
+
+        if(in == nullptr || static_cast<std::size_t>(end - in) < len) {
+            return nullptr;
+        }
+
+        s.assign(reinterpret_cast<const char*>(in), len);
+        return in + len;
+    }
+
+    static const std::uint8_t * get_size(const std::uint8_t * in, const std::uint8_t * end, std::size_t & v)
+    {
+        std::uint32_t n;
+        in = sdr::get_varint(in, end, n);
+        v = n;
+        return in;
+    }
+
+    static const std::uint8_t * get_u64(const std::uint8_t * in, const std::uint8_t * end, std::uint64_t & v)
+    {
+        std::uint32_t lo, hi;
+
+        in = sdr::get_varint(in, end, lo);
+        if(in == nullptr) {
+            return nullptr;
+        }
+
+        in = sdr::get_varint(in, end, hi);
+        v = (static_cast<std::uint64_t>(hi) << 32) | lo;
+        return in;
+    }
+
+    static const std::uint8_t * get_traits(const std::uint8_t * in, const std::uint8_t * end, std::vector<std::size_t> & traits)
+    {
+        std::uint32_t amount;
+        in = sdr::get_varint(in, end, amount);
+
+        std::size_t last { 0 };
+        for(std::uint32_t i=0; in != nullptr && i<amount; ++i) {
+            std::uint32_t delta;
+            in = sdr::get_varint(in, end, delta);
+
+            last += delta;
+            traits.emplace_back(last);
+        }
+
+        return in;
+    }
+
+    static const std::uint8_t * get_weights(
+        const std::uint8_t * in,
+        const std::uint8_t * end,
+        std::vector<std::size_t> & positions,
+        std::vector<double> & weights
+    ) {
+        std::uint32_t amount;
+        in = sdr::get_varint(in, end, amount);
+
+        for(std::uint32_t i=0; in != nullptr && i<amount; ++i) {
+            std::uint32_t pos;
+            in = sdr::get_varint(in, end, pos);
+
+            if(in == nullptr || static_cast<std::size_t>(end - in) < sizeof(double)) {
+                return nullptr;
+            }
+
+            double w;
+            std::memcpy(&w, in, sizeof(double));
+            in += sizeof(double);
+
+            positions.emplace_back(pos);
+            weights.emplace_back(w);
+        }
+
+        return in;
+    }
+
+    static void encode(std::vector<std::uint8_t> & out, const wal_record & rec)
+    {
+        const std::size_t start { out.size() };
+
+        // length and checksum are filled in after the payload
+        put_u32(out, 0);
+        put_u32(out, 0);
+
+        out.emplace_back(static_cast<std::uint8_t>(rec.op));
+        put_string(out, rec.db_name);
+
+        switch(rec.op) {
+            case wal_op::CREATE:
+            case wal_op::RESIZE:
+                sdr::put_varint(out, static_cast<std::uint32_t>(rec.width));
+                break;
+            case wal_op::PUT:
+                put_traits(out, rec.traits);
+                break;
+            case wal_op::UPDATE:
+                sdr::put_varint(out, static_cast<std::uint32_t>(rec.concept_id));
+                put_traits(out, rec.traits);
+                break;
+            case wal_op::SNAPSHOT:
+                sdr::put_varint(out, static_cast<std::uint32_t>(rec.width));
+                put_u64(out, rec.base_lsn);
+                put_string(out, rec.file);
+                break;
+            case wal_op::BASE:
+                put_u64(out, rec.base_lsn);
+                break;
+            case wal_op::WEIGHTS:
+                put_weights(out, rec.traits, rec.weights);
+                break;
+            case wal_op::MPUT:
+                {
+                    sdr::put_varint(out, static_cast<std::uint32_t>(rec.sizes.size()));
+
+                    auto it = rec.traits.cbegin();
+                    for(const std::size_t size : rec.sizes) {
+                        put_traits(out, it, it + size);
+                        it += size;
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+
+        const std::size_t payload { start + 2 * sizeof(std::uint32_t) };
+        const std::uint32_t len { static_cast<std::uint32_t>(out.size() - payload) };
+        const std::uint32_t sum { checksum(&out[payload], len) };
+
+        std::memcpy(&out[start], &len, sizeof(std::uint32_t));
+        std::memcpy(&out[start + sizeof(std::uint32_t)], &sum, sizeof(std::uint32_t));
+    }
+
+    static bool decode(const std::uint8_t * in, const std::uint8_t * end, wal_record & rec)
+    {
+        if(in == end) {
+            return false;
+        }
+
+        rec.op = static_cast<wal_op>(*in++);
+        in = get_string(in, end, rec.db_name);
+
+        if(in == nullptr) {
+            return false;
+        }
+
+        switch(rec.op) {
+            case wal_op::CREATE:
+            case wal_op::RESIZE:
+                in = get_size(in, end, rec.width);
+                break;
+            case wal_op::DROP:
+            case wal_op::CLEAR:
+                break;
+            case wal_op::PUT:
+                in = get_traits(in, end, rec.traits);
+                break;
+            case wal_op::UPDATE:
+                in = get_size(in, end, rec.concept_id);
+                if(in != nullptr) {
+                    in = get_traits(in, end, rec.traits);
+                }
+                break;
+            case wal_op::SNAPSHOT:
+                in = get_size(in, end, rec.width);
+                if(in != nullptr) {
+                    in = get_u64(in, end, rec.base_lsn);
+                }
+                if(in != nullptr) {
+                    in = get_string(in, end, rec.file);
+                }
+                break;
+            case wal_op::BASE:
+                in = get_u64(in, end, rec.base_lsn);
+                break;
+            case wal_op::WEIGHTS:
+                in = get_weights(in, end, rec.traits, rec.weights);
+                break;
+            case wal_op::MPUT:
+                {
+                    std::uint32_t amount;
+                    in = sdr::get_varint(in, end, amount);
+
+                    for(std::uint32_t i=0; in != nullptr && i<amount; ++i) {
+                        const std::size_t before { rec.traits.size() };
+                        in = get_traits(in, end, rec.traits);
+                        rec.sizes.emplace_back(rec.traits.size() - before);
+                    }
+                }
+                break;
+            default:
+                return false;
+        }
+
+        return in == end;
+    }
+
+    static bool write_all(const int to, const std::uint8_t * data, const std::size_t size)
+    {
+        std::size_t off { 0 };
+
+        while(off < size) {
+            const ssize_t n { ::write(to, data + off, size - off) };
+
+            if(n < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+
+                std::cerr << "wal write failed: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+
+            off += static_cast<std::size_t>(n);
+        }
+
+        return true;
+    }
+
+    bool write_out(const std::vector<std::uint8_t> & buf)
+    {
+        return write_all(fd, buf.data(), buf.size());
+    }
+
+    // copies [begin, end) of from onto the end of to
+    static bool copy_range(const int from, const int to, off_t begin, const off_t end)
+    {
+        std::vector<std::uint8_t> buf(read_size);
+
+        while(begin < end) {
+            const std::size_t want { static_cast<std::size_t>(std::min<off_t>(end - begin, static_cast<off_t>(buf.size()))) };
+            const ssize_t n { ::pread(from, buf.data(), want, begin) };
+
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if(n <= 0) {
+                std::cerr << "wal read failed: " << (n < 0 ? std::strerror(errno) : "unexpected end of file") << std::endl;
+                return false;
+            }
+
+            if(! write_all(to, buf.data(), static_cast<std::size_t>(n))) {
+                return false;
+            }
+
+            begin += n;
+        }
+
+        return true;
+    }
+
+    // calls visit with the lsn and contents of each intact record in
+    // [0, limit) of from, in order, until it returns false
+    // the file is read a chunk at a time rather than held in memory
+    // returns where the intact records end, or where visit stopped, and sets
+    // lsn to the lsn of the record there
+    static off_t scan(const int from, const off_t limit, const visitor & visit, std::uint64_t & lsn)
+    {
+        constexpr std::size_t header { 2 * sizeof(std::uint32_t) };
+
+        std::vector<std::uint8_t> buf(read_size);
+        std::size_t pos { 0 };
+        std::size_t filled { 0 };
+        off_t buf_off { 0 };
+        lsn = 0;
+
+        // makes at least n bytes from pos available, false at end of file
+        const auto ensure = [&](const std::size_t n) -> bool {
+            if(filled - pos >= n) {
+                return true;
+            }
+
+            std::memmove(buf.data(), buf.data() + pos, filled - pos);
+            buf_off += static_cast<off_t>(pos);
+            filled -= pos;
+            pos = 0;
+
+            if(buf.size() < n) {
+                buf.resize(n);
+            }
+
+            while(filled < n) {
+                const off_t at { buf_off + static_cast<off_t>(filled) };
+                const std::size_t want { static_cast<std::size_t>(std::min<off_t>(limit - at, static_cast<off_t>(buf.size() - filled))) };
+
+                if(want == 0) {
+                    return false;
+                }
+
+                const ssize_t got { ::pread(from, buf.data() + filled, want, at) };
+
+                if(got < 0 && errno == EINTR) {
+                    continue;
+                }
+
+                if(got <= 0) {
+                    return false;
+                }
+
+                filled += static_cast<std::size_t>(got);
+            }
+
+            return true;
+        };
+
+        while(ensure(header)) {
+            std::uint32_t len, sum;
+            std::memcpy(&len, &buf[pos], sizeof(std::uint32_t));
+            std::memcpy(&sum, &buf[pos + sizeof(std::uint32_t)], sizeof(std::uint32_t));
+
+            const off_t at { buf_off + static_cast<off_t>(pos) };
+
+            // checked before ensure so a corrupt length cannot grow buf past the file
+            if(static_cast<std::uint64_t>(limit - at) - header < len || ! ensure(header + len)) {
+                return at;
+            }
+
+            const std::uint8_t * payload { &buf[pos + header] };
+            if(checksum(payload, len) != sum) {
+                return at;
+            }
+
+            wal_record rec(wal_op::DROP, "");
+            if(! decode(payload, payload + len, rec)) {
+                return at;
+            }
+
+            if(rec.op == wal_op::BASE) {
+                lsn = rec.base_lsn;
+            } else if(! visit(lsn, rec)) {
+                return at;
+            } else {
+                ++lsn;
+            }
+
+            pos += header + len;
+        }
+
+        return buf_off + static_cast<off_t>(pos);
+    }
+
+    // caller must hold lock
+    // follows which live databases have a snapshot, so compact knows what
+    // is still needed
+    void track(const wal_record & rec)
+    {
+        switch(rec.op) {
+            case wal_op::CREATE:
+                snapshots[rec.db_name] = no_snapshot;
+                break;
+            case wal_op::DROP:
+                snapshots.erase(rec.db_name);
+                break;
+            case wal_op::SNAPSHOT:
+                snapshots[rec.db_name] = rec.base_lsn;
+                break;
+            default:
+                break;
+        }
+    }
+
+    // caller must hold lock
+    // the lsn of the oldest record a replay would use, or no_snapshot if
+    // some live database still needs the log from its create
+    std::uint64_t oldest_needed() const
+    {
+        std::uint64_t oldest { next_lsn };
+
+        for(const auto & snapshot : snapshots) {
+            if(snapshot.second == no_snapshot) {
+                return no_snapshot;
+            }
+
+            oldest = std::min(oldest, snapshot.second);
+        }
+
+        return oldest;
+    }
+
+    static bool sync_dir(const std::string & file)
+    {
+        const std::size_t slash { file.rfind('/') };
+        const std::string dir { slash == std::string::npos ? "." : (slash == 0 ? "/" : file.substr(0, slash)) };
+        const int dfd { ::open(dir.c_str(), O_RDONLY) };
+
+        if(dfd < 0) {
+            return false;
+        }
+
+        const bool ok { ::fsync(dfd) == 0 };
+        ::close(dfd);
+
+        return ok;
+    }
+
+    // caller must hold lock and not be flushing
+    // writes out everything pending, releasing lock around the io
+    // once failed, pending is dropped rather than written after a torn record
+    void flush_pending(std::unique_lock<std::mutex> & lock, const bool sync)
+    {
+        std::vector<std::uint8_t> batch;
+        batch.swap(pending);
+
+        const std::uint64_t batch_lsn { next_lsn };
+        const bool skip { failed };
+        flushing = true;
+        lock.unlock();
+
+        bool ok { ! skip && write_out(batch) };
+
+        if(ok && sync && ::fdatasync(fd) != 0) {
+            std::cerr << "wal sync failed: " << std::strerror(errno) << std::endl;
+            ok = false;
+        }
+
+        lock.lock();
+        flushing = false;
+
+        if(ok) {
+            written += static_cast<off_t>(batch.size());
+            synced_lsn = std::max(synced_lsn, batch_lsn);
+        } else {
+            failed = true;
+        }
+
+        flushed.notify_all();
+    }
+
+    void flusher_loop()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+
+        while(! stopping) {
+            wake.wait_for(lock, std::chrono::seconds(1));
+
+            while(flushing) {
+                flushed.wait(lock);
+            }
+
+            if(! pending.empty()) {
+                flush_pending(lock, policy == sync_policy::EVERYSEC);
+            }
+        }
+    }
+
+public:
+    write_ahead_log(const std::string & path, const sync_policy policy)
+    : path(path)
+    , policy(policy)
+    , fd(-1)
+    , written(0)
+    , pending()
+    , next_lsn(0)
+    , synced_lsn(0)
+    , flushing(false)
+    , stopping(false)
+    , failed(false)
+    , first_lsn(0)
+    , snapshots()
+    , compacting(false)
+    {}
+
+    ~write_ahead_log()
+    {
+        stop();
+
+        if(fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    // reads every intact record, cutting off a torn tail, then opens for appending
+    // callback receives each record with its lsn
+    bool open(const std::function<void(std::uint64_t, const wal_record &)> & callback)
+    {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+        if(fd < 0) {
+            std::cerr << "wal unable to be opened: " << path << " " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        struct stat st;
+        if(::fstat(fd, &st) != 0) {
+            return false;
+        }
+
+        bool first { true };
+
+        const off_t off { scan(fd, st.st_size, [&](const std::uint64_t lsn, const wal_record & rec) {
+            if(first) {
+                first_lsn = lsn;
+                first = false;
+            }
+
+            track(rec);
+            callback(lsn, rec);
+
+            return true;
+        }, next_lsn) };
+
+        if(first) {
+            first_lsn = next_lsn;
+        }
+
+        if(off != st.st_size) {
+            std::cerr << "wal: discarding " << (st.st_size - off) << " bytes of torn or corrupt tail" << std::endl;
+
+            if(::ftruncate(fd, off) != 0) {
+                std::cerr << "wal unable to be truncated: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+        }
+
+        ::lseek(fd, off, SEEK_SET);
+        written = off;
+        synced_lsn = next_lsn;
+
+        return true;
+    }
+
+    // reads every record again, for replays needing more than one pass
+    // must be called between open and start
+    void replay(const std::function<void(std::uint64_t, const wal_record &)> & callback) const
+    {
+        std::uint64_t lsn;
+
+        scan(fd, written, [&](const std::uint64_t at, const wal_record & rec) {
+            callback(at, rec);
+            return true;
+        }, lsn);
+    }
+
+    // the flusher thread is started separately so open can run before daemonizing
+    void start()
+    {
+        if(policy != sync_policy::ALWAYS && ! flusher.joinable()) {
+            flusher = std::thread(&write_ahead_log::flusher_loop, this);
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+
+        wake.notify_all();
+
+        if(flusher.joinable()) {
+            flusher.join();
+        }
+
+        std::unique_lock<std::mutex> lock(mtx);
+        while(flushing) {
+            flushed.wait(lock);
+        }
+
+        if(! pending.empty() && fd >= 0) {
+            flush_pending(lock, policy != sync_policy::NONE);
+        }
+    }
+
+    // queues rec and sets lsn to its lsn, see sync for durability
+    // false if the log has failed and rec was not queued
+    bool append(const wal_record & rec, std::uint64_t & lsn)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        if(failed) {
+            return false;
+        }
+
+        encode(pending, rec);
+        track(rec);
+        lsn = next_lsn++;
+
+        return true;
+    }
+
+    // with ALWAYS this blocks until lsn is on disk; whichever waiting writer
+    // gets in first syncs everything queued so far on behalf of the others
+    // kept apart from append so callers can release their locks in between
+    // false if the log has failed, in which case lsn may never be durable
+    bool sync(const std::uint64_t lsn)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+
+        if(policy != sync_policy::ALWAYS) {
+            return ! failed;
+        }
+
+        while(synced_lsn <= lsn) {
+            if(failed) {
+                return false;
+            }
+
+            if(flushing) {
+                flushed.wait(lock);
+            } else {
+                flush_pending(lock, true);
+            }
+        }
+
+        return true;
+    }
+
+    // once every live database has a snapshot, records before the oldest
+    // base lsn are contained in snapshots and only replayed to be skipped
+    // if at least as many are dead as live, the log is rewritten from there:
+    // copied beside itself after a BASE record, synced and renamed over it
+    // writers carry on during the copy and only wait for its last few records
+    // false if the rewrite failed, in which case the log is left as it was
+    bool compact()
+    {
+        std::uint64_t from;
+        off_t end;
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+
+            from = oldest_needed();
+
+            if(failed || compacting || fd < 0 || from == no_snapshot || from < first_lsn
+            || from - first_lsn < compact_min || from - first_lsn < next_lsn - from) {
+                return true;
+            }
+
+            compacting = true;
+            end = written;
+        }
+
+        const std::string tmp { path + ".compact" };
+        const int tfd { ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) };
+
+        const auto abandon = [&]() {
+            if(tfd >= 0) {
+                ::close(tfd);
+                ::unlink(tmp.c_str());
+            }
+
+            std::lock_guard<std::mutex> lock(mtx);
+            compacting = false;
+
+            return false;
+        };
+
+        if(tfd < 0) {
+            std::cerr << "wal compaction unable to open " << tmp << " " << std::strerror(errno) << std::endl;
+            return abandon();
+        }
+
+        // records up to end are never written again, so are read unlocked
+        std::uint64_t lsn;
+        const off_t start { scan(fd, end, [&](const std::uint64_t at, const wal_record &) {
+            return at < from;
+        }, lsn) };
+
+        wal_record base(wal_op::BASE, "");
+        base.base_lsn = lsn;
+
+        std::vector<std::uint8_t> head;
+        encode(head, base);
+
+        if(! write_all(tfd, head.data(), head.size()) || ! copy_range(fd, tfd, start, end) || ::fdatasync(tfd) != 0) {
+            return abandon();
+        }
+
+        std::unique_lock<std::mutex> lock(mtx);
+
+        while(flushing) {
+            flushed.wait(lock);
+        }
+
+        // whatever was written meanwhile follows, pending is flushed to tfd later
+        if(failed || ! copy_range(fd, tfd, end, written) || ::fdatasync(tfd) != 0) {
+            lock.unlock();
+            return abandon();
+        }
+
+        if(::rename(tmp.c_str(), path.c_str()) != 0) {
+            std::cerr << "wal compaction unable to rename " << tmp << " " << std::strerror(errno) << std::endl;
+            lock.unlock();
+            return abandon();
+        }
+
+        if(! sync_dir(path)) {
+            std::cerr << "wal compaction unable to sync directory of " << path << std::endl;
+        }
+
+        ::close(fd);
+        fd = tfd;
+        written = ::lseek(fd, 0, SEEK_END);
+        first_lsn = lsn;
+        compacting = false;
+
+        return true;
+    }
+
+    std::uint64_t get_next_lsn()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return next_lsn;
+    }
+};
+
+#endif
@@ -4,6 +4,10 @@
 #include "constants.hpp"
 #include "storage_concept.hpp"
 #include "concept.hpp"
+#include "codec.hpp"
+#include "query_stats.hpp"
+#include "memory.hpp"
+#include "probes.hpp"
 
 
 #include <vector>
@@ -12,15 +16,20 @@
 #include <iostream>
 #include <utility>
 #include <algorithm>
+#include <numeric>
 #include <iostream>
 #include <cmath>
 #include <future>
+#include <chrono>
+#include <functional>
 #include <thread>
 #include <fstream>
 #include <cstdint>
 #include <cstddef>
 #include <iterator>
 #include <cassert>
+#include <cstring>
+#include <memory>
 
 namespace sdr
 {
@@ -30,19 +39,60 @@ namespace sdr
 class bank
 {
 private:
+    typedef sdr::hash_set<sdr::position_t> column_type;
+    typedef std::vector<column_type, sdr::counting_allocator<column_type>> bitmap_type;
+    typedef std::vector<sdr::storage_concept, sdr::counting_allocator<sdr::storage_concept>> storage_type;
+
+    // buffers of a single closest query, counted as scratch
+    template <typename T>
+    using scratch_vector = std::vector<T, sdr::counting_allocator<T>>;
+
     std::size_t width;
 
+    // what bitmap, storage and query scratch space hold, counted by their
+    // allocators as they go
+    // on the heap so the allocators' counters stay put when the bank moves
+    std::unique_ptr<sdr::memory_usage> memory;
+
     // this holds our sets of vectors for easy comparison of different objects in storage
-    std::vector<sdr::hash_set<sdr::position_t>> bitmap;
+    bitmap_type bitmap;
 
     // all inputs we have ever received, we store here compressed into storage
-    std::vector<sdr::storage_concept> storage;
+    storage_type storage;
+
 
 
+    // passed as exclude by closest helpers when the query is not stored
+    static constexpr sdr::position_t no_position { static_cast<sdr::position_t>(-1) };
 
     // helpers are called from the public api
     // these just reduce code bloat
 
+    // width empty columns, each counting into its own counter of m
+    static bitmap_type make_bitmap(sdr::memory_usage & m)
+    {
+        bitmap_type columns { sdr::counting_allocator<column_type>(&m.column_array) };
+        columns.reserve(m.columns.size());
+
+        for(sdr::memory_counter & counter : m.columns) {
+            columns.emplace_back(0, std::hash<sdr::position_t>(), std::equal_to<sdr::position_t>(), sdr::counting_allocator<sdr::position_t>(&counter));
+            sdr::hash_set_init(columns.back());
+        }
+
+        return columns;
+    }
+
+    sdr::counting_allocator<sdr::position_t> positions_allocator() const
+    {
+        return sdr::counting_allocator<sdr::position_t>(&memory->storage);
+    }
+
+    template <typename T>
+    sdr::counting_allocator<T> scratch_allocator() const
+    {
+        return sdr::counting_allocator<T>(&memory->scratch);
+    }
+
     template <typename Collection> std::size_t similarity_helper(
         const Collection & positions,
         const sdr::position_t pos_b
@@ -63,7 +113,7 @@ private:
     }
 
     template <typename PCollection, typename WCollection>
-    std::size_t weighted_similarity_helper(
+    double weighted_similarity_helper(
         const PCollection & positions,
         const sdr::position_t pos_b,
         const WCollection & weights
@@ -108,20 +158,9 @@ private:
             }
         }
 
-        auto vit = punions.begin();
-        for(auto cit = collection.begin(); vit != punions.end() && cit != collection.end(); ++cit) {
-            sdr::position_t deref { (*vit) };
-            const sdr::position_t cmp { (*cit) };
-
-            while(deref < cmp && vit != punions.end()) {
-                ++vit;
-                deref = (*vit);
-            }
-
-            if(deref == cmp) {
-                ++result;
-                ++vit;
-            }
+        // punions is unordered, so look each position up rather than merging
+        for(const sdr::position_t cpos : collection) {
+            result += punions.count(cpos);
         }
 
         return result;
@@ -153,50 +192,143 @@ private:
             }
         }
 
-        auto vit = punions.begin();
-        for(auto cit = collection.begin(); vit != punions.end() && cit != collection.end(); ++cit) {
-            sdr::position_t deref { (*vit) };
-            const sdr::position_t cmp { (*cit) };
+        // punions is unordered, so look each position up rather than merging
+        for(const sdr::position_t cpos : collection) {
+            result += punions.count(cpos) * weights[cpos];
+        }
+
+        return result;
+    }
+
+    // exclude is the stored concept being compared, left out of its own results
+    template <typename PCollection>
+    std::vector<std::pair<sdr::position_t, std::size_t>> closest_helper(
+        const PCollection & collection,
+        const std::size_t amount,
+        const sdr::position_t exclude,
+        sdr::query_stats * stats = nullptr
+    ) const {
+        scratch_vector<sdr::position_t> idx(scratch_allocator<sdr::position_t>());
+        scratch_vector<unsigned>          v(scratch_allocator<unsigned>());
+
+        return closest_helper(collection, amount, exclude, idx, v, stats);
+    }
 
-            while(deref < cmp && vit != punions.end()) {
-                ++vit;
-                deref = (*vit);
+    // adds every column of collection into v with add(score, position)
+    // when counts is given, postings and candidates are counted on the way,
+    // a candidate being a concept whose score goes from 0 to non zero, so
+    // explaining a query costs no pass over v of its own
+    template <typename PCollection, typename Scores, typename Add>
+    void accumulate_helper(const PCollection & collection, Scores & v, const Add & add, sdr::query_stats * counts) const
+    {
+        if(! counts) {
+            for(const sdr::position_t spos : collection) {
+                for(const sdr::position_t bpos : bitmap[spos]) {
+                    add(v[bpos], spos);
+                }
             }
 
-            if(deref == cmp) {
-                result += weights[cmp];
-                ++vit;
+            return;
+        }
+
+        for(const sdr::position_t spos : collection) {
+            counts->postings += bitmap[spos].size();
+
+            for(const sdr::position_t bpos : bitmap[spos]) {
+                const bool before { v[bpos] != 0 };
+                add(v[bpos], spos);
+                const bool after { v[bpos] != 0 };
+
+                // weights may bring a score back to 0
+                if(before != after) {
+                    if(after) {
+                        ++counts->candidates;
+                    } else {
+                        --counts->candidates;
+                    }
+                }
             }
         }
+    }
 
-        return result;
+    // whether accumulate_helper needs to count, for stats or a tracer
+    static bool counting_helper(const sdr::query_stats * stats)
+    {
+        return stats != nullptr || SDR_PROBE_ENABLED(closest_accumulated);
+    }
+
+    // fires closest_accumulated with what accumulate_helper counted
+    template <typename PCollection>
+    void accumulated_probe(const PCollection & collection, const sdr::query_stats & counts) const
+    {
+        if(SDR_PROBE_ENABLED(closest_accumulated)) {
+            SDR_PROBE4(closest_accumulated, collection.size(), storage.size(), counts.postings, counts.candidates);
+        }
+    }
+
+    // fills in stats when given, see query_stats
+    void explain_helper(
+        const sdr::query_stats & counts,
+        const std::chrono::steady_clock::time_point started,
+        const std::chrono::steady_clock::time_point accumulated,
+        sdr::query_stats * stats
+    ) const {
+        if(! stats) {
+            return;
+        }
+
+        const std::chrono::steady_clock::time_point selected { std::chrono::steady_clock::now() };
+
+        stats->postings = counts.postings;
+        stats->candidates = counts.candidates;
+
+        stats->accumulate_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(accumulated - started).count());
+        stats->select_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(selected - accumulated).count());
     }
 
+    // idx and v are scratch space, kept between calls by batch_closest
     template <typename PCollection>
     std::vector<std::pair<sdr::position_t, std::size_t>> closest_helper(
         const PCollection & collection,
-        const std::size_t amount
+        const std::size_t amount,
+        const sdr::position_t exclude,
+        scratch_vector<sdr::position_t> & idx,
+        scratch_vector<unsigned> & v,
+        sdr::query_stats * stats = nullptr
     ) const {
 #ifndef NDEBUG
         for(auto & i : collection) {
             assert(i < width);
         }
 #endif
-        std::vector<sdr::position_t> idx(storage.size());
-        std::vector<unsigned>          v(storage.size());
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::time_point accumulated;
+
+        if(stats) {
+            started = std::chrono::steady_clock::now();
+        }
+
+        idx.resize(storage.size());
+        v.assign(storage.size(), 0);
 
         // if there are less than amount in storage, just return amount that exist
-        const std::size_t partial_amount { (amount + 1 >= idx.size()) ? idx.size() : amount + 1 };
+        const std::size_t wanted { amount + (exclude == no_position ? 0 : 1) };
+        const std::size_t partial_amount { (wanted >= idx.size()) ? idx.size() : wanted };
 
         std::iota(std::begin(idx), std::end(idx), 0);
 
         // count matching bits for each
-        for(const sdr::position_t spos : collection) {
-            for(const sdr::position_t bpos : bitmap[spos]) {
-                ++v[bpos];
-            }
+        sdr::query_stats counts;
+        accumulate_helper(collection, v, [](unsigned & score, const sdr::position_t) {
+            ++score;
+        }, counting_helper(stats) ? &counts : nullptr);
+
+        if(stats) {
+            accumulated = std::chrono::steady_clock::now();
         }
 
+        accumulated_probe(collection, counts);
+
         std::partial_sort(std::begin(idx), std::begin(idx) + partial_amount, std::end(idx), [&](
             const sdr::position_t a,
             const sdr::position_t b
@@ -208,11 +340,17 @@ private:
         std::vector<std::pair<sdr::position_t, std::size_t>> ret;
         ret.reserve(partial_amount);
 
-        for(std::size_t i=1; i<partial_amount; ++i) {
+        for(std::size_t i=0; i<partial_amount && ret.size() < amount; ++i) {
             const sdr::position_t m { idx[i] };
-            ret.emplace_back(std::make_pair(m, static_cast<std::size_t>(v[m])));
+            if(m != exclude) {
+                ret.emplace_back(std::make_pair(m, static_cast<std::size_t>(v[m])));
+            }
         }
 
+        SDR_PROBE2(closest_selected, amount, ret.size());
+
+        explain_helper(counts, started, accumulated, stats);
+
         return ret;
     }
 
@@ -220,21 +358,38 @@ private:
         const sdr::position_t pos,
         const std::size_t amount
     ) const {
-        return closest_helper(storage[pos].positions, amount);
+        return closest_helper(storage[pos].positions, amount, pos);
+    }
+
+    void batch_closest_helper(
+        const std::vector<sdr::position_t> & positions,
+        const std::size_t amount,
+        const std::size_t first,
+        const std::size_t last,
+        std::vector<std::vector<std::pair<sdr::position_t, std::size_t>>> & results
+    ) const {
+        scratch_vector<sdr::position_t> idx(scratch_allocator<sdr::position_t>());
+        scratch_vector<unsigned>          v(scratch_allocator<unsigned>());
+
+        for(std::size_t i=first; i<last; ++i) {
+            results[i] = closest_helper(storage[positions[i]].positions, amount, positions[i], idx, v);
+        }
     }
 
     std::vector<std::pair<sdr::position_t, std::size_t>> async_closest_helper_concept(
         const sdr::concept & concept,
         const std::size_t amount
     ) const {
-        return closest_helper(concept.data, amount);
+        return closest_helper(concept.data, amount, no_position);
     }
 
     template <typename PCollection, typename WCollection>
     std::vector<std::pair<sdr::position_t, double>> weighted_closest_helper(
-        const PCollection collection,
+        const PCollection & collection,
         const std::size_t amount,
-        const WCollection & weights
+        const sdr::position_t exclude,
+        const WCollection & weights,
+        sdr::query_stats * stats = nullptr
     ) const {
 #ifndef NDEBUG
         for(auto & i : collection) {
@@ -242,21 +397,34 @@ private:
         }
         assert(weights.size() == width);
 #endif
-        std::vector<sdr::position_t> idx(storage.size());
-        std::vector<double>            v(storage.size());
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::time_point accumulated;
+
+        if(stats) {
+            started = std::chrono::steady_clock::now();
+        }
+
+        scratch_vector<sdr::position_t> idx(storage.size(), 0, scratch_allocator<sdr::position_t>());
+        scratch_vector<double>            v(storage.size(), 0.0, scratch_allocator<double>());
 
         // if there are less than amount in storage, just return amount that exist
-        const std::size_t partial_amount { (amount + 1 >= idx.size()) ? idx.size() : amount + 1 };
+        const std::size_t wanted { amount + (exclude == no_position ? 0 : 1) };
+        const std::size_t partial_amount { (wanted >= idx.size()) ? idx.size() : wanted };
 
         std::iota(std::begin(idx), std::end(idx), 0);
 
         // count matching bits for each
-        for(const sdr::position_t spos : collection) {
-            for(const sdr::position_t bpos : bitmap[spos]) {
-                v[bpos] += weights[spos];
-            }
+        sdr::query_stats counts;
+        accumulate_helper(collection, v, [&](double & score, const sdr::position_t spos) {
+            score += weights[spos];
+        }, counting_helper(stats) ? &counts : nullptr);
+
+        if(stats) {
+            accumulated = std::chrono::steady_clock::now();
         }
 
+        accumulated_probe(collection, counts);
+
         std::partial_sort(std::begin(idx), std::begin(idx) + partial_amount, std::end(idx), [&](
             const sdr::position_t a,
             const sdr::position_t b
@@ -268,11 +436,17 @@ private:
         std::vector<std::pair<sdr::position_t, double>> ret;
         ret.reserve(partial_amount);
 
-        for(std::size_t i=1; i<partial_amount; ++i) {
+        for(std::size_t i=0; i<partial_amount && ret.size() < amount; ++i) {
             const sdr::position_t m { idx[i] };
-            ret.emplace_back(std::make_pair(m, v[m]));
+            if(m != exclude) {
+                ret.emplace_back(std::make_pair(m, v[m]));
+            }
         }
 
+        SDR_PROBE2(closest_selected, amount, ret.size());
+
+        explain_helper(counts, started, accumulated, stats);
+
         return ret;
     }
 
@@ -282,7 +456,7 @@ private:
         const std::size_t amount,
         const WCollection & weights
     ) const {
-        return weighted_closest_helper(pos, amount, weights);
+        return weighted_closest_helper(storage[pos].positions, amount, pos, weights);
     }
 
     template <typename WCollection>
@@ -291,18 +465,156 @@ private:
         const std::size_t amount,
         const WCollection & weights
     ) const {
-        return weighted_closest_helper(concept, amount, weights);
+        return weighted_closest_helper(concept.data, amount, no_position, weights);
+    }
+
+    // a run of blocks in a loaded file which can be decoded on its own
+    struct chunk_ref
+    {
+        std::size_t first;
+        std::size_t amount;
+        const std::uint8_t * begin;
+        const std::uint8_t * end;
+    };
+
+    // decodes chunks [first, last) straight into their slots in storage
+    // and collects the postings they contribute to each column
+    bool decode_chunks_helper(
+        const std::vector<chunk_ref> & chunks,
+        const std::size_t first,
+        const std::size_t last,
+        const std::size_t block_size,
+        std::vector<std::vector<sdr::position_t>> & columns
+    ) {
+        columns.resize(width);
+
+        std::vector<std::vector<sdr::position_t>> block;
+        std::vector<std::uint32_t> scratch;
+
+        for(std::size_t c=first; c < last; ++c) {
+            const chunk_ref & chunk { chunks[c] };
+            const std::uint8_t * it { chunk.begin };
+
+            for(std::size_t start=0; start < chunk.amount; start += block_size) {
+                const std::size_t amount { std::min(block_size, chunk.amount - start) };
+
+                it = sdr::decode_block(it, chunk.end, amount, block, scratch);
+                if(it == nullptr) {
+                    return false;
+                }
+
+                for(std::size_t i=0; i < amount; ++i) {
+                    const std::vector<sdr::position_t> & positions { block[i] };
+                    const sdr::position_t pos { chunk.first + start + i };
+
+                    if(! positions.empty() && positions.back() >= width) {
+                        return false;
+                    }
+
+                    storage[pos].positions.insert(std::begin(positions), std::end(positions));
+
+                    for(const sdr::position_t p : positions) {
+                        columns[p].emplace_back(pos);
+                    }
+                }
+            }
+
+            SDR_PROBE2(load_progress, chunk.first, chunk.amount);
+        }
+
+        return true;
+    }
+
+    // builds columns [first, last) of bitmap from every thread's segments
+    void merge_columns_helper(
+        const std::vector<std::vector<std::vector<sdr::position_t>>> & segments,
+        const std::size_t first,
+        const std::size_t last
+    ) {
+        for(std::size_t col=first; col < last; ++col) {
+            std::size_t total { 0 };
+            for(auto & segment : segments) {
+                total += segment[col].size();
+            }
+
+            bitmap[col].resize(total);
+
+            for(auto & segment : segments) {
+                bitmap[col].insert(std::begin(segment[col]), std::end(segment[col]));
+            }
+        }
+    }
+
+    // chunks are decoded on every core, each thread keeping its own column
+    // segments, then columns are split between threads to be merged
+    bool load_chunks(
+        const std::vector<chunk_ref> & chunks,
+        const std::size_t storage_size,
+        const std::size_t block_size
+    ) {
+        storage.assign(storage_size, sdr::storage_concept(sdr::concept({}), positions_allocator()));
+
+        const std::size_t threads {
+            std::max<std::size_t>(1, std::min<std::size_t>(std::thread::hardware_concurrency(), chunks.size()))
+        };
+
+        std::vector<std::vector<std::vector<sdr::position_t>>> segments(threads);
+        std::vector<std::future<bool>> decoders;
+
+        for(std::size_t t=0; t < threads; ++t) {
+            const std::size_t first { chunks.size() * t / threads };
+            const std::size_t last  { chunks.size() * (t + 1) / threads };
+
+            decoders.emplace_back(std::async(std::launch::async, [&, t, first, last]() {
+                return decode_chunks_helper(chunks, first, last, block_size, segments[t]);
+            }));
+        }
+
+        bool ok { true };
+        for(auto & decoder : decoders) {
+            ok = decoder.get() && ok;
+        }
+
+        if(! ok) {
+            return false;
+        }
+
+        std::vector<std::future<void>> mergers;
+
+        for(std::size_t t=0; t < threads; ++t) {
+            const std::size_t first { width * t / threads };
+            const std::size_t last  { width * (t + 1) / threads };
+
+            mergers.emplace_back(std::async(std::launch::async, &bank::merge_columns_helper, this, std::cref(segments), first, last));
+        }
+
+        for(auto & merger : mergers) {
+            merger.get();
+        }
+
+        return true;
     }
 
 public:
     bank(const std::size_t width)
     : width(width)
-    , bitmap(width)
-    , storage()
+    , memory(new sdr::memory_usage(width))
+    , bitmap(make_bitmap(*memory))
+    , storage(sdr::counting_allocator<sdr::storage_concept>(&memory->storage))
+    {}
+
+    bank(bank && other) = default;
+
+    // the old columns and storage are freed before the counters they
+    // count into
+    bank & operator=(bank && other)
     {
-        for(auto & i : bitmap) {
-            sdr::hash_set_init(i);
-        }
+        width = other.width;
+        bitmap = std::move(other.bitmap);
+        storage = std::move(other.storage);
+        memory = std::move(other.memory);
+
+        return *this;
     }
 
     // this automatically clears before changing width
@@ -310,18 +622,20 @@ public:
     {
         clear();
 
-        width = new_width;
-        bitmap = std::vector<sdr::hash_set<sdr::position_t>>(new_width);
-        storage = std::vector<sdr::storage_concept>();
+        std::unique_ptr<sdr::memory_usage> fresh(new sdr::memory_usage(new_width));
 
-        for(auto & i : bitmap) {
-            sdr::hash_set_init(i);
-        }
+        width = new_width;
+        bitmap = make_bitmap(*fresh);
+        storage = storage_type(sdr::counting_allocator<sdr::storage_concept>(&fresh->storage));
+        memory = std::move(fresh);
     }
 
     // recomend you use .sdr extension
-    bool save_to_file(const std::string & src) const
-    {
+    // progress is called with the amount of concepts written after each chunk
+    bool save_to_file(
+        const std::string & src,
+        const std::function<void(std::size_t)> & progress = std::function<void(std::size_t)>()
+    ) const {
         std::ofstream ofs(src, std::ios::out | std::ios::binary);
 
         if(! ofs) {
@@ -344,31 +658,94 @@ public:
 
         //storage
         write(static_cast<std::uint32_t>(storage.size()));
-        for(auto & item : storage) {
-            write(static_cast<std::uint32_t>(item.positions.size()));
+        write(sdr::F_BLOCK_SIZE);
+
+        const std::size_t chunk_count { (storage.size() + sdr::F_CHUNK_SIZE - 1) / sdr::F_CHUNK_SIZE };
+        write(static_cast<std::uint32_t>(chunk_count));
+
+        // chunk directory is filled in once each chunk has been encoded
+        const std::streampos directory { ofs.tellp() };
+        for(std::size_t i=0; i < chunk_count; ++i) {
+            write(0);
+            write(0);
+        }
+
+        std::vector<std::uint32_t> chunk_bytes;
+        chunk_bytes.reserve(chunk_count);
+
+        std::vector<std::uint8_t> buf;
+        std::vector<std::vector<std::uint32_t>> block;
+
+        for(std::size_t chunk_start=0; chunk_start < storage.size(); chunk_start += sdr::F_CHUNK_SIZE) {
+            const std::size_t chunk_stop { std::min(chunk_start + sdr::F_CHUNK_SIZE, storage.size()) };
+
+            buf.clear();
+
+            for(std::size_t start=chunk_start; start < chunk_stop; start += sdr::F_BLOCK_SIZE) {
+                const std::size_t stop { std::min(start + sdr::F_BLOCK_SIZE, chunk_stop) };
+
+                block.resize(stop - start);
+                for(std::size_t i=start; i < stop; ++i) {
+                    std::vector<std::uint32_t> & positions { block[i - start] };
 
-            for(auto & i : item.positions) {
-                write(static_cast<std::uint32_t>(i));
+                    positions.assign(std::begin(storage[i].positions), std::end(storage[i].positions));
+                    std::sort(std::begin(positions), std::end(positions));
+                }
+
+                sdr::encode_block(buf, block);
+            }
+
+            ofs.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+            chunk_bytes.emplace_back(static_cast<std::uint32_t>(buf.size()));
+
+            SDR_PROBE2(save_progress, chunk_stop, storage.size());
+
+            if(progress) {
+                progress(chunk_stop);
             }
         }
 
+        ofs.seekp(directory);
+        for(std::size_t i=0; i < chunk_count; ++i) {
+            write(static_cast<std::uint32_t>(std::min(sdr::F_CHUNK_SIZE, storage.size() - i * sdr::F_CHUNK_SIZE)));
+            write(chunk_bytes[i]);
+        }
+
 
         ofs.close();
 
-        return true;
+        return static_cast<bool>(ofs);
     }
 
     std::size_t load_from_file(const std::string & src)
     {
-        std::ifstream ifs(src, std::ios::binary);
+        std::ifstream ifs(src, std::ios::binary | std::ios::ate);
         if(! ifs) {
             std::cerr << "file not found: " << src << std::endl;
             return false;
         }
 
+        // read it all at once, padded so blocks can be unpacked a word at a time
+        const std::size_t file_size { static_cast<std::size_t>(ifs.tellg()) };
+        std::vector<std::uint8_t> buf(file_size + sizeof(std::uint64_t));
+
+        ifs.seekg(0);
+        ifs.read(reinterpret_cast<char*>(buf.data()), file_size);
+
+        const std::uint8_t * it  { buf.data() };
+        const std::uint8_t * end { buf.data() + file_size };
+        bool truncated { false };
+
         auto read = [&]() -> std::uint32_t {
-            std::uint32_t v;
-            ifs.read(reinterpret_cast<char*>(&v), sizeof(std::uint32_t));
+            std::uint32_t v { 0 };
+
+            if(end - it < static_cast<std::ptrdiff_t>(sizeof(std::uint32_t))) {
+                truncated = true;
+                return v;
+            }
+
+            std::memcpy(&v, it, sizeof(std::uint32_t));
+            it += sizeof(std::uint32_t);
             return v;
         };
 
@@ -384,7 +761,7 @@ public:
         // version
         const std::uint32_t version { read() };
 
-        if(version != sdr::F_VERSION) {
+        if(version != sdr::F_VERSION && version != sdr::F_VERSION_UNCHUNKED && version != sdr::F_VERSION_RAW) {
             std::cerr << "wrong version. found:" << version << " expected: " << sdr::F_VERSION << std::endl;
             return false;
         }
@@ -403,17 +780,92 @@ public:
         // storage
         const std::size_t storage_size { read() };
 
-        for(std::size_t i=0; i < storage_size; ++i) {
-            const std::size_t size { static_cast<std::size_t>(read()) };
+        if(version == sdr::F_VERSION_RAW) {
+            // every concept takes at least its u32 position count, and every
+            // position a u32, so counts are checked against the bytes left
+            // before anything is reserved for them
+            const auto left = [&]() {
+                return static_cast<std::size_t>(end - it) / sizeof(std::uint32_t);
+            };
+
+            truncated = truncated || storage_size > left();
 
+            if(! truncated) {
+                storage.reserve(storage_size);
+            }
 
             std::vector<sdr::position_t> positions;
 
-            for(std::size_t j=0; j < size; ++j) {
-                positions.emplace_back(static_cast<sdr::position_t>(read()));
+            for(std::size_t i=0; i < storage_size && ! truncated; ++i) {
+                const std::size_t size { static_cast<std::size_t>(read()) };
+
+                if(truncated || size > left()) {
+                    truncated = true;
+                    break;
+                }
+
+                positions.clear();
+
+                for(std::size_t j=0; j < size; ++j) {
+                    const std::uint32_t p { read() };
+
+                    if(p >= width) {
+                        truncated = true;
+                        break;
+                    }
+
+                    positions.emplace_back(static_cast<sdr::position_t>(p));
+                }
+
+                if(! truncated) {
+                    insert(sdr::concept(positions));
+                }
             }
+        } else {
+            const std::size_t block_size { read() };
+
+            // every concept takes at least one byte for its position count
+            truncated = truncated || block_size == 0 || storage_size > file_size;
+
+            std::vector<chunk_ref> chunks;
+
+            // version 2 files are a single chunk without a directory
+            if(version == sdr::F_VERSION_UNCHUNKED) {
+                chunks.emplace_back(chunk_ref { 0, storage_size, it, end });
+            } else {
+                const std::size_t chunk_count { read() };
+                std::vector<std::pair<std::size_t, std::size_t>> directory;
+
+                for(std::size_t i=0; i < chunk_count && ! truncated; ++i) {
+                    const std::size_t amount { read() };
+                    const std::size_t bytes  { read() };
+                    directory.emplace_back(std::make_pair(amount, bytes));
+                }
 
-            insert(sdr::concept(positions));
+                std::size_t first { 0 };
+                for(auto & entry : directory) {
+                    if(static_cast<std::size_t>(end - it) < entry.second) {
+                        truncated = true;
+                        break;
+                    }
+
+                    chunks.emplace_back(chunk_ref { first, entry.first, it, it + entry.second });
+                    first += entry.first;
+                    it += entry.second;
+                }
+
+                truncated = truncated || first != storage_size;
+            }
+
+            if(! truncated) {
+                truncated = ! load_chunks(chunks, storage_size, block_size);
+            }
+        }
+
+        if(truncated) {
+            std::cerr << "file is truncated or corrupt: " << src << std::endl;
+            clear();
+            return false;
         }
 
         return storage_size;
@@ -426,7 +878,7 @@ public:
             assert(i < width);
         }
 #endif
-        storage.emplace_back(sdr::storage_concept(concept));
+        storage.emplace_back(sdr::storage_concept(concept, positions_allocator()));
 
         const sdr::position_t last_pos { storage.size() - 1 };
 
@@ -434,9 +886,49 @@ public:
             bitmap[pos].insert(last_pos);
         }
 
+        SDR_PROBE2(insert, last_pos, concept.data.size());
+
         return last_pos;
     }
 
+    // inserts concepts at consecutive positions, returning the first
+    // each column is grown once for the whole batch rather than rehashing
+    // as it fills
+    sdr::position_t bulk_insert(const std::vector<sdr::concept> & concepts)
+    {
+        const sdr::position_t first_pos { storage.size() };
+
+        std::vector<std::size_t> added(width);
+        for(const sdr::concept & concept : concepts) {
+            for(const sdr::position_t pos : concept.data) {
+                assert(pos < width);
+                ++added[pos];
+            }
+        }
+
+        for(std::size_t col=0; col<width; ++col) {
+            if(added[col]) {
+                bitmap[col].resize(bitmap[col].size() + added[col]);
+            }
+        }
+
+        storage.reserve(storage.size() + concepts.size());
+
+        for(const sdr::concept & concept : concepts) {
+            storage.emplace_back(sdr::storage_concept(concept, positions_allocator()));
+
+            const sdr::position_t last_pos { storage.size() - 1 };
+
+            for(sdr::position_t pos : concept.data) {
+                bitmap[pos].insert(last_pos);
+            }
+
+            SDR_PROBE2(insert, last_pos, concept.data.size());
+        }
+
+        return first_pos;
+    }
+
     void update(
         const sdr::position_t pos,
         const sdr::concept & concept
@@ -460,6 +952,8 @@ public:
         for(sdr::position_t p : storage_concept.positions) {
             bitmap[p].insert(pos);
         }
+
+        SDR_PROBE2(update, pos, concept.data.size());
     }
 
     void clear()
@@ -476,6 +970,26 @@ public:
         return storage.size();
     }
 
+    // bytes held by each part of the bank, see memory_usage
+    const sdr::memory_usage & get_memory_usage() const
+    {
+        return *memory;
+    }
+
+    // the traits of the concept at pos, in order
+    sdr::concept get_concept(const sdr::position_t pos) const
+    {
+        std::vector<sdr::position_t> positions(std::begin(storage[pos].positions), std::end(storage[pos].positions));
+        std::sort(std::begin(positions), std::end(positions));
+
+        return sdr::concept(positions);
+    }
+
+    std::size_t get_column_size(const sdr::position_t pos) const
+    {
+        return bitmap[pos].size();
+    }
+
     std::size_t get_width() const
     {
         return width;
@@ -551,21 +1065,58 @@ public:
     // find most similar to object at pos
     // first refers to position
     // second refers to matching number of bits
+    // stats, when given, is filled in with what the query did
     std::vector<std::pair<sdr::position_t, std::size_t>> closest(
         const sdr::position_t pos,
-        const std::size_t amount
+        const std::size_t amount,
+        sdr::query_stats * stats = nullptr
     ) const {
 #ifndef NDEBUG
         assert(pos < storage.size());
 #endif
-        return closest_helper(storage[pos].positions, amount);
+        return closest_helper(storage[pos].positions, amount, pos, stats);
     }
 
+    // concept need not be stored, so nothing is left out of the results
     std::vector<std::pair<sdr::position_t, std::size_t>> closest(
         const sdr::concept & concept,
+        const std::size_t amount,
+        sdr::query_stats * stats = nullptr
+    ) const {
+        return closest_helper(concept.data, amount, no_position, stats);
+    }
+
+    // closest for each of positions, in the same order
+    // positions are split between cores, each reusing its count buffers
+    std::vector<std::vector<std::pair<sdr::position_t, std::size_t>>> batch_closest(
+        const std::vector<sdr::position_t> & positions,
         const std::size_t amount
     ) const {
-        return closest_helper(concept.data, amount);
+#ifndef NDEBUG
+        for(auto & i : positions) {
+            assert(i < storage.size());
+        }
+#endif
+        std::vector<std::vector<std::pair<sdr::position_t, std::size_t>>> results(positions.size());
+
+        const std::size_t threads {
+            std::max<std::size_t>(1, std::min<std::size_t>(std::thread::hardware_concurrency(), positions.size()))
+        };
+
+        std::vector<std::future<void>> workers;
+
+        for(std::size_t t=0; t < threads; ++t) {
+            const std::size_t first { positions.size() * t / threads };
+            const std::size_t last  { positions.size() * (t + 1) / threads };
+
+            workers.emplace_back(std::async(std::launch::async, &bank::batch_closest_helper, this, std::cref(positions), amount, first, last, std::ref(results)));
+        }
+
+        for(auto & worker : workers) {
+            worker.get();
+        }
+
+        return results;
     }
 
     std::future<std::vector<std::pair<sdr::position_t, std::size_t>>> async_closest(
@@ -592,21 +1143,23 @@ public:
     std::vector<std::pair<sdr::position_t, double>> weighted_closest(
         const sdr::position_t pos,
         const std::size_t amount,
-        const WCollection & weights
+        const WCollection & weights,
+        sdr::query_stats * stats = nullptr
     ) const {
 #ifndef NDEBUG
         assert(pos < storage.size());
 #endif
-        return weighted_closest_helper(storage[pos].positions, amount, weights);
+        return weighted_closest_helper(storage[pos].positions, amount, pos, weights, stats);
     }
 
     template <typename WCollection>
     std::vector<std::pair<sdr::position_t, double>> weighted_closest(
         const sdr::concept & concept,
         const std::size_t amount,
-        const WCollection & weights
+        const WCollection & weights,
+        sdr::query_stats * stats = nullptr
     ) const {
-        return weighted_closest_helper(concept.data, amount, weights);
+        return weighted_closest_helper(concept.data, amount, no_position, weights, stats);
     }
 
     template <typename WCollection>
@@ -681,7 +1234,7 @@ public:
             }
         }
 
-        return { std::begin(matching), std::begin(matching) };
+        return { std::begin(matching), std::end(matching) };
     }
 
     // has to match amount in data
@@ -0,0 +1,197 @@
+#ifndef SDR_CODEC_H_
+#define SDR_CODEC_H_
+
+#include "constants.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+
+
+namespace sdr
+{
+
+// on disk, concepts are grouped into blocks of F_BLOCK_SIZE
+// each block is laid out as:
+//   varint position count for every concept in the block
+//   u8 bit width shared by the whole block
+//   sorted positions of every concept, delta coded and bit packed at that width
+//
+// a block always decodes independently of any other block
+
+inline void put_varint(std::vector<std::uint8_t> & out, std::uint32_t v)
+{
+    while(v >= 0x80) {
+        out.emplace_back(static_cast<std::uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+
+    out.emplace_back(static_cast<std::uint8_t>(v));
+}
+
+// returns nullptr if the varint runs past end
+inline const std::uint8_t * get_varint(
+    const std::uint8_t * in,
+    const std::uint8_t * end,
+    std::uint32_t & v
+) {
+    v = 0;
+
+    for(unsigned shift=0; in < end && shift < 35; shift += 7) {
+        const std::uint8_t byte { *in++ };
+        v |= static_cast<std::uint32_t>(byte & 0x7F) << shift;
+
+        if(! (byte & 0x80)) {
+            return in;
+        }
+    }
+
+    return nullptr;
+}
+
+inline std::uint8_t bits_needed(std::uint32_t v)
+{
+    std::uint8_t bits { 0 };
+
+    while(v) {
+        ++bits;
+        v >>= 1;
+    }
+
+    return bits;
+}
+
+inline std::size_t packed_size(const std::size_t amount, const std::uint8_t bits)
+{
+    return (amount * bits + 7) / 8;
+}
+
+// appends values packed little endian at bits each
+inline void pack_bits(
+    std::vector<std::uint8_t> & out,
+    const std::vector<std::uint32_t> & values,
+    const std::uint8_t bits
+) {
+    const std::size_t start { out.size() };
+    out.resize(start + packed_size(values.size(), bits), 0);
+
+    for(std::size_t i=0; i<values.size(); ++i) {
+        const std::size_t bitpos { i * bits };
+        std::uint64_t v { static_cast<std::uint64_t>(values[i]) << (bitpos & 7) };
+
+        for(std::size_t b = start + (bitpos >> 3); v; ++b, v >>= 8) {
+            out[b] |= static_cast<std::uint8_t>(v & 0xFF);
+        }
+    }
+}
+
+// in must be readable for 8 bytes past the packed data
+// every value is pulled out of one unaligned 64 bit load so the loop has no
+// branches and no dependency between iterations, which lets it vectorise
+inline void unpack_bits(
+    const std::uint8_t * in,
+    const std::size_t amount,
+    const std::uint8_t bits,
+    std::uint32_t * out
+) {
+    const std::uint64_t mask { (1ull << bits) - 1 };
+
+    for(std::size_t i=0; i<amount; ++i) {
+        const std::size_t bitpos { i * bits };
+
+        std::uint64_t word;
+        std::memcpy(&word, in + (bitpos >> 3), sizeof(word));
+
+        out[i] = static_cast<std::uint32_t>((word >> (bitpos & 7)) & mask);
+    }
+}
+
+// each entry of block must be sorted ascending
+inline void encode_block(
+    std::vector<std::uint8_t> & out,
+    const std::vector<std::vector<std::uint32_t>> & block
+) {
+    std::vector<std::uint32_t> deltas;
+    std::uint32_t largest { 0 };
+
+    for(auto & positions : block) {
+        put_varint(out, static_cast<std::uint32_t>(positions.size()));
+
+        std::uint32_t last { 0 };
+        for(const std::uint32_t p : positions) {
+            deltas.emplace_back(p - last);
+            largest = std::max(largest, p - last);
+            last = p;
+        }
+    }
+
+    const std::uint8_t bits { bits_needed(largest) };
+    out.emplace_back(bits);
+
+    pack_bits(out, deltas, bits);
+}
+
+// decodes amount concepts into block, reusing its storage
+// returns nullptr if the block is malformed or runs past end
+// end must be followed by 8 readable bytes, see unpack_bits
+inline const std::uint8_t * decode_block(
+    const std::uint8_t * in,
+    const std::uint8_t * end,
+    const std::size_t amount,
+    std::vector<std::vector<sdr::position_t>> & block,
+    std::vector<std::uint32_t> & scratch
+) {
+    // counts are checked against the bytes left before anything is
+    // allocated for them, so a corrupt file fails rather than exhausting memory
+    scratch.resize(amount);
+
+    std::size_t total { 0 };
+    for(std::size_t i=0; i<amount; ++i) {
+        in = get_varint(in, end, scratch[i]);
+
+        if(in == nullptr || scratch[i] > std::numeric_limits<std::size_t>::max() - total) {
+            return nullptr;
+        }
+
+        total += scratch[i];
+    }
+
+    if(in >= end) {
+        return nullptr;
+    }
+
+    const std::uint8_t bits { *in++ };
+    const std::size_t bytes { packed_size(total, bits) };
+
+    // with no bits, every delta is 0, so a concept holds at most position 0
+    if(bits > 32 || (bits == 0 && total > amount) || static_cast<std::size_t>(end - in) < bytes) {
+        return nullptr;
+    }
+
+    block.resize(amount);
+    for(std::size_t i=0; i<amount; ++i) {
+        block[i].resize(scratch[i]);
+    }
+
+    scratch.resize(total);
+    unpack_bits(in, total, bits, scratch.data());
+
+    const std::uint32_t * delta { scratch.data() };
+    for(auto & positions : block) {
+        sdr::position_t last { 0 };
+
+        for(auto & p : positions) {
+            last += *delta++;
+            p = last;
+        }
+    }
+
+    return in + bytes;
+}
+
+} //namespace sdr
+
+#endif
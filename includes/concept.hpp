@@ -7,6 +7,7 @@
 #include <array>
 #include <bitset>
 #include <algorithm>
+#include <numeric>
 #include <cstddef>
 #include <iterator>
 
@@ -2,8 +2,10 @@
 #define SDR_CONSTANTS_H_
 
 #include <sparsehash/dense_hash_set>
+#include "memory.hpp"
 #include <utility>
 #include <limits>
+#include <cstdint>
 
 namespace sdr
 {
@@ -12,10 +14,23 @@ typedef std::size_t position_t;
 typedef std::size_t width_t;
 
 constexpr std::uint32_t F_PREFIX  { 0x5D };
-constexpr std::uint32_t F_VERSION { 0x01 };
+constexpr std::uint32_t F_VERSION { 0x03 };
 
+// files written before positions were delta coded and bit packed
+constexpr std::uint32_t F_VERSION_RAW { 0x01 };
+
+// files written before blocks were grouped into chunks with a directory
+constexpr std::uint32_t F_VERSION_UNCHUNKED { 0x02 };
+
+// amount of concepts sharing one bit width on disk
+constexpr std::uint32_t F_BLOCK_SIZE { 128 };
+
+// amount of concepts in each independently decodable chunk
+constexpr std::size_t F_CHUNK_SIZE { 8192 };
+
+// counts nothing unless given a counting_allocator with a counter
 template <typename T>
-using hash_set = google::dense_hash_set<T, std::hash<T>>;
+using hash_set = google::dense_hash_set<T, std::hash<T>, std::equal_to<T>, sdr::counting_allocator<T>>;
 
 template <typename T>
 void hash_set_init(hash_set<T> & hset)
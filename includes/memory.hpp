@@ -0,0 +1,187 @@
+#ifndef SDR_MEMORY_H_
+#define SDR_MEMORY_H_
+
+#include <vector>
+#include <atomic>
+#include <new>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+
+namespace sdr
+{
+
+// bytes held through the allocators counting into it, and the most it
+// has held at once
+// atomic as queries allocate scratch space alongside each other
+struct memory_counter
+{
+    std::atomic<std::size_t> bytes;
+    std::atomic<std::size_t> peak;
+
+    memory_counter()
+    : bytes(0)
+    , peak(0)
+    {}
+
+    memory_counter(const memory_counter &) = delete;
+    memory_counter & operator=(const memory_counter &) = delete;
+
+    void add(const std::size_t n)
+    {
+        const std::size_t now { bytes.fetch_add(n, std::memory_order_relaxed) + n };
+        std::size_t seen { peak.load(std::memory_order_relaxed) };
+
+        while(now > seen && ! peak.compare_exchange_weak(seen, now, std::memory_order_relaxed)) {
+        }
+    }
+
+    void sub(const std::size_t n)
+    {
+        bytes.fetch_sub(n, std::memory_order_relaxed);
+    }
+
+    std::size_t get() const
+    {
+        return bytes.load(std::memory_order_relaxed);
+    }
+
+    std::size_t get_peak() const
+    {
+        return peak.load(std::memory_order_relaxed);
+    }
+};
+
+// allocates with new and counts what it holds into counter
+// a default constructed one counts nothing, so sets and vectors made for a
+// single query cost the same as with std::allocator
+// copies count into the same counter, and containers take their
+// allocator along when assigned, so moving a bank's containers keeps them
+// counted where they were
+template <typename T>
+class counting_allocator
+{
+public:
+    typedef T value_type;
+    typedef T * pointer;
+    typedef const T * const_pointer;
+    typedef T & reference;
+    typedef const T & const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef counting_allocator<U> other;
+    };
+
+    memory_counter * counter;
+
+    counting_allocator()
+    : counter(nullptr)
+    {}
+
+    explicit counting_allocator(memory_counter * counter)
+    : counter(counter)
+    {}
+
+    template <typename U>
+    counting_allocator(const counting_allocator<U> & other)
+    : counter(other.counter)
+    {}
+
+    pointer allocate(const size_type n, const void * = nullptr)
+    {
+        pointer p { static_cast<pointer>(::operator new(n * sizeof(T))) };
+
+        if(counter) {
+            counter->add(n * sizeof(T));
+        }
+
+        return p;
+    }
+
+    void deallocate(const pointer p, const size_type n)
+    {
+        if(counter) {
+            counter->sub(n * sizeof(T));
+        }
+
+        ::operator delete(p);
+    }
+
+    size_type max_size() const
+    {
+        return std::numeric_limits<size_type>::max() / sizeof(T);
+    }
+
+    pointer address(reference x) const
+    {
+        return &x;
+    }
+
+    const_pointer address(const_reference x) const
+    {
+        return &x;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U * p, Args &&... args)
+    {
+        ::new(static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    void destroy(U * p)
+    {
+        p->~U();
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const counting_allocator<T> & a, const counting_allocator<U> & b)
+{
+    return a.counter == b.counter;
+}
+
+template <typename T, typename U>
+bool operator!=(const counting_allocator<T> & a, const counting_allocator<U> & b)
+{
+    return a.counter != b.counter;
+}
+
+// where a bank's memory goes
+struct memory_usage
+{
+    // the hash table of each column, one counter per column
+    std::vector<memory_counter> columns;
+
+    // the array of columns itself
+    memory_counter column_array;
+
+    // the forward store, its array and every concept's positions
+    memory_counter storage;
+
+    // counting buffers of closest queries while they run
+    memory_counter scratch;
+
+    explicit memory_usage(const std::size_t width)
+    : columns(width)
+    , column_array()
+    , storage()
+    , scratch()
+    {}
+
+    memory_usage(const memory_usage &) = delete;
+    memory_usage & operator=(const memory_usage &) = delete;
+};
+
+}
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef SDR_PERF_COUNTERS_H_
+#define SDR_PERF_COUNTERS_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace sdr
+{
+
+// hardware events counted around queries
+// dtlb misses are of data loads
+enum class perf_event : std::uint8_t { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, DTLB_MISSES };
+
+constexpr std::size_t perf_event_count { 5 };
+
+inline const char * perf_event_name(const std::size_t i)
+{
+    static const char * names[perf_event_count] {
+        "cycles", "instructions", "cache_misses", "branch_misses", "dtlb_misses"
+    };
+
+    return names[i];
+}
+
+// one reading of every event
+// an event the cpu or kernel would not count stays 0 and is not available
+struct perf_values
+{
+    std::uint64_t values[perf_event_count];
+
+    perf_values()
+    {
+        std::memset(values, 0, sizeof(values));
+    }
+
+    std::uint64_t operator[](const perf_event e) const
+    {
+        return values[static_cast<std::size_t>(e)];
+    }
+
+    // what was counted since earlier
+    perf_values operator-(const perf_values & earlier) const
+    {
+        perf_values d;
+
+        for(std::size_t i=0; i<perf_event_count; ++i) {
+            d.values[i] = values[i] - earlier.values[i];
+        }
+
+        return d;
+    }
+};
+
+// the events as one perf_event_open group counting the calling thread in
+// user space, so they are scheduled together and their ratios hold
+// open it on the thread it is to count, and read it from that thread
+// does nothing off linux, or where perf_event_paranoid, a vm or seccomp
+// keeps every event from opening
+class perf_counters
+{
+private:
+    int fds[perf_event_count];
+
+    // index of each event in a group read, -1 if it did not open
+    int slots[perf_event_count];
+    std::size_t opened;
+    int leader;
+
+#ifdef __linux__
+    static int open_event(const std::uint32_t type, const std::uint64_t config, const int group)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group, 0));
+    }
+#endif
+
+public:
+    perf_counters()
+    : opened(0)
+    , leader(-1)
+    {
+        for(std::size_t i=0; i<perf_event_count; ++i) {
+            fds[i] = -1;
+            slots[i] = -1;
+        }
+
+#ifdef __linux__
+        const std::uint32_t types[perf_event_count] {
+            PERF_TYPE_HARDWARE,
+            PERF_TYPE_HARDWARE,
+            PERF_TYPE_HARDWARE,
+            PERF_TYPE_HARDWARE,
+            PERF_TYPE_HW_CACHE
+        };
+
+        const std::uint64_t configs[perf_event_count] {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+            PERF_COUNT_HW_CACHE_DTLB
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+        };
+
+        // the first event to open leads the group, the rest join it
+        for(std::size_t i=0; i<perf_event_count; ++i) {
+            fds[i] = open_event(types[i], configs[i], leader);
+
+            if(fds[i] < 0) {
+                continue;
+            }
+
+            if(leader < 0) {
+                leader = fds[i];
+            }
+
+            slots[i] = static_cast<int>(opened++);
+        }
+#endif
+    }
+
+    perf_counters(const perf_counters &) = delete;
+    perf_counters & operator=(const perf_counters &) = delete;
+
+    ~perf_counters()
+    {
+#ifdef __linux__
+        for(const int fd : fds) {
+            if(fd >= 0) {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    bool available() const
+    {
+        return leader >= 0;
+    }
+
+    bool available(const perf_event e) const
+    {
+        return slots[static_cast<std::size_t>(e)] >= 0;
+    }
+
+    // every event of the group in a single read
+    bool read(perf_values & out) const
+    {
+#ifdef __linux__
+        if(leader < 0) {
+            return false;
+        }
+
+        // u64 amount of events, then each one's value
+        std::uint64_t buffer[1 + perf_event_count];
+
+        const ssize_t wanted { static_cast<ssize_t>((1 + opened) * sizeof(std::uint64_t)) };
+
+        if(::read(leader, buffer, sizeof(buffer)) != wanted) {
+            return false;
+        }
+
+        for(std::size_t i=0; i<perf_event_count; ++i) {
+            out.values[i] = slots[i] >= 0 ? buffer[1 + slots[i]] : 0;
+        }
+
+        return true;
+#else
+        (void) out;
+        return false;
+#endif
+    }
+};
+
+}
+
+#endif
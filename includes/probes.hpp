@@ -0,0 +1,67 @@
+#ifndef SDR_PROBES_H_
+#define SDR_PROBES_H_
+
+// usdt tracepoints of provider sdr, for bpftrace, perf probe and systemtap
+// built in with -DSDR_USDT (make USDT=1), which needs sys/sdt.h from
+// systemtap's sdt headers, and compiled away otherwise
+//
+// a probe is a single nop until a tracer attaches to it
+// each has a semaphore the tracer raises while attached, so arguments that
+// take work to find are only found then, see SDR_PROBE_ENABLED
+//
+// probes and their arguments:
+//   closest_accumulated   bits, concepts, postings, candidates
+//   closest_selected      amount, results
+//   insert                position, bits
+//   update                position, bits
+//   save_progress         concepts written, concepts
+//   load_progress         first concept, amount decoded
+//   query_start           db name, command name, concepts
+//   query_end             db name, command name, execute ns, results
+//   connection_accept     connection id, fd
+//   connection_close      connection id
+//
+//   bpftrace -e 'usdt:./dist/sdrdb-server:sdr:query_end { @[str(arg1)] = hist(arg2); }'
+
+#ifdef SDR_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+// weak, so every translation unit including this shares one of each
+#define SDR_PROBE_SEMAPHORE(name) \
+    extern "C" { __attribute__((weak, unused, section(".probes"))) volatile unsigned short sdr_##name##_semaphore; }
+
+#define SDR_PROBE_ENABLED(name) __builtin_expect(sdr_##name##_semaphore != 0, 0)
+
+#define SDR_PROBE1(name, a)             DTRACE_PROBE1(sdr, name, a)
+#define SDR_PROBE2(name, a, b)          DTRACE_PROBE2(sdr, name, a, b)
+#define SDR_PROBE3(name, a, b, c)       DTRACE_PROBE3(sdr, name, a, b, c)
+#define SDR_PROBE4(name, a, b, c, d)    DTRACE_PROBE4(sdr, name, a, b, c, d)
+
+#else
+
+#define SDR_PROBE_SEMAPHORE(name)
+
+#define SDR_PROBE_ENABLED(name) false
+
+// arguments are named but never evaluated, so nothing goes unused
+#define SDR_PROBE1(name, a)             do { (void) sizeof(a); } while(0)
+#define SDR_PROBE2(name, a, b)          do { (void) sizeof(a); (void) sizeof(b); } while(0)
+#define SDR_PROBE3(name, a, b, c)       do { (void) sizeof(a); (void) sizeof(b); (void) sizeof(c); } while(0)
+#define SDR_PROBE4(name, a, b, c, d)    do { (void) sizeof(a); (void) sizeof(b); (void) sizeof(c); (void) sizeof(d); } while(0)
+
+#endif
+
+SDR_PROBE_SEMAPHORE(closest_accumulated)
+SDR_PROBE_SEMAPHORE(closest_selected)
+SDR_PROBE_SEMAPHORE(insert)
+SDR_PROBE_SEMAPHORE(update)
+SDR_PROBE_SEMAPHORE(save_progress)
+SDR_PROBE_SEMAPHORE(load_progress)
+SDR_PROBE_SEMAPHORE(query_start)
+SDR_PROBE_SEMAPHORE(query_end)
+SDR_PROBE_SEMAPHORE(connection_accept)
+SDR_PROBE_SEMAPHORE(connection_close)
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef SDR_QUERY_STATS_H_
+#define SDR_QUERY_STATS_H_
+
+#include <cstdint>
+#include <cstddef>
+
+namespace sdr
+{
+
+// what a closest query did, filled in by the bank when given one
+// tells a hot bit with a huge column apart from a large amount
+struct query_stats
+{
+    // column entries read while counting shared bits
+    std::size_t postings;
+
+    // concepts sharing at least one bit with the query
+    std::size_t candidates;
+
+    // time spent counting shared bits, then picking the top amount
+    std::uint64_t accumulate_ns;
+    std::uint64_t select_ns;
+
+    query_stats()
+    : postings(0)
+    , candidates(0)
+    , accumulate_ns(0)
+    , select_ns(0)
+    {}
+};
+
+}
+
+#endif
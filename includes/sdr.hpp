@@ -7,6 +7,8 @@
 #include "constants.hpp"
 #include "concept.hpp"
 #include "storage_concept.hpp"
+#include "codec.hpp"
+#include "query_stats.hpp"
 #include "bank.hpp"
 
 #endif
@@ -7,6 +7,7 @@
 
 #include <iterator>
 #include <vector>
+#include <functional>
 
 
 namespace sdr
@@ -19,8 +20,12 @@ struct storage_concept
     // store the positions of all set bits from 0 -> width
     sdr::hash_set<sdr::position_t> positions;
 
-    explicit storage_concept(const sdr::concept & concept)
-     : positions()
+    // alloc counts positions into the bank's memory_usage
+    explicit storage_concept(
+        const sdr::concept & concept,
+        const sdr::counting_allocator<sdr::position_t> & alloc = sdr::counting_allocator<sdr::position_t>()
+    )
+     : positions(0, std::hash<sdr::position_t>(), std::equal_to<sdr::position_t>(), alloc)
     {
         sdr::hash_set_init(positions);
         fill(concept);